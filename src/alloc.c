@@ -3,8 +3,17 @@
 #include "logging.h"
 #include "alloc.h"
 
+#ifdef CORVUS_TEST
+// allocations made by the current thread, checked by tests
+__thread long long cv_alloc_count = 0;
+#define COUNT_ALLOC() (cv_alloc_count++)
+#else
+#define COUNT_ALLOC()
+#endif
+
 void *cv_raw_malloc(size_t size, const char *file, int line)
 {
+    COUNT_ALLOC();
     void *ptr = je_malloc(size);
     if (ptr == NULL) {
         LOG(ERROR, "Fatal: OOM trying to allocate %d bytes at %s:%d", size,
@@ -16,6 +25,7 @@ void *cv_raw_malloc(size_t size, const char *file, int line)
 
 void *cv_raw_calloc(size_t number, size_t size, const char *file, int line)
 {
+    COUNT_ALLOC();
     void *ptr = je_calloc(number, size);
     if (ptr == NULL) {
         LOG(ERROR, "Fatal: OOM trying to allocate %d bytes at %s:%d",
@@ -27,6 +37,7 @@ void *cv_raw_calloc(size_t number, size_t size, const char *file, int line)
 
 void *cv_raw_realloc(void *ptr, size_t size, const char *file, int line)
 {
+    COUNT_ALLOC();
     void *newptr = je_realloc(ptr, size);
     if (newptr == NULL) {
         LOG(ERROR, "Fatal: OOM trying to allocate %d bytes at %s:%d", size,
@@ -23,4 +23,8 @@ void *cv_raw_realloc(void *ptr, size_t size, const char *file, int line);
 void cv_free(void *ptr);
 char *cv_raw_strndup(const char *other, size_t size, const char *file, int line);
 
+#ifdef CORVUS_TEST
+extern __thread long long cv_alloc_count;
+#endif
+
 #endif /* end of include guard: ALLOC_H */
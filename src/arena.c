@@ -0,0 +1,167 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "arena.h"
+#include "alloc.h"
+#include "logging.h"
+
+// prefer memory of the NUMA node the calling thread is running on
+static void arena_bind(void *addr)
+{
+#if defined(SYS_getcpu) && defined(SYS_mbind)
+    unsigned cpu, node;
+    unsigned long mask[16];
+    size_t bits = sizeof(unsigned long) * 8;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1) return;
+    if (node >= sizeof(mask) * 8) return;
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_mbind, addr, ARENA_CHUNK_SIZE, MPOL_PREFERRED,
+                mask, sizeof(mask) * 8, 0) == -1)
+    {
+        LOG(DEBUG, "arena: mbind to node %u: %s", node, strerror(errno));
+    }
+#endif
+}
+
+static uint8_t *arena_map(bool *huge)
+{
+    uint8_t *p;
+    uintptr_t start;
+
+    p = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *huge = true;
+        return p;
+    }
+
+    // no reserved huge pages, align to huge page for transparent ones
+    p = mmap(NULL, ARENA_CHUNK_SIZE * 2, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        LOG(WARN, "arena: mmap: %s", strerror(errno));
+        return NULL;
+    }
+    start = ((uintptr_t)p + ARENA_CHUNK_SIZE - 1) & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1);
+    if (start > (uintptr_t)p) {
+        munmap(p, start - (uintptr_t)p);
+    }
+    munmap((uint8_t*)start + ARENA_CHUNK_SIZE,
+            (uintptr_t)p + ARENA_CHUNK_SIZE - start);
+#ifdef MADV_HUGEPAGE
+    madvise((void*)start, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    *huge = false;
+    return (uint8_t*)start;
+}
+
+static struct arena_chunk *arena_chunk_create(struct arena *arena, int size_class)
+{
+    bool huge;
+    uint8_t *base = arena_map(&huge);
+    if (base == NULL) return NULL;
+    arena_bind(base);
+
+    struct arena_chunk *chunk = cv_calloc(1, sizeof(struct arena_chunk));
+    chunk->base = base;
+    chunk->huge = huge;
+    chunk->total = ARENA_CHUNK_SIZE / arena->sizes[size_class];
+
+    arena->nchunks++;
+    if (huge) arena->huge_chunks++;
+    arena->empty[size_class]++;
+    return chunk;
+}
+
+static void arena_chunk_free(struct arena *arena, struct arena_chunk *chunk)
+{
+    munmap(chunk->base, ARENA_CHUNK_SIZE);
+    arena->nchunks--;
+    if (chunk->huge) arena->huge_chunks--;
+    cv_free(chunk);
+}
+
+void arena_init(struct arena *arena, bool enabled, uint32_t sizes[])
+{
+    memset(arena, 0, sizeof(struct arena));
+    arena->enabled = enabled;
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        arena->sizes[i] = sizes[i];
+        TAILQ_INIT(&arena->chunks[i]);
+    }
+}
+
+void arena_destroy(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        while (!TAILQ_EMPTY(&arena->chunks[i])) {
+            chunk = TAILQ_FIRST(&arena->chunks[i]);
+            TAILQ_REMOVE(&arena->chunks[i], chunk, next);
+            arena_chunk_free(arena, chunk);
+        }
+        arena->empty[i] = 0;
+    }
+}
+
+/*
+ * A buffer of `size_class` and its chunk, or NULL if the arena is
+ * disabled, the buffers don't fit in a chunk or mmap fails.
+ */
+void *arena_alloc(struct arena *arena, int size_class, struct arena_chunk **chunk)
+{
+    void *buf;
+    struct arena_chunk_tqh *chunks = &arena->chunks[size_class];
+    struct arena_chunk *c = TAILQ_FIRST(chunks);
+
+    if (!arena->enabled || arena->sizes[size_class] > ARENA_CHUNK_SIZE) return NULL;
+
+    if (c == NULL || c->used >= c->total) {
+        if ((c = arena_chunk_create(arena, size_class)) == NULL) return NULL;
+        TAILQ_INSERT_HEAD(chunks, c, next);
+    }
+
+    if (c->free != NULL) {
+        buf = c->free;
+        c->free = *(void**)buf;
+    } else {
+        buf = c->base + (size_t)c->bump++ * arena->sizes[size_class];
+    }
+    if (c->used++ == 0) arena->empty[size_class]--;
+
+    // full chunks go after the ones with free buffers
+    if (c->used >= c->total && TAILQ_NEXT(c, next) != NULL) {
+        TAILQ_REMOVE(chunks, c, next);
+        TAILQ_INSERT_TAIL(chunks, c, next);
+    }
+    *chunk = c;
+    return buf;
+}
+
+void arena_free(struct arena *arena, int size_class, struct arena_chunk *chunk, void *buf)
+{
+    struct arena_chunk_tqh *chunks = &arena->chunks[size_class];
+
+    *(void**)buf = chunk->free;
+    chunk->free = buf;
+
+    if (chunk->used-- >= chunk->total && TAILQ_FIRST(chunks) != chunk) {
+        TAILQ_REMOVE(chunks, chunk, next);
+        TAILQ_INSERT_HEAD(chunks, chunk, next);
+    }
+    if (chunk->used > 0) return;
+
+    // give empty chunks back to the kernel beyond a few
+    if (arena->empty[size_class] >= ARENA_FREE_CHUNKS) {
+        TAILQ_REMOVE(chunks, chunk, next);
+        arena_chunk_free(arena, chunk);
+    } else {
+        arena->empty[size_class]++;
+    }
+}
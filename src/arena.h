@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/queue.h>
+#include "mbuf.h"
+
+#define ARENA_CHUNK_SIZE (2 << 20)  // one huge page
+#define ARENA_FREE_CHUNKS 1  // empty chunks kept per size class
+
+// huge page carved into buffers of one size class
+struct arena_chunk {
+    TAILQ_ENTRY(arena_chunk) next;
+    uint8_t *base;
+    void *free;  // returned buffers, linked through their first bytes
+    uint32_t bump;  // buffers from this index are never used
+    uint32_t used;
+    uint32_t total;
+    bool huge;  // from MAP_HUGETLB rather than transparent huge pages
+};
+
+TAILQ_HEAD(arena_chunk_tqh, arena_chunk);
+
+/*
+ * Buffer memory of a worker thread, reserved in huge pages preferably
+ * on the NUMA node of the thread. Chunks with free buffers are kept
+ * before full ones.
+ */
+struct arena {
+    bool enabled;
+    uint32_t sizes[MBUF_CLASSES];
+    struct arena_chunk_tqh chunks[MBUF_CLASSES];
+    int empty[MBUF_CLASSES];
+    long long nchunks;
+    long long huge_chunks;
+};
+
+void arena_init(struct arena *arena, bool enabled, uint32_t sizes[]);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, int size_class, struct arena_chunk **chunk);
+void arena_free(struct arena *arena, int size_class, struct arena_chunk *chunk, void *buf);
+
+#endif /* end of include guard: ARENA_H */
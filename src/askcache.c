@@ -0,0 +1,107 @@
+#include <string.h>
+#include <time.h>
+#include "corvus.h"
+#include "askcache.h"
+#include "alloc.h"
+#include "logging.h"
+
+/*
+ * Entry of the first key of `cmd`, the key is copied to `key`.
+ * Returns NULL if the key can't be cached.
+ */
+static struct askcache_entry *askcache_find(struct askcache *cache,
+        struct command *cmd, char *key, int *len)
+{
+    uint32_t h = 2166136261u;
+
+    if (cmd->slot < 0 || cmd->slot >= REDIS_CLUSTER_SLOTS) return NULL;
+
+    *len = cmd_copy_key(cmd, key, ASKCACHE_KEY_LEN);
+    if (*len < 0 || *len > ASKCACHE_KEY_LEN) return NULL;
+
+    for (int i = 0; i < *len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return &cache->entries[h & (ASKCACHE_SIZE - 1)];
+}
+
+static bool askcache_match(struct askcache_entry *e, struct command *cmd,
+        char *key, int len)
+{
+    return e->slot == cmd->slot && e->len == len && memcmp(e->key, key, len) == 0;
+}
+
+void askcache_init(struct askcache *cache)
+{
+    cache->slot_expire = cv_calloc(REDIS_CLUSTER_SLOTS, sizeof(uint32_t));
+    cache->entries = cv_calloc(ASKCACHE_SIZE, sizeof(struct askcache_entry));
+}
+
+void askcache_free(struct askcache *cache)
+{
+    cv_free(cache->slot_expire);
+    cv_free(cache->entries);
+    cache->slot_expire = NULL;
+    cache->entries = NULL;
+}
+
+// remember the key of `cmd` redirected by ASK to `addr`
+void askcache_set(struct askcache *cache, struct command *cmd, char *addr)
+{
+    char key[ASKCACHE_KEY_LEN + 1];
+    int len;
+    struct address a;
+
+    // a bad address leaves the entry in the bucket untouched
+    if (socket_parse_addr(addr, &a) == CORVUS_ERR) return;
+
+    struct askcache_entry *e = askcache_find(cache, cmd, key, &len);
+    if (e == NULL) return;
+
+    e->addr = a;
+    e->expire = time(NULL) + ASKCACHE_TTL;
+    e->slot = cmd->slot;
+    e->len = len;
+    memcpy(e->key, key, len);
+    cache->slot_expire[cmd->slot] = e->expire;
+}
+
+/*
+ * Whether the key of `cmd` was recently redirected by ASK, the importing
+ * node is copied to `addr`. Only slots with unexpired entries pay for the
+ * key lookup.
+ */
+bool askcache_get(struct askcache *cache, struct command *cmd, struct address *addr)
+{
+    char key[ASKCACHE_KEY_LEN + 1];
+    int len;
+
+    if (cmd->slot < 0 || cmd->slot >= REDIS_CLUSTER_SLOTS) return false;
+    if (cache->slot_expire[cmd->slot] == 0) return false;
+
+    int64_t now = time(NULL);
+    if (cache->slot_expire[cmd->slot] < now) {
+        cache->slot_expire[cmd->slot] = 0;
+        return false;
+    }
+
+    struct askcache_entry *e = askcache_find(cache, cmd, key, &len);
+    if (e == NULL || e->expire < now || !askcache_match(e, cmd, key, len)) {
+        return false;
+    }
+    memcpy(addr, &e->addr, sizeof(struct address));
+    return true;
+}
+
+// drop the key of `cmd` after the importing node redirected it elsewhere
+void askcache_del(struct askcache *cache, struct command *cmd)
+{
+    char key[ASKCACHE_KEY_LEN + 1];
+    int len;
+    struct askcache_entry *e = askcache_find(cache, cmd, key, &len);
+
+    if (e != NULL && askcache_match(e, cmd, key, len)) {
+        e->expire = 0;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef ASKCACHE_H
+#define ASKCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "socket.h"
+
+#define ASKCACHE_SIZE 1024
+#define ASKCACHE_KEY_LEN 64
+#define ASKCACHE_TTL 10
+
+struct command;
+
+struct askcache_entry {
+    int64_t expire;  // seconds, zero if unused
+    int slot;
+    int len;
+    char key[ASKCACHE_KEY_LEN];
+    struct address addr;
+};
+
+/*
+ * Keys of migrating slots recently redirected by ASK, per worker thread.
+ * A key moved to the importing node stays there during the migration, so
+ * following commands of the key are sent there with ASKING directly.
+ * Keys longer than ASKCACHE_KEY_LEN are not cached.
+ */
+struct askcache {
+    uint32_t *slot_expire;  // latest expire time of entries of each slot
+    struct askcache_entry *entries;
+};
+
+void askcache_init(struct askcache *cache);
+void askcache_free(struct askcache *cache);
+void askcache_set(struct askcache *cache, struct command *cmd, char *addr);
+bool askcache_get(struct askcache *cache, struct command *cmd, struct address *addr);
+void askcache_del(struct askcache *cache, struct command *cmd);
+
+#endif /* end of include guard: ASKCACHE_H */
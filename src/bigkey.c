@@ -0,0 +1,182 @@
+#include <string.h>
+#include <stdlib.h>
+#include "corvus.h"
+#include "bigkey.h"
+#include "alloc.h"
+#include "logging.h"
+
+static bool bigkey_same_key(struct bigkey_entry *e, struct bigkey_entry *o)
+{
+    return e->kind == o->kind && e->cmd_type == o->cmd_type && e->len == o->len
+        && memcmp(e->key, o->key, MIN(e->len, BIGKEY_KEY_LEN)) == 0;
+}
+
+static void bigkey_update_min(struct bigkey_list *list)
+{
+    uint32_t min = list->entries[0].bytes;
+
+    if (list->len < BIGKEY_TOPN) {
+        min = 0;
+    } else {
+        for (int i = 1; i < list->len; i++) {
+            if (list->entries[i].bytes < min) min = list->entries[i].bytes;
+        }
+    }
+    __atomic_store_n(&list->min, min, __ATOMIC_RELAXED);
+}
+
+/* one entry per key and command, keeping the largest size seen */
+static void bigkey_update(struct bigkey_list *list, struct bigkey_entry *entry)
+{
+    struct bigkey_entry *e = NULL;
+    int i;
+
+    for (i = 0; i < list->len; i++) {
+        if (bigkey_same_key(&list->entries[i], entry)) {
+            e = &list->entries[i];
+            if (e->bytes >= entry->bytes) return;
+            break;
+        }
+    }
+
+    if (e == NULL) {
+        if (list->len < BIGKEY_TOPN) {
+            e = &list->entries[list->len++];
+        } else {
+            e = &list->entries[0];
+            for (i = 1; i < list->len; i++) {
+                if (list->entries[i].bytes < e->bytes) e = &list->entries[i];
+            }
+            if (e->bytes >= entry->bytes) return;
+        }
+    }
+
+    memcpy(e, entry, sizeof(struct bigkey_entry));
+    bigkey_update_min(list);
+}
+
+void bigkey_init(struct bigkey_table *table)
+{
+    memset(table, 0, sizeof(struct bigkey_table));
+}
+
+// called by the owner thread
+static void bigkey_clear(struct bigkey_table *t)
+{
+    unsigned reset = __atomic_load_n(&t->reset, __ATOMIC_RELAXED);
+    if (reset == t->cleared) return;
+
+    seq_write_begin(&t->seq);
+    for (int i = 0; i < 2; i++) {
+        t->lists[i].len = 0;
+        bigkey_update_min(&t->lists[i]);
+    }
+    t->cleared = reset;
+    seq_write_end(&t->seq);
+}
+
+/*
+ * Called by worker threads for each successful reply from redis. Sub
+ * commands of multiple keys commands are reported with their first key
+ * and the parent command type.
+ */
+void bigkey_record(struct command *cmd, uint32_t req_bytes, uint32_t rep_bytes)
+{
+    struct bigkey_table *t = &cmd->ctx->bigkeys;
+    struct command *c = cmd->parent != NULL ? cmd->parent : cmd;
+    struct bigkey_entry e;
+    long long argc;
+
+    bigkey_clear(t);
+    bool req = req_bytes > __atomic_load_n(&t->lists[BIGKEY_REQUEST].min, __ATOMIC_RELAXED);
+    bool rep = rep_bytes > __atomic_load_n(&t->lists[BIGKEY_REPLY].min, __ATOMIC_RELAXED);
+    if (!req && !rep) return;
+
+    e.len = cmd_copy_key(cmd, e.key, BIGKEY_KEY_LEN);
+    if (e.len < 0) {
+        e.len = 0;
+        e.key[0] = '\0';
+    }
+    e.cmd_type = c->cmd_type;
+    if (cmd->parent == NULL) {
+        argc = cmd->keys + 1;
+    } else {
+        argc = cmd->key_count * (c->cmd_type == CMD_MSET ? 2 : 1) + 1;
+    }
+    strncpy(e.node, cmd->server != NULL ? cmd->server->info->dsn : "", ADDRESS_LEN);
+    e.node[ADDRESS_LEN] = '\0';
+
+    seq_write_begin(&t->seq);
+    if (req) {
+        e.kind = BIGKEY_REQUEST;
+        e.bytes = req_bytes;
+        e.elements = argc;
+        bigkey_update(&t->lists[BIGKEY_REQUEST], &e);
+    }
+    if (rep) {
+        e.kind = BIGKEY_REPLY;
+        e.bytes = rep_bytes;
+        e.elements = cmd->reply_type == REP_ARRAY ? cmd->rep_elements : 1;
+        bigkey_update(&t->lists[BIGKEY_REPLY], &e);
+    }
+    seq_write_end(&t->seq);
+}
+
+// lists of a worker thread are hidden until the owner has cleared them
+void bigkey_reset(struct context *contexts)
+{
+    for (int i = 0; i < config.thread; i++) {
+        ATOMIC_INC(contexts[i].bigkeys.reset, 1);
+    }
+}
+
+static int bigkey_cmp(const void *lhs, const void *rhs)
+{
+    const struct bigkey_entry *e1 = lhs, *e2 = rhs;
+    if (e1->bytes != e2->bytes) return e1->bytes > e2->bytes ? -1 : 1;
+    if (e1->kind != e2->kind) return e2->kind - e1->kind;
+    return strcmp(e1->key, e2->key);
+}
+
+/*
+ * Largest requests and replies of all worker threads in `top`, replies
+ * and requests sorted together by size. Returns the number of entries
+ * written, at most `n`. Worker threads are never blocked, a copy torn by
+ * an update is taken again.
+ */
+int bigkey_get_top(struct context *contexts, struct bigkey_entry *top, int n)
+{
+    int i, j, len, count = 0;
+    unsigned seq;
+    struct bigkey_entry *entries;
+
+    entries = cv_malloc(sizeof(struct bigkey_entry) * BIGKEY_TOPN * 2 * config.thread);
+    for (i = 0; i < config.thread; i++) {
+        struct bigkey_table *t = &contexts[i].bigkeys;
+        do {
+            seq = seq_read_begin(&t->seq);
+            len = 0;
+            if (t->cleared != __atomic_load_n(&t->reset, __ATOMIC_RELAXED)) continue;
+            for (j = 0; j < 2; j++) {
+                int n = MIN(__atomic_load_n(&t->lists[j].len, __ATOMIC_RELAXED), BIGKEY_TOPN);
+                memcpy(entries + count + len, t->lists[j].entries,
+                        sizeof(struct bigkey_entry) * n);
+                len += n;
+            }
+        } while (seq_read_retry(&t->seq, seq));
+        count += len;
+    }
+
+    qsort(entries, count, sizeof(struct bigkey_entry), bigkey_cmp);
+
+    // the same key may be seen by several threads, keep the largest
+    int m = 0;
+    for (i = 0; i < count && m < n; i++) {
+        for (j = 0; j < m; j++) {
+            if (bigkey_same_key(&top[j], &entries[i])) break;
+        }
+        if (j == m) top[m++] = entries[i];
+    }
+    cv_free(entries);
+    return m;
+}
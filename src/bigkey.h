@@ -0,0 +1,52 @@
+#ifndef BIGKEY_H
+#define BIGKEY_H
+
+#include <stdint.h>
+#include "socket.h"
+
+#define BIGKEY_TOPN 16
+#define BIGKEY_KEY_LEN 128
+
+enum {
+    BIGKEY_REQUEST,
+    BIGKEY_REPLY,
+};
+
+struct command;
+struct context;
+
+struct bigkey_entry {
+    int kind;
+    int cmd_type;
+    uint32_t bytes;
+    long long elements;
+    int len;  // length of the whole key, `key` may be truncated
+    char key[BIGKEY_KEY_LEN + 1];
+    char node[ADDRESS_LEN + 1];
+};
+
+struct bigkey_list {
+    uint32_t min;  // smallest size worth recording
+    int len;
+    struct bigkey_entry entries[BIGKEY_TOPN];
+};
+
+/*
+ * Largest requests and replies of a worker thread since startup or the
+ * last reset. Only the owner thread writes the lists, other threads copy
+ * them out under `seq`. A reset from another thread only bumps `reset`,
+ * the owner clears the lists on its next record.
+ */
+struct bigkey_table {
+    unsigned seq;
+    unsigned reset;
+    unsigned cleared;  // value of `reset` when the lists were cleared
+    struct bigkey_list lists[2];
+};
+
+void bigkey_init(struct bigkey_table *table);
+void bigkey_record(struct command *cmd, uint32_t req_bytes, uint32_t rep_bytes);
+void bigkey_reset(struct context *contexts);
+int bigkey_get_top(struct context *contexts, struct bigkey_entry *top, int n);
+
+#endif /* end of include guard: BIGKEY_H */
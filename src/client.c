@@ -8,25 +8,25 @@
 #include "socket.h"
 #include "logging.h"
 #include "event.h"
+#include "relay.h"
 
 #define CMD_MIN_LIMIT 64
 #define CMD_MAX_LIMIT 512
 
-int client_trigger_event(struct connection *client)
+/*
+ * Queue the client to continue parsing the input it has already read. The
+ * queue is drained by `client_run_ready` after each `event_wait`.
+ */
+void client_trigger_event(struct connection *client)
 {
     struct mbuf *buf = client->info->current_buf;
-    if (buf == NULL) {
-        return CORVUS_OK;
-    }
+    if (buf == NULL) return;
 
-    if (buf->pos < buf->last && !client->event_triggered) {
-        if (socket_trigger_event(client->ev->fd) == CORVUS_ERR) {
-            LOG(ERROR, "%s: fail to trigger readable event", __func__);
-            return CORVUS_ERR;
-        }
-        client->event_triggered = true;
+    if (buf->pos < buf->last && !client->ready_queued) {
+        client->ready_queued = true;
+        client->ctx->ready_count++;
+        TAILQ_INSERT_TAIL(&client->ctx->ready_conns, client, ready_next);
     }
-    return CORVUS_OK;
 }
 
 void client_range_clear(struct connection *client, struct command *cmd)
@@ -67,10 +67,6 @@ int client_read_socket(struct connection *client)
         buf_time_append(client->ctx, &client->info->buf_times, buf, get_time());
 
         if (buf->last < buf->end) {
-            if (conn_register(client) == CORVUS_ERR) {
-                LOG(ERROR, "%s: fail to reregister client %d", __func__, client->fd);
-                return CORVUS_ERR;
-            }
             return CORVUS_OK;
         }
     }
@@ -98,7 +94,7 @@ int client_read(struct connection *client, bool read_socket)
 
     // calculate limit
     long long free_cmds = client->ctx->mstats.free_cmds;
-    long long clients = ATOMIC_GET(client->ctx->stats.connected_clients);
+    long long clients = client->ctx->stats.basic.connected_clients;
     free_cmds /= clients;
     int limit = free_cmds > CMD_MIN_LIMIT ? free_cmds : CMD_MIN_LIMIT;
     if (limit > CMD_MAX_LIMIT) {
@@ -145,7 +141,8 @@ int client_read(struct connection *client, bool read_socket)
             }
         }
         if (cmd->parse_done && (--limit) <= 0) {
-            return client_trigger_event(client);
+            client_trigger_event(client);
+            break;
         }
     }
 
@@ -183,21 +180,17 @@ void client_make_iov(struct conn_info *info)
 
 int client_write(struct connection *client)
 {
-    struct context *ctx = client->ctx;
     struct conn_info *info = client->info;
 
+    // Replies of the finished head of cmd_queue are written right away,
+    // commands behind an unfinished one wait there to keep the order.
     if (!STAILQ_EMPTY(&info->cmd_queue)) {
         client_make_iov(info);
     }
 
     if (info->iov.len <= 0) {
         cmd_iov_reset(&info->iov);
-        return CORVUS_OK;
-    }
-
-    // wait for all cmds in cmd_queue to be done
-    struct command *cmd = STAILQ_FIRST(&client->info->cmd_queue);
-    if (cmd != NULL && cmd->parse_done && !info->quit) {
+        if (info->relay != NULL) conn_mark_dirty(info->relay->server);
         return CORVUS_OK;
     }
 
@@ -210,22 +203,20 @@ int client_write(struct connection *client)
     if (status == CORVUS_AGAIN) return CORVUS_OK;
 
     if (info->iov.cursor >= info->iov.len) {
-        cmd_iov_free(&info->iov);
-        if (info->quit) {
-            return CORVUS_ERR;
-        }
-        if (event_reregister(&ctx->loop, client, E_READABLE) == CORVUS_ERR) {
-            LOG(ERROR, "client_write: fail to reregister client %d", client->fd);
-            return CORVUS_ERR;
+        // keep the iovec array of a default size, it's reused soon
+        if (info->iov.max_size > CORVUS_IOV_MAX) {
+            cmd_iov_free(&info->iov);
+        } else {
+            cmd_iov_reset(&info->iov);
         }
-        if (client_trigger_event(client) == CORVUS_ERR) {
-            LOG(ERROR, "client_write: fail to trigger event %d %d",
-                    client->fd, client->ev->fd);
+        // the payload of a spliced reply follows its head
+        if (info->relay != NULL) conn_mark_dirty(info->relay->server);
+        if (info->quit) {
             return CORVUS_ERR;
         }
-    } else if (conn_register(client) == CORVUS_ERR) {
-        LOG(ERROR, "client_write: fail to reregister client %d", client->fd);
-        return CORVUS_ERR;
+        client_trigger_event(client);
+    } else {
+        conn_mark_dirty(client);
     }
 
     if (client->ctx->state == CTX_BEFORE_QUIT
@@ -273,25 +264,26 @@ void client_ready(struct connection *self, uint32_t mask)
     }
 }
 
-void client_event_ready(struct connection *self, uint32_t mask)
+/*
+ * Clients queued while draining are run in the next round, so that a
+ * client with a lot of buffered input doesn't starve the others.
+ */
+void client_run_ready(struct context *ctx)
 {
-    struct connection *client = self->parent;
-    client->event_triggered = false;
+    struct connection *client;
+    int n = ctx->ready_count;
 
-    if (client->eof) {
-        if (client->info->refcount <= 0) {
-            conn_free(client);
-            conn_recycle(client->ctx, client);
-        }
-        return;
-    }
+    while (n-- > 0 && !TAILQ_EMPTY(&ctx->ready_conns)) {
+        client = TAILQ_FIRST(&ctx->ready_conns);
+        TAILQ_REMOVE(&ctx->ready_conns, client, ready_next);
+        client->ready_queued = false;
+        ctx->ready_count--;
 
-    client->info->last_active = time(NULL);
+        if (client->eof) continue;
 
-    if (mask & E_READABLE) {
+        client->info->last_active = time(NULL);
         if (client_read(client, false) == CORVUS_ERR) {
             client_eof(client);
-            return;
         }
     }
 }
@@ -319,20 +311,6 @@ struct connection *client_create(struct context *ctx, int fd)
         return NULL;
     }
 
-    int evfd = socket_create_eventfd();
-    client->ev = conn_create(ctx);
-    if (evfd == -1 || client->ev == NULL) {
-        LOG(ERROR, "%s: fail to create event connection", __func__);
-        if (evfd != -1) close(evfd);
-        conn_free(client);
-        conn_recycle(ctx, client);
-        return NULL;
-    }
-
-    client->ev->fd = evfd;
-    client->ev->ready = client_event_ready;
-    client->ev->parent = client;
-
     client->ready = client_ready;
     client->info->last_active = time(NULL);
     return client;
@@ -354,12 +332,9 @@ void client_eof(struct connection *client)
         cmd_set_stale(cmd);
     }
 
-    ATOMIC_DEC(client->ctx->stats.connected_clients, 1);
+    STATS_INCR(client->ctx->stats.basic.connected_clients, -1);
 
     event_deregister(&client->ctx->loop, client);
-    if (client->ev != NULL && !client->event_triggered) {
-        event_deregister(&client->ctx->loop, client->ev);
-    }
 
     // don't care response any more
     cmd_iov_clear(client->ctx, &client->info->iov);
@@ -368,9 +343,7 @@ void client_eof(struct connection *client)
     // request may not write
     if (client->info->refcount <= 0) {
         conn_buf_free(client);
-        if (!client->event_triggered) {
-            conn_free(client);
-            conn_recycle(client->ctx, client);
-        }
+        conn_free(client);
+        conn_recycle(client->ctx, client);
     }
 }
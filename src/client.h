@@ -8,5 +8,6 @@ struct command;
 struct connection *client_create(struct context *ctx, int fd);
 void client_eof(struct connection *client);
 void client_range_clear(struct connection *client, struct command *cmd);
+void client_run_ready(struct context *ctx);
 
 #endif /* end of include guard: CLIENT_H */
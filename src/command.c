@@ -21,8 +21,12 @@
 #include "slowlog.h"
 #include "config.h"
 #include "array.h"
+#include "relay.h"
 
 #define CMD_RECYCLE_SIZE 1024
+#define CMD_MAP_BITS 11
+#define CMD_MAP_TRIES (1 << 20)
+#define CMD_NAME_MAX 32
 
 #define CMD_BUILD_MAP(cmd, type, access) {#cmd, CMD_##cmd, CMD_##type, CMD_ACCESS_##access},
 
@@ -42,6 +46,7 @@ const char *rep_addr_err = "-ERR Proxy fail to parse server address\r\n";
 const char *rep_server_err = "-ERR Proxy fail to get server\r\n";
 const char *rep_timeout_err = "-ERR Proxy timed out\r\n";
 const char *rep_slowlog_not_enabled = "-ERR Slowlog not enabled\r\n";
+const char *rep_hotkey_not_enabled = "-ERR Hotkey sampling not enabled\r\n";
 const char *rep_in_progress = "-ERR Operation in progress\r\n";
 
 const char *rep_config_err = "-ERR Config error\r\n";
@@ -53,6 +58,11 @@ const char *rep_set = "*3\r\n$3\r\nSET\r\n";
 const char *rep_del = "*2\r\n$3\r\nDEL\r\n";
 const char *rep_exists = "*2\r\n$6\r\nEXISTS\r\n";
 
+static const char *req_mget = "$4\r\nMGET\r\n";
+static const char *req_mset = "$4\r\nMSET\r\n";
+static const char *req_del = "$3\r\nDEL\r\n";
+static const char *req_exists = "$6\r\nEXISTS\r\n";
+
 static const char *rep_ok = "+OK\r\n";
 static const char *rep_ping = "+PONG\r\n";
 static const char *rep_noauth = "-NOAUTH Authentication required.\r\n";
@@ -63,19 +73,16 @@ static const char *rep_select_not_allowed = "-ERR SELECT is not allowed in clust
 
 struct cmd_item cmds[] = {CMD_DO(CMD_BUILD_MAP)};
 const size_t CMD_NUM = sizeof(cmds) / sizeof(struct cmd_item);
-static struct dict command_map;
+
+/* perfect hash of command names, the multiplier is searched in `cmd_map_init` */
+static uint64_t cmd_map_seed;
+static uint16_t cmd_map[1 << CMD_MAP_BITS]; /* index of `cmds` plus one */
 
 const char *cmd_extract_prefix(const char *prefix)
 {
-    const char *get = "$3\r\nGET\r\n";
-    const char *set = "$3\r\nSET\r\n";
-    const char *del = "$3\r\nDEL\r\n";
-    const char *exists = "$6\r\nEXISTS\r\n";
-    return prefix == rep_get ? cv_strndup(get, strlen(get)) :
-        prefix == rep_set ? cv_strndup(set, strlen(set)) :
-        prefix == rep_del ? cv_strndup(del, strlen(del)) :
-        prefix == rep_exists ? cv_strndup(exists, strlen(exists)) :
-        NULL;
+    // strip the leading "*<argc>\r\n" to get the command name
+    const char *name = strchr(prefix, '\n');
+    return name == NULL ? NULL : cv_strndup(name + 1, strlen(name + 1));
 }
 
 static inline uint8_t *cmd_get_data(struct mbuf *b, struct buf_ptr ptr[], int *len)
@@ -110,6 +117,7 @@ static void cmd_init(struct context *ctx, struct command *cmd)
     cmd->cmd_count = -1;
 
     STAILQ_INIT(&cmd->sub_cmds);
+    parse_store_init(&cmd->store, &ctx->parse_pool);
 }
 
 static void cmd_recycle(struct context *ctx, struct command *cmd)
@@ -142,25 +150,61 @@ static int cmd_in_queue(struct command *cmd, struct connection *server)
         || wait == cmd;
 }
 
-static void cmd_get_map_key(struct pos_array *pos, char *key)
+/*
+ * Length, first four and last two bytes tell all commands apart,
+ * letters are folded to lower case.
+ */
+static inline uint64_t cmd_map_key(const uint8_t *s, int len)
 {
-    int i, j, h;
-    struct pos *p;
-    for (i = 0, h = 0; i < pos->pos_len; i++) {
-        p = &pos->items[i];
-        for (j = 0; j < (int)p->len; j++, h++) {
-            key[h] = toupper(p->str[j]);
-        }
+    int i;
+    uint64_t key = len;
+
+    for (i = 0; i < 4 && i < len; i++) {
+        key |= (uint64_t)(s[i] | 0x20) << (8 * (i + 1));
     }
+    key |= (uint64_t)(s[len - 1] | 0x20) << 40;
+    if (len >= 2) {
+        key |= (uint64_t)(s[len - 2] | 0x20) << 48;
+    }
+    return key;
 }
 
-static int cmd_get_type(struct command *cmd, struct pos_array *pos)
+static inline uint32_t cmd_map_hash(uint64_t key)
+{
+    return (key * cmd_map_seed) >> (64 - CMD_MAP_BITS);
+}
+
+struct cmd_item *cmd_map_get(struct pos_array *pos)
 {
-    char key[pos->str_len + 1];
-    cmd_get_map_key(pos, key);
-    key[pos->str_len] = '\0';
+    int i, len = pos->str_len;
+    uint8_t buf[CMD_NAME_MAX];
+    const uint8_t *s;
+    const char *name;
+    uint16_t idx;
+
+    if (len <= 0 || len > CMD_NAME_MAX) return NULL;
 
-    struct cmd_item *item = dict_get(&command_map, key);
+    if (pos->pos_len == 1) {
+        s = pos->items[0].str;
+    } else {
+        pos_to_str_with_limit(pos, buf, len);
+        s = buf;
+    }
+
+    idx = cmd_map[cmd_map_hash(cmd_map_key(s, len))];
+    if (idx == 0) return NULL;
+
+    // command names only contain letters
+    name = cmds[idx - 1].cmd;
+    for (i = 0; i < len; i++) {
+        if (name[i] == '\0' || (s[i] | 0x20) != (name[i] | 0x20)) return NULL;
+    }
+    return name[len] == '\0' ? &cmds[idx - 1] : NULL;
+}
+
+static int cmd_get_type(struct command *cmd, struct pos_array *pos)
+{
+    struct cmd_item *item = cmd_map_get(pos);
     if (item == NULL) {
         return CORVUS_ERR;
     }
@@ -182,6 +226,7 @@ static int cmd_format_stats(char *dest, size_t n, struct stats *stats, char *lat
             "connected_clients:%lld\r\n"
             "completed_commands:%lld\r\n"
             "slot_update_jobs:%lld\r\n"
+            "slot_update_last_usec:%lld\r\n"
             "recv_bytes:%lld\r\n"
             "send_bytes:%lld\r\n"
             "remote_latency:%.6f\r\n"
@@ -189,6 +234,10 @@ static int cmd_format_stats(char *dest, size_t n, struct stats *stats, char *lat
             "last_command_latency:%s\r\n"
             "ask_recv:%lld\r\n"
             "moved_recv:%lld\r\n"
+            "ask_cache_hits:%lld\r\n"
+            "ask_cache_misses:%lld\r\n"
+            "spliced_replies:%lld\r\n"
+            "spliced_bytes:%lld\r\n"
             "remotes:%s\r\n",
             config.cluster, VERSION, getpid(), config.thread,
             CV_MALLOC_LIB,
@@ -196,11 +245,16 @@ static int cmd_format_stats(char *dest, size_t n, struct stats *stats, char *lat
             stats->basic.connected_clients,
             stats->basic.completed_commands,
             stats->basic.slot_update_jobs,
+            stats->slot_update_last_usec,
             stats->basic.recv_bytes, stats->basic.send_bytes,
             stats->basic.remote_latency / 1000000.0,
             stats->basic.total_latency / 1000000.0, latency,
             stats->basic.ask_recv,
             stats->basic.moved_recv,
+            stats->basic.ask_cache_hits,
+            stats->basic.ask_cache_misses,
+            stats->basic.spliced_replies,
+            stats->basic.spliced_bytes,
             stats->remote_nodes);
 }
 
@@ -241,7 +295,16 @@ int cmd_forward_basic(struct command *cmd)
         return CORVUS_ERR;
     }
 
-    server = conn_get_server(ctx, slot, cmd->cmd_access);
+    struct address addr;
+    if (askcache_get(&ctx->askcache, cmd, &addr)) {
+        // the key was moved to the importing node, skip the ASK round trip
+        server = conn_get_server_from_pool(ctx, &addr, false);
+        cmd->asking = server != NULL;
+        cmd->ask_cached = server != NULL;
+    }
+    if (server == NULL) {
+        server = conn_get_server(ctx, slot, cmd->cmd_access);
+    }
     if (server == NULL) {
         LOG(ERROR, "cmd_forward_basic: fail to get server with slot %d", slot);
         return CORVUS_ERR;
@@ -253,108 +316,161 @@ int cmd_forward_basic(struct command *cmd)
     LOG(DEBUG, "command with slot %d ready", slot);
 
     STAILQ_INSERT_TAIL(&server->info->ready_queue, cmd, ready_next);
-    if (conn_register(server) == -1) {
-        LOG(ERROR, "cmd_forward_basic: fail to register server %d", server->fd);
-        /* cmd already marked failed in server_eof */
-        server_eof(server, rep_err);
-    }
+    conn_mark_dirty(server);
     return CORVUS_OK;
 }
 
-/* mget, del, exists */
-int cmd_forward_multikey(struct command *cmd, struct redis_data *data, const char *prefix)
+static void cmd_set_key_prefix(struct command *cmd)
 {
-    ASSERT_ELEMENTS(data->elements >= 2, data);
-
-    cmd->cmd_count = data->elements - 1;
+    int step = 1;
+    const char *single, *name;
 
-    size_t i;
-    struct command *ncmd;
-    struct redis_data *key;
-    for (i = 1; i < data->elements; i++) {
-        key = &data->element[i];
-
-        ncmd = cmd_create(cmd->ctx);
-        ncmd->parent = cmd;
-        ncmd->client = cmd->client;
-        STAILQ_INSERT_TAIL(&cmd->sub_cmds, ncmd, sub_cmd_next);
-
-        if (key->type != REP_STRING) {
-            LOG(ERROR, "%s: expect data type %d got %d", __func__,
-                    REP_STRING, key->type);
-            cmd_mark_fail(ncmd, rep_forward_err);
-            continue;
-        }
+    switch (cmd->parent->cmd_type) {
+        case CMD_MGET:
+            single = rep_get;
+            name = req_mget;
+            break;
+        case CMD_MSET:
+            single = rep_set;
+            name = req_mset;
+            step = 2;
+            break;
+        case CMD_DEL:
+            single = rep_del;
+            name = req_del;
+            break;
+        default:
+            single = rep_exists;
+            name = req_exists;
+            break;
+    }
 
-        ncmd->slot = slot_get(&key->pos);
-        ncmd->cmd_access = cmd->cmd_access;
+    if (cmd->key_count == 1) {
+        cmd->prefix = (char*)single;
+        return;
+    }
+    snprintf(cmd->prefix_buf, sizeof(cmd->prefix_buf), "*%d\r\n%s",
+            cmd->key_count * step + 1, name);
+    cmd->prefix = cmd->prefix_buf;
+}
 
-        // no need to increase buf refcount
-        memcpy(&ncmd->req_buf[0], &key->buf[0], sizeof(key->buf[0]));
-        memcpy(&ncmd->req_buf[1], &key->buf[1], sizeof(key->buf[1]));
-        ncmd->prefix = (char*)prefix;
-        ncmd->data.type = REP_ARRAY;
-        ncmd->data.elements = 1;
-        ncmd->data.element = key;
+static struct command *cmd_create_sub(struct command *cmd, struct cmd_key *key, int count)
+{
+    struct command *ncmd = cmd_create(cmd->ctx);
+    ncmd->parent = cmd;
+    ncmd->client = cmd->client;
+    ncmd->slot = key->slot;
+    ncmd->cmd_access = cmd->cmd_access;
+    ncmd->key_list = key;
+    ncmd->key_count = count;
+    cmd_set_key_prefix(ncmd);
+
+    ncmd->data.type = REP_ARRAY;
+    ncmd->data.elements = cmd->cmd_type == CMD_MSET ? 2 : 1;
+    ncmd->data.element = key->data;
+    return ncmd;
+}
 
-        if (cmd_forward_basic(ncmd) == CORVUS_ERR) {
-            cmd_mark_fail(ncmd, rep_forward_err);
-        }
+static int cmd_key_cmp(const void *a, const void *b)
+{
+    const struct cmd_key *x = *(struct cmd_key**)a, *y = *(struct cmd_key**)b;
+    if (x->slot != y->slot) {
+        return x->slot - y->slot;
     }
-
-    return CORVUS_OK;
+    return x < y ? -1 : x > y;
 }
 
-int cmd_forward_mset(struct command *cmd, struct redis_data *data)
+/* keys sharing a slot are forwarded in one sub command */
+static int cmd_forward_keys(struct command *cmd, struct redis_data *data, int step)
 {
-    ASSERT_ELEMENTS(data->elements >= 3 && (data->elements & 1) == 1, data);
+    size_t i, j, m, n = (data->elements - 1) / step;
+    struct cmd_key *key, **sorted;
+    struct pos_array *pos[SLOT_BATCH_SIZE];
+    uint16_t slots[SLOT_BATCH_SIZE];
+    struct redis_data *k, *v;
+    struct command *ncmd;
 
-    cmd->cmd_count = (data->elements - 1) >> 1;
+    cmd->key_array = cv_calloc(n, sizeof(struct cmd_key));
+    sorted = cv_malloc(n * sizeof(struct cmd_key*));
 
-    size_t i;
-    struct command *ncmd;
-    struct redis_data *key, *value;
-    for (i = 1; i < data->elements; i += 2) {
-        key = &data->element[i];
-        value = &data->element[i + 1];
-
-        ncmd = cmd_create(cmd->ctx);
-        ncmd->parent = cmd;
-        ncmd->client = cmd->client;
-        STAILQ_INSERT_TAIL(&cmd->sub_cmds, ncmd, sub_cmd_next);
+    for (i = 0; i < n; i++) {
+        k = &data->element[i * step + 1];
+        v = &data->element[i * step + step];
 
-        if (key->type != REP_STRING || value->type != REP_STRING) {
-            LOG(ERROR, "%s: expect key/value data type %d got %d/%d",
-                    __func__, REP_STRING, key->type, value->type);
-            cmd_mark_fail(ncmd, rep_forward_err);
-            continue;
+        if (k->type != REP_STRING || v->type != REP_STRING) {
+            LOG(ERROR, "%s: expect data type %d got %d/%d", __func__,
+                    REP_STRING, k->type, v->type);
+            cv_free(sorted);
+            return CORVUS_ERR;
         }
 
-        ncmd->slot = slot_get(&key->pos);
-        ncmd->cmd_access = cmd->cmd_access;
+        key = &cmd->key_array[i];
+        key->data = k;
+        HOTKEY_RECORD(cmd->ctx, &k->pos);
 
         // no need to increase buf refcount
-        memcpy(&ncmd->req_buf[0], &key->buf[0], sizeof(key->buf[0]));
-        memcpy(&ncmd->req_buf[1], &value->buf[1], sizeof(value->buf[1]));
-        ncmd->prefix = (char*)rep_set;
-        ncmd->data.type = REP_ARRAY;
-        ncmd->data.elements = 2;
-        ncmd->data.element = &data->element[i];
+        memcpy(&key->req_buf[0], &k->buf[0], sizeof(k->buf[0]));
+        memcpy(&key->req_buf[1], &v->buf[1], sizeof(v->buf[1]));
+        sorted[i] = key;
+    }
+
+    for (i = 0; i < n; i += m) {
+        m = MIN(n - i, SLOT_BATCH_SIZE);
+        for (j = 0; j < m; j++) {
+            pos[j] = &cmd->key_array[i + j].data->pos;
+        }
+        slot_get_batch(pos, slots, m);
+        for (j = 0; j < m; j++) {
+            cmd->key_array[i + j].slot = slots[j];
+        }
+    }
+    qsort(sorted, n, sizeof(struct cmd_key*), cmd_key_cmp);
+
+    // set before forwarding, sub commands may fail immediately
+    cmd->cmd_count = 1;
+    for (i = 1; i < n; i++) {
+        if (sorted[i]->slot != sorted[i - 1]->slot) {
+            cmd->cmd_count++;
+        }
+    }
+
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && sorted[j]->slot == sorted[i]->slot; j++) {
+            sorted[j - 1]->next = sorted[j];
+        }
+        ncmd = cmd_create_sub(cmd, sorted[i], j - i);
+        STAILQ_INSERT_TAIL(&cmd->sub_cmds, ncmd, sub_cmd_next);
 
         if (cmd_forward_basic(ncmd) == CORVUS_ERR) {
             cmd_mark_fail(ncmd, rep_forward_err);
         }
     }
 
+    cv_free(sorted);
     return CORVUS_OK;
 }
 
+/* mget, del, exists */
+int cmd_forward_multikey(struct command *cmd, struct redis_data *data)
+{
+    ASSERT_ELEMENTS(data->elements >= 2, data);
+    return cmd_forward_keys(cmd, data, 1);
+}
+
+int cmd_forward_mset(struct command *cmd, struct redis_data *data)
+{
+    ASSERT_ELEMENTS(data->elements >= 3 && (data->elements & 1) == 1, data);
+    return cmd_forward_keys(cmd, data, 2);
+}
+
 int cmd_forward_eval(struct command *cmd, struct redis_data *data)
 {
     ASSERT_ELEMENTS(data->elements >= 4, data);
     ASSERT_TYPE(&data->element[3], REP_STRING);
 
     cmd->slot = slot_get(&data->element[3].pos);
+    HOTKEY_RECORD(cmd->ctx, &data->element[3].pos);
+    memcpy(cmd->key_buf, data->element[3].buf, sizeof(cmd->key_buf));
     return cmd_forward_basic(cmd);
 }
 
@@ -362,13 +478,11 @@ int cmd_forward_complex(struct command *cmd, struct redis_data *data)
 {
     switch (cmd->cmd_type) {
         case CMD_MGET:
-            return cmd_forward_multikey(cmd, data, rep_get);
-        case CMD_MSET:
-            return cmd_forward_mset(cmd, data);
         case CMD_DEL:
-            return cmd_forward_multikey(cmd, data, rep_del);
         case CMD_EXISTS:
-            return cmd_forward_multikey(cmd, data, rep_exists);
+            return cmd_forward_multikey(cmd, data);
+        case CMD_MSET:
+            return cmd_forward_mset(cmd, data);
         case CMD_EVAL:
             return cmd_forward_eval(cmd, data);
         default:
@@ -388,8 +502,44 @@ int cmd_ping(struct command *cmd)
     return CORVUS_OK;
 }
 
-int cmd_info(struct command *cmd)
+int cmd_info_latency(struct command *cmd)
+{
+    struct cvstr info = cvstr_new(1024);
+    size_t n = stats_get_latency(&info);
+
+    char *fmt = "$%zu\r\n";
+    int size = snprintf(NULL, 0, fmt, n);
+    char head[size + 1];
+    snprintf(head, sizeof(head), fmt, n);
+
+    conn_add_data(cmd->client, (uint8_t*)head, size, &cmd->rep_buf[0], NULL);
+    conn_add_data(cmd->client, (uint8_t*)info.data, n, NULL, NULL);
+    conn_add_data(cmd->client, (uint8_t*)"\r\n", 2, NULL, &cmd->rep_buf[1]);
+    CMD_INCREF(cmd);
+    cvstr_free(&info);
+
+    cmd_mark_done(cmd);
+    return CORVUS_OK;
+}
+
+int cmd_info(struct command *cmd, struct redis_data *data)
 {
+    ASSERT_TYPE(data, REP_ARRAY);
+
+    if (data->elements >= 2) {
+        struct redis_data *section = &data->element[1];
+        ASSERT_TYPE(section, REP_STRING);
+
+        char name[section->pos.str_len + 1];
+        if (pos_to_str(&section->pos, name) == CORVUS_ERR) {
+            LOG(ERROR, "cmd_info: parse error");
+            return CORVUS_ERR;
+        }
+        if (strcasecmp(name, "LATENCY") == 0) {
+            return cmd_info_latency(cmd);
+        }
+    }
+
     int i, n = 0, size = 0;
     struct stats stats;
     memset(&stats, 0, sizeof(stats));
@@ -408,6 +558,7 @@ int cmd_info(struct command *cmd)
     n = cmd_format_stats(NULL, 0, &stats, latency);
     char info[n + 1];
     cmd_format_stats(info, sizeof(info), &stats, latency);
+    stats_free(&stats);
 
     char *fmt = "$%lu\r\n";
     size = snprintf(NULL, 0, fmt, n);
@@ -423,6 +574,23 @@ int cmd_info(struct command *cmd)
     return CORVUS_OK;
 }
 
+static int cmd_parse_len(struct redis_data *data, int *result)
+{
+    ASSERT_TYPE(data, REP_STRING);
+    char len_limit[data->pos.str_len + 1];
+    if (pos_to_str(&data->pos, len_limit) == CORVUS_ERR) {
+        LOG(ERROR, "parse_len: emptry arg string");
+        return CORVUS_ERR;
+    }
+
+    *result = atoi(len_limit);
+    if (*result <= 0) {
+        return CORVUS_ERR;
+    }
+
+    return CORVUS_OK;
+}
+
 int cmd_proxy_info(struct command *cmd)
 {
     struct memory_stats stats;
@@ -442,10 +610,19 @@ int cmd_proxy_info(struct command *cmd)
         "in_use_conn_info:%lld\r\n"
         "free_conn_info:%lld\r\n"
         "in_use_buf_times:%lld\r\n"
-        "free_buf_times:%lld\r\n",
+        "free_buf_times:%lld\r\n"
+        "arena_chunks:%lld\r\n"
+        "arena_huge_chunks:%lld\r\n",
         stats.buffers, stats.free_buffers, stats.cmds, stats.free_cmds,
         stats.conns, stats.free_conns, stats.conn_info, stats.free_conn_info,
-        stats.buf_times, stats.free_buf_times);
+        stats.buf_times, stats.free_buf_times,
+        stats.arena_chunks, stats.arena_huge_chunks);
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        content_len += snprintf(content + content_len, sizeof(content) - content_len,
+                "buffers_%u:in_use=%lld,free=%lld\r\n",
+                mbuf_class_size(&get_contexts()[0], i),
+                stats.class_buffers[i], stats.free_class_buffers[i]);
+    }
     int data_len = snprintf(data, sizeof(data), "$%d\r\n%s\r\n", content_len, content);
 
     conn_add_data(cmd->client, (uint8_t*)data, data_len,
@@ -456,6 +633,230 @@ int cmd_proxy_info(struct command *cmd)
     return CORVUS_OK;
 }
 
+static void cmd_add_bulk(struct command *cmd, const char *str, int len)
+{
+    char buf[32];
+    int size = snprintf(buf, sizeof buf, "$%d\r\n", len);
+    conn_add_data(cmd->client, (uint8_t*)buf, size, NULL, &cmd->rep_buf[1]);
+    conn_add_data(cmd->client, (uint8_t*)str, len, NULL, &cmd->rep_buf[1]);
+    conn_add_data(cmd->client, (uint8_t*)"\r\n", 2, NULL, &cmd->rep_buf[1]);
+}
+
+int cmd_proxy_hotkeys(struct command *cmd, struct redis_data *data)
+{
+    // For example 'proxy hotkeys 20', element[2] is 20 here
+    int i, count, n = 10;
+    if (data->elements > 3) {
+        LOG(DEBUG, "cmd_proxy_hotkeys: too many arguments");
+        return CORVUS_ERR;
+    } else if (data->elements == 3) {
+        if (cmd_parse_len(&data->element[2], &n) == CORVUS_ERR) {
+            return CORVUS_ERR;
+        }
+        n = MIN(n, HOTKEY_TOPK * config.thread);
+    }
+
+    if (ATOMIC_GET(config.hotkey_sample_rate) <= 0) {
+        conn_add_data(cmd->client, (uint8_t*)rep_hotkey_not_enabled,
+            strlen(rep_hotkey_not_enabled),
+            &cmd->rep_buf[0], &cmd->rep_buf[1]);
+        CMD_INCREF(cmd);
+        cmd_mark_done(cmd);
+        return CORVUS_OK;
+    }
+
+    struct hotkey_entry *top = cv_malloc(sizeof(struct hotkey_entry) * n);
+    count = hotkey_get_top(get_contexts(), top, n);
+
+    // key and estimated count pairs, hottest first
+    char buf[64];
+    int size = snprintf(buf, sizeof buf, "*%d\r\n", count * 2);
+    conn_add_data(cmd->client, (uint8_t*)buf, size,
+            &cmd->rep_buf[0], &cmd->rep_buf[1]);
+
+    for (i = 0; i < count; i++) {
+        cmd_add_bulk(cmd, top[i].key, MIN(top[i].len, HOTKEY_KEY_LEN));
+        size = snprintf(buf, sizeof buf, ":%u\r\n", top[i].count);
+        conn_add_data(cmd->client, (uint8_t*)buf, size, NULL, &cmd->rep_buf[1]);
+    }
+    cv_free(top);
+    CMD_INCREF(cmd);
+    cmd_mark_done(cmd);
+
+    return CORVUS_OK;
+}
+
+int cmd_proxy_sizes(struct command *cmd)
+{
+    struct cvstr info = cvstr_new(1024);
+    size_t n = stats_get_sizes(&info);
+
+    char *fmt = "$%zu\r\n";
+    int size = snprintf(NULL, 0, fmt, n);
+    char head[size + 1];
+    snprintf(head, sizeof(head), fmt, n);
+
+    conn_add_data(cmd->client, (uint8_t*)head, size, &cmd->rep_buf[0], NULL);
+    conn_add_data(cmd->client, (uint8_t*)info.data, n, NULL, NULL);
+    conn_add_data(cmd->client, (uint8_t*)"\r\n", 2, NULL, &cmd->rep_buf[1]);
+    CMD_INCREF(cmd);
+    cvstr_free(&info);
+
+    cmd_mark_done(cmd);
+    return CORVUS_OK;
+}
+
+int cmd_proxy_bigkeys(struct command *cmd, struct redis_data *data)
+{
+    // For example 'proxy bigkeys 20', element[2] is 20 here
+    int i, count, n = 10;
+    if (data->elements > 3) {
+        LOG(DEBUG, "cmd_proxy_bigkeys: too many arguments");
+        return CORVUS_ERR;
+    } else if (data->elements == 3) {
+        struct redis_data *arg = &data->element[2];
+        ASSERT_TYPE(arg, REP_STRING);
+
+        char op[arg->pos.str_len + 1];
+        if (pos_to_str(&arg->pos, op) == CORVUS_ERR) {
+            LOG(ERROR, "cmd_proxy_bigkeys: parse error");
+            return CORVUS_ERR;
+        }
+        if (strcasecmp(op, "SIZES") == 0) {
+            return cmd_proxy_sizes(cmd);
+        } else if (strcasecmp(op, "RESET") == 0) {
+            bigkey_reset(get_contexts());
+            conn_add_data(cmd->client, (uint8_t*)rep_ok, strlen(rep_ok),
+                    &cmd->rep_buf[0], &cmd->rep_buf[1]);
+            CMD_INCREF(cmd);
+            cmd_mark_done(cmd);
+            return CORVUS_OK;
+        }
+        if (cmd_parse_len(arg, &n) == CORVUS_ERR) {
+            return CORVUS_ERR;
+        }
+        n = MIN(n, BIGKEY_TOPN * 2 * config.thread);
+    }
+
+    struct bigkey_entry *top = cv_malloc(sizeof(struct bigkey_entry) * n);
+    count = bigkey_get_top(get_contexts(), top, n);
+
+    char buf[128];
+    int size = snprintf(buf, sizeof buf, "*%d\r\n", count);
+    conn_add_data(cmd->client, (uint8_t*)buf, size,
+            &cmd->rep_buf[0], &cmd->rep_buf[1]);
+
+    // kind, key, command, bytes, elements, node
+    for (i = 0; i < count; i++) {
+        struct bigkey_entry *e = &top[i];
+        const char *kind = e->kind == BIGKEY_REQUEST ? "request" : "reply";
+        size = snprintf(buf, sizeof buf, "*6\r\n$%zu\r\n%s\r\n", strlen(kind), kind);
+        conn_add_data(cmd->client, (uint8_t*)buf, size, NULL, &cmd->rep_buf[1]);
+        cmd_add_bulk(cmd, e->key, MIN(e->len, BIGKEY_KEY_LEN));
+        cmd_add_bulk(cmd, cmds[e->cmd_type].cmd, strlen(cmds[e->cmd_type].cmd));
+        size = snprintf(buf, sizeof buf, ":%u\r\n:%lld\r\n", e->bytes, e->elements);
+        conn_add_data(cmd->client, (uint8_t*)buf, size, NULL, &cmd->rep_buf[1]);
+        cmd_add_bulk(cmd, e->node, strlen(e->node));
+    }
+    cv_free(top);
+    CMD_INCREF(cmd);
+    cmd_mark_done(cmd);
+
+    return CORVUS_OK;
+}
+
+static int cmd_parse_slot(struct redis_data *data, int *result)
+{
+    ASSERT_TYPE(data, REP_STRING);
+    char slot[data->pos.str_len + 1];
+    char *end;
+    if (pos_to_str(&data->pos, slot) == CORVUS_ERR) {
+        LOG(ERROR, "parse_slot: emptry arg string");
+        return CORVUS_ERR;
+    }
+
+    long v = strtol(slot, &end, 10);
+    if (*slot == '\0' || *end != '\0' || v < 0 || v >= REDIS_CLUSTER_SLOTS) {
+        return CORVUS_ERR;
+    }
+    *result = v;
+    return CORVUS_OK;
+}
+
+int cmd_proxy_slotstats_dump(struct command *cmd)
+{
+    struct cvstr buf = cvstr_new(1024);
+    size_t n = stats_get_slotstats(&buf);
+
+    char *fmt = "$%zu\r\n";
+    int size = snprintf(NULL, 0, fmt, n);
+    char head[size + 1];
+    snprintf(head, sizeof(head), fmt, n);
+
+    conn_add_data(cmd->client, (uint8_t*)head, size, &cmd->rep_buf[0], NULL);
+    conn_add_data(cmd->client, (uint8_t*)buf.data, n, NULL, NULL);
+    conn_add_data(cmd->client, (uint8_t*)"\r\n", 2, NULL, &cmd->rep_buf[1]);
+    CMD_INCREF(cmd);
+    cvstr_free(&buf);
+
+    cmd_mark_done(cmd);
+    return CORVUS_OK;
+}
+
+int cmd_proxy_slotstats(struct command *cmd, struct redis_data *data)
+{
+    // For example 'proxy slotstats 0 100', element[2] is 0 here
+    int i, count = 0, start = 0, end = REDIS_CLUSTER_SLOTS - 1;
+    if (data->elements == 3) {
+        struct redis_data *arg = &data->element[2];
+        ASSERT_TYPE(arg, REP_STRING);
+
+        char op[arg->pos.str_len + 1];
+        if (pos_to_str(&arg->pos, op) == CORVUS_ERR) {
+            LOG(ERROR, "cmd_proxy_slotstats: parse error");
+            return CORVUS_ERR;
+        }
+        if (strcasecmp(op, "DUMP") != 0) return CORVUS_ERR;
+        return cmd_proxy_slotstats_dump(cmd);
+    } else if (data->elements == 4) {
+        if (cmd_parse_slot(&data->element[2], &start) == CORVUS_ERR
+                || cmd_parse_slot(&data->element[3], &end) == CORVUS_ERR
+                || start > end)
+        {
+            return CORVUS_ERR;
+        }
+    } else if (data->elements != 2) {
+        LOG(DEBUG, "cmd_proxy_slotstats: wrong number of arguments");
+        return CORVUS_ERR;
+    }
+
+    int n = end - start + 1;
+    struct slot_counter *slots = cv_malloc(sizeof(struct slot_counter) * n);
+    slotstats_get(get_contexts(), slots, start, end);
+    for (i = 0; i < n; i++) {
+        if (slots[i].ops > 0) count++;
+    }
+
+    char buf[128];
+    int size = snprintf(buf, sizeof buf, "*%d\r\n", count);
+    conn_add_data(cmd->client, (uint8_t*)buf, size,
+            &cmd->rep_buf[0], &cmd->rep_buf[1]);
+
+    // slot, ops, request bytes, reply bytes of slots with traffic
+    for (i = 0; i < n; i++) {
+        struct slot_counter *c = &slots[i];
+        if (c->ops == 0) continue;
+        size = snprintf(buf, sizeof buf, "*4\r\n:%d\r\n:%lld\r\n:%lld\r\n:%lld\r\n",
+                start + i, c->ops, c->req_bytes, c->rep_bytes);
+        conn_add_data(cmd->client, (uint8_t*)buf, size, NULL, &cmd->rep_buf[1]);
+    }
+    cv_free(slots);
+    CMD_INCREF(cmd);
+    cmd_mark_done(cmd);
+
+    return CORVUS_OK;
+}
+
 int cmd_proxy(struct command *cmd, struct redis_data *data)
 {
     ASSERT_TYPE(data, REP_ARRAY);
@@ -472,6 +873,14 @@ int cmd_proxy(struct command *cmd, struct redis_data *data)
 
     if (strcasecmp(type, "INFO") == 0) {
         return cmd_proxy_info(cmd);
+    } else if (strcasecmp(type, "LATENCY") == 0) {
+        return cmd_info_latency(cmd);
+    } else if (strcasecmp(type, "HOTKEYS") == 0) {
+        return cmd_proxy_hotkeys(cmd, data);
+    } else if (strcasecmp(type, "BIGKEYS") == 0) {
+        return cmd_proxy_bigkeys(cmd, data);
+    } else if (strcasecmp(type, "SLOTSTATS") == 0) {
+        return cmd_proxy_slotstats(cmd, data);
     } else if (strcasecmp(type, "UPDATESLOTMAP") == 0) {
         slot_create_job(SLOT_UPDATE);
         conn_add_data(cmd->client, (uint8_t*)rep_ok, strlen(rep_ok),
@@ -693,23 +1102,6 @@ int cmd_select(struct command *cmd, struct redis_data *data)
     return CORVUS_OK;
 }
 
-static int cmd_parse_len(struct redis_data *data, int *result)
-{
-    ASSERT_TYPE(data, REP_STRING);
-    char len_limit[data->pos.str_len + 1];
-    if (pos_to_str(&data->pos, len_limit) == CORVUS_ERR) {
-        LOG(ERROR, "parse_len: emptry arg string");
-        return CORVUS_ERR;
-    }
-
-    *result = atoi(len_limit);
-    if (*result <= 0) {
-        return CORVUS_ERR;
-    }
-
-    return CORVUS_OK;
-}
-
 static int cmd_slowlog_entry_cmp(const void * lhs, const void * rhs)
 {
     const struct slowlog_entry *e1 = *((struct slowlog_entry**)lhs);
@@ -878,7 +1270,7 @@ int cmd_extra(struct command *cmd, struct redis_data *data)
         case CMD_PING:
             return cmd_ping(cmd);
         case CMD_INFO:
-            return cmd_info(cmd);
+            return cmd_info(cmd, data);
         case CMD_PROXY:
             return cmd_proxy(cmd, data);
         case CMD_AUTH:
@@ -914,6 +1306,10 @@ int cmd_forward(struct command *cmd, struct redis_data *data)
     switch (cmd->request_type) {
         case CMD_BASIC:
             cmd->slot = cmd_get_slot(data);
+            if (cmd->slot != -1) {
+                HOTKEY_RECORD(cmd->ctx, &data->element[1].pos);
+                memcpy(cmd->key_buf, data->element[1].buf, sizeof(cmd->key_buf));
+            }
             return cmd_forward_basic(cmd);
         case CMD_COMPLEX:
             return cmd_forward_complex(cmd, data);
@@ -949,7 +1345,10 @@ int cmd_parse_req(struct command *cmd, struct mbuf *buf)
     struct reader *r = &cmd->client->info->reader;
     reader_feed(r, buf);
 
-    if (parse(r, MODE_REQ) == CORVUS_ERR) {
+    r->store = &cmd->store;
+    int status = parse(r, MODE_REQ);
+    r->store = NULL;
+    if (status == CORVUS_ERR) {
         return CORVUS_ERR;
     }
 
@@ -1006,6 +1405,8 @@ int cmd_parse_rep(struct command *cmd, struct mbuf *buf)
         cmd->reply_type = r->redis_data_type;
         if (cmd->reply_type == REP_INTEGER) {
             cmd->integer_data = r->item_size;
+        } else if (cmd->reply_type == REP_ARRAY) {
+            cmd->rep_elements = r->data.elements;
         }
 
         memcpy(&cmd->rep_buf[1], &r->end, sizeof(r->end));
@@ -1018,10 +1419,199 @@ int cmd_parse_rep(struct command *cmd, struct mbuf *buf)
     return CORVUS_OK;
 }
 
+static inline uint8_t *cmd_range_last(struct buf_ptr *p, struct buf_ptr ptr[])
+{
+    return p->buf == ptr[1].buf ? ptr[1].pos : p->buf->last;
+}
+
+/* move `p` to the next unread byte in range `ptr` */
+static uint8_t *cmd_range_next(struct buf_ptr *p, struct buf_ptr ptr[])
+{
+    while (p->pos >= cmd_range_last(p, ptr)) {
+        if (p->buf == ptr[1].buf) return NULL;
+        p->buf = TAILQ_NEXT(p->buf, next);
+        if (p->buf == NULL) return NULL;
+        p->pos = p->buf->start;
+    }
+    return p->pos;
+}
+
+/* read a "<type><length>\r\n" line and return the type */
+static int cmd_range_read_len(struct buf_ptr *p, struct buf_ptr ptr[], long long *len)
+{
+    uint8_t *c;
+    int type = 0, sign = 1;
+    long long v = 0;
+
+    while ((c = cmd_range_next(p, ptr)) != NULL) {
+        p->pos++;
+        if (type == 0) {
+            type = *c;
+        } else if (*c == '-') {
+            sign = -1;
+        } else if (isdigit(*c)) {
+            v = v * 10 + (*c - '0');
+        } else if (*c == '\n') {
+            *len = sign * v;
+            return type;
+        }
+    }
+    return CORVUS_ERR;
+}
+
+/*
+ * Copy at most `limit` bytes of the first key of a forwarded command into
+ * `dst` and terminate it. The key is read from the request buffers, which
+ * are kept until the command is freed. Returns the key length or -1.
+ */
+int cmd_copy_key(struct command *cmd, char *dst, int limit)
+{
+    struct buf_ptr range[2], p;
+    long long len;
+    uint8_t *c;
+    int n = 0;
+
+    if (cmd->key_list != NULL) {
+        memcpy(range, cmd->key_list->req_buf, sizeof(range));
+    } else if (cmd->key_buf[0].buf != NULL) {
+        memcpy(range, cmd->key_buf, sizeof(range));
+    } else {
+        return -1;
+    }
+
+    p = range[0];
+    if (cmd_range_read_len(&p, range, &len) != '$' || len < 0) return -1;
+
+    while (n < limit && n < len && (c = cmd_range_next(&p, range)) != NULL) {
+        dst[n++] = *c;
+        p.pos++;
+    }
+    dst[n] = '\0';
+    return len;
+}
+
+// bytes of the request sent to redis, sub commands only send their keys
+uint32_t cmd_req_len(struct command *cmd)
+{
+    struct cmd_key *k;
+    uint32_t len = 0;
+
+    if (cmd->parent == NULL) return mbuf_range_len(cmd->req_buf);
+    for (k = cmd->key_list; k != NULL; k = k->next) {
+        len += mbuf_range_len(k->req_buf);
+    }
+    return len;
+}
+
+static int cmd_range_skip(struct buf_ptr *p, struct buf_ptr ptr[], long long n)
+{
+    long long size;
+    while (n > 0) {
+        if (cmd_range_next(p, ptr) == NULL) return CORVUS_ERR;
+        size = MIN(n, cmd_range_last(p, ptr) - p->pos);
+        p->pos += size;
+        n -= size;
+    }
+    return CORVUS_OK;
+}
+
+static void cmd_buf_decref(struct context *ctx, struct mbuf *b)
+{
+    b->refcount--;
+    if (b->refcount <= 0 && b->pos >= b->last) {
+        TAILQ_REMOVE(b->queue, b, next);
+        mbuf_recycle(ctx, b);
+    }
+}
+
+/* Split the reply of a grouped MGET into the replies of its keys,
+ * each key reply holds its own buf references. */
+static int cmd_split_rep(struct command *cmd)
+{
+    struct cmd_key *key = cmd->key_list;
+    struct buf_ptr p = cmd->rep_buf[0];
+    long long len;
+
+    if (cmd->key_count == 1) {
+        memcpy(key->rep_buf, cmd->rep_buf, sizeof(cmd->rep_buf));
+        memset(cmd->rep_buf, 0, sizeof(cmd->rep_buf));
+        return CORVUS_OK;
+    }
+
+    if (cmd_range_read_len(&p, cmd->rep_buf, &len) != '*' || len != cmd->key_count) {
+        return CORVUS_ERR;
+    }
+    for (; key != NULL; key = key->next) {
+        if (cmd_range_next(&p, cmd->rep_buf) == NULL) return CORVUS_ERR;
+        key->rep_buf[0] = p;
+        if (cmd_range_read_len(&p, cmd->rep_buf, &len) != '$') return CORVUS_ERR;
+        if (len >= 0 && cmd_range_skip(&p, cmd->rep_buf, len + 2) == CORVUS_ERR) {
+            return CORVUS_ERR;
+        }
+        key->rep_buf[1] = p;
+    }
+
+    for (key = cmd->key_list; key != NULL; key = key->next) {
+        key->rep_buf[0].buf->refcount++;
+        if (key->rep_buf[1].buf != key->rep_buf[0].buf) {
+            key->rep_buf[1].buf->refcount++;
+        }
+    }
+    cmd_buf_decref(cmd->ctx, cmd->rep_buf[0].buf);
+    if (cmd->rep_buf[1].buf != cmd->rep_buf[0].buf) {
+        cmd_buf_decref(cmd->ctx, cmd->rep_buf[1].buf);
+    }
+    memset(cmd->rep_buf, 0, sizeof(cmd->rep_buf));
+    return CORVUS_OK;
+}
+
+static int cmd_split_mget_rep(struct command *cmd)
+{
+    int i;
+    struct command *c;
+
+    STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
+        if (cmd_split_rep(c) == CORVUS_ERR) break;
+    }
+    if (c == NULL) return CORVUS_OK;
+
+    LOG(ERROR, "%s: fail to split reply of %d keys", __func__, c->key_count);
+    STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
+        mbuf_range_clear(cmd->ctx, c->rep_buf);
+    }
+    for (i = 0; i < cmd->keys; i++) {
+        mbuf_range_clear(cmd->ctx, cmd->key_array[i].rep_buf);
+    }
+    return CORVUS_ERR;
+}
+
+/*
+ * Replies generated by corvus are copied to the local buffers of the client
+ * so that they stay valid until the client has written them, like the
+ * replies read from servers.
+ */
+static void cmd_iov_add_header(struct command *cmd, struct iov_data *iov,
+        char type, long n)
+{
+    char data[32];
+    struct buf_ptr ptr[2];
+    struct mbuf *b;
+
+    int len = snprintf(data, sizeof(data), "%c%ld\r\n", type, n);
+    conn_add_data(cmd->client, (uint8_t*)data, len, &ptr[0], &ptr[1]);
+
+    // every iovec entry holds a reference
+    for (b = ptr[0].buf; b != NULL; b = TAILQ_NEXT(b, next)) {
+        b->refcount++;
+        if (b == ptr[1].buf) break;
+    }
+    cmd_create_iovec(ptr, iov);
+}
+
 void cmd_gen_mget_iovec(struct command *cmd, struct iov_data *iov)
 {
     struct command *c, *temp;
-    int n, setted = 0;
+    int i, setted = 0;
 
     STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
         if (c->cmd_fail) {
@@ -1042,12 +1632,18 @@ void cmd_gen_mget_iovec(struct command *cmd, struct iov_data *iov)
             if (c == temp || c->cmd_fail) continue;
             mbuf_range_clear(cmd->ctx, c->rep_buf);
         }
+    } else if (cmd->key_array != NULL && cmd_split_mget_rep(cmd) == CORVUS_ERR) {
+        cmd_iov_add(iov, (void*)rep_err, strlen(rep_err), NULL);
     } else {
-        const char *fmt = "*%ld\r\n";
-        n = snprintf(iov->buf, sizeof(iov->buf), fmt, cmd->keys);
-        cmd_iov_add(iov, iov->buf, n, NULL);
-        STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
-            cmd_create_iovec(c->rep_buf, iov);
+        cmd_iov_add_header(cmd, iov, '*', cmd->keys);
+        if (cmd->key_array == NULL) {
+            STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
+                cmd_create_iovec(c->rep_buf, iov);
+            }
+        } else {
+            for (i = 0; i < cmd->keys; i++) {
+                cmd_create_iovec(cmd->key_array[i].rep_buf, iov);
+            }
         }
     }
 }
@@ -1079,7 +1675,7 @@ void cmd_gen_mset_iovec(struct command *cmd, struct iov_data *iov)
 void cmd_gen_multikey_iovec(struct command *cmd, struct iov_data *iov)
 {
     struct command *c;
-    int n = 0, count = 0, setted = 0;
+    int count = 0, setted = 0;
     STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
         if (c->cmd_fail && !setted) {
             cmd_iov_add(iov, c->fail_reason, strlen(c->fail_reason), NULL);
@@ -1091,8 +1687,8 @@ void cmd_gen_multikey_iovec(struct command *cmd, struct iov_data *iov)
             setted = 1;
             continue;
         }
-        if (!c->cmd_fail && c->reply_type != REP_ERROR && c->integer_data == 1) {
-            count++;
+        if (!c->cmd_fail && c->reply_type != REP_ERROR) {
+            count += c->integer_data;
         }
         if (!c->cmd_fail) {
             mbuf_range_clear(cmd->ctx, c->rep_buf);
@@ -1101,9 +1697,7 @@ void cmd_gen_multikey_iovec(struct command *cmd, struct iov_data *iov)
 
     if (setted) return;
 
-    const char *fmt = ":%ld\r\n";
-    n = snprintf(iov->buf, sizeof(iov->buf), fmt, count);
-    cmd_iov_add(iov, iov->buf, n, NULL);
+    cmd_iov_add_header(cmd, iov, ':', count);
 }
 
 void cmd_mark(struct command *cmd, int fail)
@@ -1129,26 +1723,31 @@ void cmd_mark(struct command *cmd, int fail)
         // }
     }
 
-    if (root != NULL && conn_register(root->client) == CORVUS_ERR) {
-        LOG(ERROR, "fail to reregister client %d", root->client->fd);
-        client_eof(root->client);
+    if (root != NULL) {
+        conn_mark_dirty(root->client);
     }
 }
 
 void cmd_map_init()
 {
-    dict_init(&command_map);
-
-    size_t i, cmds_len = sizeof(cmds) / sizeof(struct cmd_item);
-
-    for (i = 0; i < cmds_len; i++) {
-        dict_set(&command_map, cmds[i].cmd, &cmds[i]);
+    size_t i;
+    uint32_t h;
+    int tries;
+
+    // try multipliers until every command gets its own slot
+    cmd_map_seed = 0x9e3779b97f4a7c15ULL;
+    for (tries = 0; tries < CMD_MAP_TRIES; tries++, cmd_map_seed += 2) {
+        memset(cmd_map, 0, sizeof(cmd_map));
+        for (i = 0; i < CMD_NUM; i++) {
+            h = cmd_map_hash(cmd_map_key((uint8_t*)cmds[i].cmd, strlen(cmds[i].cmd)));
+            if (cmd_map[h] != 0) break;
+            cmd_map[h] = i + 1;
+        }
+        if (i == CMD_NUM) return;
     }
-}
-
-void cmd_map_destroy()
-{
-    dict_free(&command_map);
+    LOG(ERROR, "Fatal: no perfect hash for %zu commands in %d tries, "
+            "increase CMD_MAP_BITS", CMD_NUM, CMD_MAP_TRIES);
+    abort();
 }
 
 struct command *cmd_create(struct context *ctx)
@@ -1173,6 +1772,8 @@ int cmd_read_rep(struct command *cmd, struct connection *server)
     int rsize, status;
     struct mbuf *buf;
 
+    if (server->info->relay != NULL) return relay_run(server);
+
     while (1) {
         buf = conn_get_buf(server, true, false);
         rsize = mbuf_read_size(buf);
@@ -1184,6 +1785,8 @@ int cmd_read_rep(struct command *cmd, struct connection *server)
 
         if (cmd_parse_rep(cmd, buf) == CORVUS_ERR) return CORVUS_ERR;
         if (reader_ready(&server->info->reader)) break;
+        // the rest of a large bulk string skips the buffers
+        if (relay_start(server, cmd)) return relay_run(server);
     }
 
     return CORVUS_OK;
@@ -1274,6 +1877,12 @@ int cmd_parse_redirect(struct command *cmd, struct redirect_info *info)
     } else if (strncmp(err, "-CLUSTERDOWN", 12) == 0) {
         /* -CLUSTERDOWN The cluster is down */
         info->type = CMD_ERR_CLUSTERDOWN;
+    } else if (strncmp(err, "-CROSSSLOT", 10) == 0) {
+        /* -CROSSSLOT Keys in request don't hash to the same slot */
+        info->type = CMD_ERR_CROSSSLOT;
+    } else if (strncmp(err, "-TRYAGAIN", 9) == 0) {
+        /* -TRYAGAIN Multiple keys request during rehashing of slot */
+        info->type = CMD_ERR_TRYAGAIN;
     }
     return CORVUS_OK;
 }
@@ -1296,17 +1905,18 @@ void cmd_stats(struct command *cmd, int64_t end_time)
     struct context *ctx = cmd->ctx;
     long long remote_latency, total_latency;
 
-    ATOMIC_INC(ctx->stats.completed_commands, 1);
-
     total_latency = end_time - cmd->parse_time;
-
-    ATOMIC_INC(ctx->stats.total_latency, total_latency);
-    ATOMIC_SET(ctx->last_command_latency, total_latency);
-
     remote_latency = cmd->rep_time[1] - cmd->rep_time[0];
 
+    stats_write_begin(&ctx->stats);
+    STATS_INCR(ctx->stats.basic.completed_commands, 1);
+    STATS_INCR(ctx->stats.basic.total_latency, total_latency);
+    STATS_INCR(ctx->stats.basic.remote_latency, remote_latency);
+    STATS_SET(ctx->stats.last_command_latency, total_latency);
+    stats_write_end(&ctx->stats);
+
     if (slowlog_need_log(cmd, total_latency)) {
-        if (slowlog_statsd_enabled()) {
+        if (slowlog_count_enabled()) {
             slowlog_add_count(cmd);
         }
         if (slowlog_cmd_enabled()) {
@@ -1320,7 +1930,7 @@ void cmd_stats(struct command *cmd, int64_t end_time)
         }
     }
 
-    ATOMIC_INC(ctx->stats.remote_latency, remote_latency);
+    stats_record_latency(cmd, total_latency);
 }
 
 void cmd_set_stale(struct command *cmd)
@@ -1350,6 +1960,28 @@ void cmd_set_stale(struct command *cmd)
     }
 }
 
+/* Fall back to one sub command per key, return the number of sub commands */
+int cmd_split_keys(struct command *cmd)
+{
+    int n = 1;
+    struct command *ncmd, *prev = cmd;
+    struct cmd_key *key = cmd->key_list->next, *next;
+
+    cmd->key_list->next = NULL;
+    cmd->key_count = 1;
+    cmd_set_key_prefix(cmd);
+
+    for (; key != NULL; key = next, n++) {
+        next = key->next;
+        key->next = NULL;
+        ncmd = cmd_create_sub(cmd->parent, key, 1);
+        STAILQ_INSERT_AFTER(&cmd->parent->sub_cmds, prev, ncmd, sub_cmd_next);
+        prev = ncmd;
+    }
+    cmd->parent->cmd_count += n - 1;
+    return n;
+}
+
 void cmd_iov_add(struct iov_data *iov, void *buf, size_t len, struct mbuf *b)
 {
     if (iov->cursor >= CORVUS_IOV_MAX) {
@@ -1421,6 +2053,11 @@ void cmd_free(struct command *cmd)
         cmd_free(c);
     }
 
+    if (cmd->key_array != NULL) {
+        cv_free(cmd->key_array);
+        cmd->key_array = NULL;
+    }
+
     if (cmd->cmd_ref != NULL) {
         cmd->cmd_ref->refcount--;
         if (cmd->cmd_ref->refcount <= 0) {
@@ -1433,14 +2070,14 @@ void cmd_free(struct command *cmd)
         cmd->conn_ref->info->refcount--;
         if (cmd->conn_ref->info->refcount <= 0) {
             conn_buf_free(cmd->conn_ref);
-            if (!cmd->conn_ref->event_triggered) {
-                conn_free(cmd->conn_ref);
-                conn_recycle(ctx, cmd->conn_ref);
-            }
+            conn_free(cmd->conn_ref);
+            conn_recycle(ctx, cmd->conn_ref);
         }
         cmd->conn_ref = NULL;
     }
 
+    parse_store_reset(&cmd->store);
+
     cmd->client = NULL;
     cmd->server = NULL;
     cmd_recycle(ctx, cmd);
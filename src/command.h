@@ -169,6 +169,8 @@ enum {
     CMD_ERR_MOVED,
     CMD_ERR_ASK,
     CMD_ERR_CLUSTERDOWN,
+    CMD_ERR_CROSSSLOT,
+    CMD_ERR_TRYAGAIN,
 
     CMD_ACCESS_UNKNOWN,
     CMD_ACCESS_WRITE,
@@ -180,15 +182,24 @@ STAILQ_HEAD(cmd_tqh, command);
 struct iov_data {
     struct iovec *data;
     struct mbuf **buf_ptr;
-    char buf[32];
     int cursor;
     int len;
     int max_size;
 };
 
+/* a key (or key/value pair of MSET) of a multiple keys command */
+struct cmd_key {
+    struct buf_ptr req_buf[2];
+    struct buf_ptr rep_buf[2];
+    struct cmd_key *next;
+    struct redis_data *data; /* weak reference, see command.data */
+    int slot;
+};
+
 struct command {
     struct buf_ptr req_buf[2];
     struct buf_ptr rep_buf[2];
+    struct buf_ptr key_buf[2]; /* key of single key commands, inside req_buf */
 
     STAILQ_ENTRY(command) cmd_next;
     STAILQ_ENTRY(command) ready_next;
@@ -220,14 +231,27 @@ struct command {
     int16_t reply_type;
     int keys;
     int integer_data; /* for integer response */
+    int rep_elements; /* for array response */
+    size_t rep_spliced; /* length of a reply spliced to the client */
 
     int cmd_count;
     int cmd_done_count;
     struct cmd_tqh sub_cmds;
 
+    /* Keys of multiple keys command in request order, owned by parent cmd.
+       Sub commands link the keys sharing a slot through key_list. */
+    struct cmd_key *key_array;
+    struct cmd_key *key_list;
+    int key_count;
+    char prefix_buf[32];
+
+    /* arrays of the parsed request */
+    struct parse_store store;
+
     /* redirect */
     int16_t redirected;
     bool asking;
+    bool ask_cached;  // sent to the importing node by askcache
 
     bool parse_done;
     bool stale;
@@ -269,7 +293,6 @@ const char *rep_err,
 const char *rep_get, *rep_set, *rep_del, *rep_exists;
 
 void cmd_map_init();
-void cmd_map_destroy();
 struct command *cmd_create(struct context *ctx);
 int cmd_read_rep(struct command *cmd, struct connection *server);
 void cmd_create_iovec(struct buf_ptr ptr[], struct iov_data *iov);
@@ -285,6 +308,9 @@ void cmd_iov_reset(struct iov_data *iov);
 void cmd_iov_clear(struct context *ctx, struct iov_data *iov);
 void cmd_iov_free(struct iov_data *iov);
 void cmd_free(struct command *cmd);
+int cmd_split_keys(struct command *cmd);
+int cmd_copy_key(struct command *cmd, char *dst, int limit);
+uint32_t cmd_req_len(struct command *cmd);
 const char *cmd_extract_prefix(const char *prefix);
 
 #endif /* end of include guard: COMMAND_H */
@@ -16,6 +16,7 @@
 #define DEFAULT_THREAD 4
 #define DEFAULT_BUFSIZE 16384
 #define MIN_BUFSIZE 64
+#define MAX_HOTKEY_SAMPLE_RATE 1000000
 #define TMP_CONFIG_FILE "tmp-corvus.conf"
 
 static pthread_mutex_t lock_conf_node = PTHREAD_MUTEX_INITIALIZER;
@@ -23,6 +24,9 @@ static pthread_mutex_t lock_config_rewrite = PTHREAD_MUTEX_INITIALIZER;
 const char * CONFIG_OPTIONS[] = {
     "cluster",
     "bind",
+    "bind-unix",
+    "bind-unix-perm",
+    "metrics-bind",
     "node",
     "thread",
     "loglevel",
@@ -35,9 +39,12 @@ const char * CONFIG_OPTIONS[] = {
     "client_timeout",
     "server_timeout",
     "bufsize",
+    "buffer-arena",
+    "splice-threshold",
     "slowlog-log-slower-than",
     "slowlog-max-len",
     "slowlog-statsd-enabled",
+    "hotkey-sample-rate",
 };
 
 void config_init()
@@ -46,6 +53,9 @@ void config_init()
     strncpy(config.cluster, "default", CLUSTER_NAME_SIZE);
 
     config.bind = 12345;
+    memset(config.bind_unix, 0, sizeof(config.bind_unix));
+    config.bind_unix_perm = 0;
+    config.metrics_bind = 0;
     config.node = cv_calloc(1, sizeof(struct node_conf));
     config.node->refcount = 1;
     config.thread = DEFAULT_THREAD;
@@ -55,11 +65,14 @@ void config_init()
     config.client_timeout = 0;
     config.server_timeout = 0;
     config.bufsize = DEFAULT_BUFSIZE;
+    config.buffer_arena = false;
+    config.splice_threshold = 0;
     config.requirepass = NULL;
     config.readslave = config.readmasterslave = false;
     config.slowlog_max_len = 1024;
     config.slowlog_log_slower_than = -1;
     config.slowlog_statsd_enabled = 0;
+    config.hotkey_sample_rate = 0;
 
     memset(config.statsd_addr, 0, sizeof(config.statsd_addr));
     config.metric_interval = 10;
@@ -176,6 +189,26 @@ int config_add(char *name, char *value)
         if (socket_parse_port(value, &config.bind) == CORVUS_ERR) {
             return CORVUS_ERR;
         }
+    } else if (strcmp(name, "bind-unix") == 0) {
+        if (strlen(value) > UNIX_PATH_SIZE) {
+            LOG(WARN, "bind-unix: path too long");
+            return CORVUS_ERR;
+        }
+        strncpy(config.bind_unix, value, UNIX_PATH_SIZE);
+    } else if (strcmp(name, "bind-unix-perm") == 0) {
+        char *end;
+        long perm = strtol(value, &end, 8);
+        if (*value == '\0' || *end != '\0' || perm < 0 || perm > 0777) {
+            return CORVUS_ERR;
+        }
+        config.bind_unix_perm = perm;
+    } else if (strcmp(name, "metrics-bind") == 0) {
+        // 0 disables the metrics endpoint
+        if (strcmp(value, "0") == 0) {
+            config.metrics_bind = 0;
+        } else if (socket_parse_port(value, &config.metrics_bind) == CORVUS_ERR) {
+            return CORVUS_ERR;
+        }
     } else if (strcmp(name, "syslog") == 0) {
         config_boolean(&config.syslog, value);
     } else if (strcmp(name, "read-slave") == 0) {
@@ -212,6 +245,11 @@ int config_add(char *name, char *value)
         } else {
             config.bufsize = val;
         }
+    } else if (strcmp(name, "buffer-arena") == 0) {
+        config_boolean(&config.buffer_arena, value);
+    } else if (strcmp(name, "splice-threshold") == 0) {
+        TRY_PARSE_INT();
+        config.splice_threshold = val < 0 ? 0 : val;
     } else if (strcmp(name, "client_timeout") == 0) {
         TRY_PARSE_INT();
         config.client_timeout = val < 0 ? 0 : val;
@@ -282,6 +320,10 @@ int config_add(char *name, char *value)
         config.slowlog_max_len = val;
     } else if (strcmp(name, "slowlog-statsd-enabled") == 0) {
         config_boolean(&config.slowlog_statsd_enabled, value);
+    } else if (strcmp(name, "hotkey-sample-rate") == 0) {
+        TRY_PARSE_INT();
+        if (val < 0 || val > MAX_HOTKEY_SAMPLE_RATE) return CORVUS_ERR;
+        ATOMIC_SET(config.hotkey_sample_rate, val);
     }
     return CORVUS_OK;
 }
@@ -295,6 +337,12 @@ int config_get(const char *name, char *value, size_t max_len)
         strncpy(value, config.cluster, max_len);
     } else if (strcmp(name, "bind") == 0) {
         snprintf(value, max_len, "%u", config.bind);
+    } else if (strcmp(name, "bind-unix") == 0) {
+        strncpy(value, config.bind_unix, max_len);
+    } else if (strcmp(name, "bind-unix-perm") == 0) {
+        snprintf(value, max_len, "%o", config.bind_unix_perm);
+    } else if (strcmp(name, "metrics-bind") == 0) {
+        snprintf(value, max_len, "%u", config.metrics_bind);
     } else if (strcmp(name, "node") == 0) {
         config_node_to_str(value, max_len);
     } else if (strcmp(name, "thread") == 0) {
@@ -329,12 +377,18 @@ int config_get(const char *name, char *value, size_t max_len)
         snprintf(value, max_len, "%" PRId64, config.server_timeout);
     } else if (strcmp(name, "bufsize") == 0) {
         snprintf(value, max_len, "%d", config.bufsize);
+    } else if (strcmp(name, "buffer-arena") == 0) {
+        strncpy(value, BOOL_STR(config.buffer_arena), max_len);
+    } else if (strcmp(name, "splice-threshold") == 0) {
+        snprintf(value, max_len, "%d", config.splice_threshold);
     } else if (strcmp(name, "slowlog-log-slower-than") == 0) {
         snprintf(value, max_len, "%d", ATOMIC_GET(config.slowlog_log_slower_than));
     } else if (strcmp(name, "slowlog-max-len") == 0) {
         snprintf(value, max_len, "%d", config.slowlog_max_len);
     } else if (strcmp(name, "slowlog-statsd-enabled") == 0) {
         strncpy(value, BOOL_STR(config.slowlog_statsd_enabled), max_len);
+    } else if (strcmp(name, "hotkey-sample-rate") == 0) {
+        snprintf(value, max_len, "%d", ATOMIC_GET(config.hotkey_sample_rate));
     } else {
         return CORVUS_ERR;
     }
@@ -603,7 +657,8 @@ int config_rewrite()
 
 bool config_option_changable(const char *option)
 {
-    const char *CHANGABLE_OPTIONS[] = {"node", "loglevel", "slowlog-log-slower-than"};
+    const char *CHANGABLE_OPTIONS[] = {"node", "loglevel", "slowlog-log-slower-than",
+        "hotkey-sample-rate"};
     const size_t OPTIONS_NUM = sizeof(CHANGABLE_OPTIONS) / sizeof(char*);
     for (size_t i = 0; i != OPTIONS_NUM; i++) {
         if (strcasecmp(CHANGABLE_OPTIONS[i], option) == 0) {
@@ -5,6 +5,7 @@
 
 #define CLUSTER_NAME_SIZE 127
 #define CONFIG_FILE_PATH_SIZE 256
+#define UNIX_PATH_SIZE 107
 
 struct node_conf {
     struct address *addr;
@@ -16,6 +17,9 @@ struct corvus_config {
     char config_file_path[CONFIG_FILE_PATH_SIZE + 1];
     char cluster[CLUSTER_NAME_SIZE + 1];
     uint16_t bind;
+    char bind_unix[UNIX_PATH_SIZE + 1];
+    int bind_unix_perm;
+    uint16_t metrics_bind;
     struct node_conf *node;
     int thread;
     int loglevel;
@@ -29,9 +33,12 @@ struct corvus_config {
     int64_t client_timeout;
     int64_t server_timeout;
     int bufsize;
+    bool buffer_arena;
+    int splice_threshold;
     int slowlog_log_slower_than;
     int slowlog_max_len;
     bool slowlog_statsd_enabled;
+    int hotkey_sample_rate;
 } config;
 
 void config_init();
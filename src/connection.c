@@ -91,6 +91,7 @@ static struct connection *conn_create_server(struct context *ctx,
         server->info->readonly = true;
     }
 
+    info->latency = cv_calloc(1, sizeof(struct histogram));
     strncpy(info->dsn, key, ADDRESS_LEN);
     dict_set(&ctx->server_table, info->dsn, (void*)server);
     TAILQ_INSERT_TAIL(&ctx->servers, server, next);
@@ -105,6 +106,7 @@ void conn_info_init(struct conn_info *info)
     info->readonly_sent = false;
     info->quit = false;
     info->slow_cmd_counts = NULL;
+    info->latency = NULL;
 
     memset(&info->addr, 0, sizeof(info->addr));
     memset(info->dsn, 0, sizeof(info->dsn));
@@ -113,6 +115,8 @@ void conn_info_init(struct conn_info *info)
 
     info->last_active = -1;
     info->current_buf = NULL;
+    info->read_hint = 0;
+    info->relay = NULL;
 
     STAILQ_INIT(&info->cmd_queue);
     STAILQ_INIT(&info->ready_queue);
@@ -194,11 +198,15 @@ void conn_free(struct connection *conn)
 
     conn->registered = false;
 
-    if (conn->ev != NULL) {
-        conn->ev->info = NULL;
-        conn_free(conn->ev);
-        conn_recycle(conn->ctx, conn->ev);
-        conn->ev = NULL;
+    if (conn->dirty) {
+        TAILQ_REMOVE(&conn->ctx->dirty_conns, conn, dirty_next);
+        conn->dirty = false;
+    }
+
+    if (conn->ready_queued) {
+        TAILQ_REMOVE(&conn->ctx->ready_conns, conn, ready_next);
+        conn->ready_queued = false;
+        conn->ctx->ready_count--;
     }
 
     if (conn->info == NULL) return;
@@ -320,22 +328,28 @@ struct connection *conn_get_raw_server(struct context *ctx)
 struct connection *conn_get_server(struct context *ctx, uint16_t slot,
         int access)
 {
-    struct address *addr;
-    struct node_info info;
+    size_t i = 0;
     bool readonly = false;
+    struct connection *server;
+    struct slot_route *route = slot_get_route(&ctx->slot_table, slot);
 
-    if (slot_get_node_addr(slot, &info)) {
-        addr = &info.nodes[0];
-        if (access != CMD_ACCESS_WRITE && config.readslave && info.index > 1) {
+    if (route != NULL) {
+        if (access != CMD_ACCESS_WRITE && config.readslave && route->len > 1) {
             int r = rand_r(&ctx->seed);
-            if (!config.readmasterslave || r % info.index != 0) {
-                int i = r % (info.index - 1);
-                addr = &info.nodes[++i];
+            if (!config.readmasterslave || r % route->len != 0) {
+                i = r % (route->len - 1) + 1;
                 readonly = true;
             }
         }
-        if (addr->port > 0) {
-            return conn_get_server_from_pool(ctx, addr, readonly);
+        if (route->nodes[i].port > 0) {
+            server = route->servers[i];
+            if (server == NULL) {
+                server = conn_get_server_from_pool(ctx, &route->nodes[i], readonly);
+                route->servers[i] = server;
+            } else if (verify_server(server, readonly) == CORVUS_ERR) {
+                return NULL;
+            }
+            return server;
         }
     }
     return conn_get_raw_server(ctx);
@@ -351,7 +365,8 @@ struct connection *conn_get_server(struct context *ctx, uint16_t slot,
  *
  * `local` means whether to get buf from `info->local_data` or `info->data`.
  */
-struct mbuf *conn_get_buf(struct connection *conn, bool unprocessed, bool local)
+static struct mbuf *conn_get_buf_size(struct connection *conn, bool unprocessed,
+        bool local, size_t size)
 {
     struct mbuf *buf = NULL;
     struct mhdr *queue = local ? &conn->info->local_data : &conn->info->data;
@@ -361,13 +376,26 @@ struct mbuf *conn_get_buf(struct connection *conn, bool unprocessed, bool local)
     }
 
     if (buf == NULL || (unprocessed ? buf->pos : buf->last) >= buf->end) {
-        buf = mbuf_get(conn->ctx);
+        buf = mbuf_get_size(conn->ctx, size);
         buf->queue = queue;
         TAILQ_INSERT_TAIL(queue, buf, next);
     }
     return buf;
 }
 
+/*
+ * New read buffers are sized by the rest of a bulk string being parsed,
+ * or by the recent reads of the connection.
+ */
+struct mbuf *conn_get_buf(struct connection *conn, bool unprocessed, bool local)
+{
+    size_t size = 0;
+    if (!local) {
+        size = MAX(conn->info->read_hint, reader_pending(&conn->info->reader));
+    }
+    return conn_get_buf_size(conn, unprocessed, local, size);
+}
+
 int conn_register(struct connection *conn)
 {
     struct context *ctx = conn->ctx;
@@ -378,11 +406,51 @@ int conn_register(struct connection *conn)
     }
 }
 
+/*
+ * Queue the connection to be written at the end of current loop iteration
+ * instead of rearming it with `epoll_ctl` on every command.
+ */
+void conn_mark_dirty(struct connection *conn)
+{
+    if (conn->dirty) return;
+    conn->dirty = true;
+    TAILQ_INSERT_TAIL(&conn->ctx->dirty_conns, conn, dirty_next);
+}
+
+/*
+ * Connections are registered edge triggered with both EPOLLIN and EPOLLOUT,
+ * so after a write returns EAGAIN the kernel reports EPOLLOUT again once
+ * the socket is writable. Only connections which have not been registered
+ * yet need an `epoll_ctl` here.
+ */
+void conn_flush_dirty(struct context *ctx)
+{
+    struct connection *conn;
+
+    while (!TAILQ_EMPTY(&ctx->dirty_conns)) {
+        conn = TAILQ_FIRST(&ctx->dirty_conns);
+        TAILQ_REMOVE(&ctx->dirty_conns, conn, dirty_next);
+        conn->dirty = false;
+
+        if (conn->eof || conn->fd == -1 || conn->info == NULL) continue;
+
+        if (!conn->registered && conn_register(conn) == CORVUS_ERR) {
+            LOG(ERROR, "%s: fail to register connection %d", __func__, conn->fd);
+            conn->ready(conn, E_ERROR);
+            continue;
+        }
+        // wait for EPOLLOUT to complete the connection
+        if (conn->info->status == CONNECTING) continue;
+
+        conn->ready(conn, E_WRITABLE);
+    }
+}
+
 void conn_add_data(struct connection *conn, uint8_t *data, int n,
         struct buf_ptr *start, struct buf_ptr *end)
 {
     // get buffer from local_data.
-    struct mbuf *buf = conn_get_buf(conn, false, true);
+    struct mbuf *buf = conn_get_buf_size(conn, false, true, n);
     int remain = n, wlen, size, len = 0;
 
     if (remain > 0 && start != NULL) {
@@ -402,7 +470,7 @@ void conn_add_data(struct connection *conn, uint8_t *data, int n,
             end->buf = buf;
         }
         if (wlen - size <= 0) {
-            buf = conn_get_buf(conn, false, true);
+            buf = conn_get_buf_size(conn, false, true, remain);
         }
     }
 }
@@ -424,7 +492,7 @@ int conn_write(struct connection *conn, int clear)
     status = socket_write(conn->fd, vec, n);
     if (status == CORVUS_AGAIN || status == CORVUS_ERR) return status;
 
-    ATOMIC_INC(conn->ctx->stats.send_bytes, status);
+    STATS_INCR(conn->ctx->stats.basic.send_bytes, status);
 
     if (status < bytes) {
         for (i = 0; i < n; i++) {
@@ -454,8 +522,16 @@ int conn_read(struct connection *conn, struct mbuf *buf)
     if (n == 0) return CORVUS_EOF;
     if (n == CORVUS_ERR) return CORVUS_ERR;
     if (n == CORVUS_AGAIN) return CORVUS_AGAIN;
-    ATOMIC_INC(conn->ctx->stats.recv_bytes, n);
-    ATOMIC_INC(conn->info->recv_bytes, n);
+
+    // grow while reads fill buffers, shrink back for idle connections
+    uint32_t *hint = &conn->info->read_hint;
+    if (buf->last >= buf->end) {
+        *hint = MIN((uint64_t)MAX(*hint, (uint32_t)n) * 2, UINT32_MAX);
+    } else {
+        *hint = MAX((uint32_t)n, *hint / 2);
+    }
+    STATS_INCR(conn->ctx->stats.basic.recv_bytes, n);
+    STATS_INCR(conn->info->recv_bytes, n);
     return CORVUS_OK;
 }
 
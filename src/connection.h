@@ -19,16 +19,17 @@ struct connection {
     struct context *ctx;
 
     TAILQ_ENTRY(connection) next;
+    TAILQ_ENTRY(connection) dirty_next;
+    TAILQ_ENTRY(connection) ready_next;
 
     int fd;
 
     struct conn_info *info;
 
-    struct connection *ev;
-    struct connection *parent;
-    bool event_triggered;
     bool eof;
     bool registered;
+    bool dirty;
+    bool ready_queued;
 
     void (*ready)(struct connection *self, uint32_t mask);
 };
@@ -56,6 +57,10 @@ struct conn_info {
     struct mhdr data;
     struct mhdr local_data;
     struct iov_data iov;
+    // expected size of the next read, picks the size of new read buffers
+    uint32_t read_hint;
+    // bulk reply being spliced, shared by the server and the client
+    struct relay *relay;
 
     // If `requirepass` config is setted the client should be verified.
     bool authenticated;
@@ -72,6 +77,8 @@ struct conn_info {
 
     // slow log, only for server connection in worker thread
     uint32_t *slow_cmd_counts;
+    // remote latency of commands sent to this node, same as above
+    struct histogram *latency;
 };
 
 TAILQ_HEAD(conn_tqh, connection);
@@ -89,6 +96,8 @@ struct connection *conn_get_server(struct context *ctx, uint16_t slot, int acces
 struct mbuf *conn_get_buf(struct connection *conn, bool unprocessed, bool local);
 int conn_create_fd();
 int conn_register(struct connection *conn);
+void conn_mark_dirty(struct connection *conn);
+void conn_flush_dirty(struct context *ctx);
 void conn_add_data(struct connection *conn, uint8_t *data, int n,
         struct buf_ptr *start, struct buf_ptr *end);
 int conn_write(struct connection *conn, int clear);
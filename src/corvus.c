@@ -13,6 +13,8 @@
 #include "logging.h"
 #include "event.h"
 #include "proxy.h"
+#include "metrics.h"
+#include "client.h"
 #include "stats.h"
 #include "dict.h"
 #include "timer.h"
@@ -20,6 +22,7 @@
 
 static pthread_spinlock_t signal_lock;
 static struct context *contexts;
+static int unix_fd = -1;
 
 void sigsegv_handler(int sig)
 {
@@ -169,6 +172,23 @@ void context_init(struct context *ctx)
     STAILQ_INIT(&ctx->free_conn_infoq);
     TAILQ_INIT(&ctx->servers);
     TAILQ_INIT(&ctx->conns);
+    TAILQ_INIT(&ctx->dirty_conns);
+    TAILQ_INIT(&ctx->ready_conns);
+
+    conn_init(&ctx->unix_proxy, ctx);
+    conn_init(&ctx->metrics, ctx);
+    TAILQ_INIT(&ctx->metrics_conns);
+
+    extern const size_t CMD_NUM;
+    ctx->total_latency = cv_calloc(CMD_NUM, sizeof(struct histogram*));
+    ctx->remote_latency = cv_calloc(CMD_NUM, sizeof(struct histogram*));
+    ctx->request_size = cv_calloc(CMD_NUM, sizeof(struct histogram*));
+    ctx->reply_size = cv_calloc(CMD_NUM, sizeof(struct histogram*));
+
+    hotkey_init(&ctx->hotkeys);
+    bigkey_init(&ctx->bigkeys);
+    slotstats_init(&ctx->slotstats);
+    askcache_init(&ctx->askcache);
 
     ctx->slowlog.capacity = 0;  // for non worker threads
 }
@@ -197,15 +217,35 @@ void context_free(struct context *ctx)
         conn_free(conn);
         conn_buf_free(conn);
         cv_free(conn->info->slow_cmd_counts);
+        cv_free(conn->info->latency);
         cv_free(conn->info);
         cv_free(conn);
     }
     dict_free(&ctx->server_table);
 
+    slot_table_free(&ctx->slot_table);
+    cv_free(ctx->slot_table.routes);
+
     /* slowlog */
     if (ctx->slowlog.capacity > 0)
         slowlog_free(&ctx->slowlog);
 
+    /* latency and size histograms */
+    extern const size_t CMD_NUM;
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        cv_free(ctx->total_latency[i]);
+        cv_free(ctx->remote_latency[i]);
+        cv_free(ctx->request_size[i]);
+        cv_free(ctx->reply_size[i]);
+    }
+    cv_free(ctx->total_latency);
+    cv_free(ctx->remote_latency);
+    cv_free(ctx->request_size);
+    cv_free(ctx->reply_size);
+
+    slotstats_free(&ctx->slotstats);
+    askcache_free(&ctx->askcache);
+
     /* mbuf queue */
     mbuf_destroy(ctx);
 
@@ -217,17 +257,13 @@ void context_free(struct context *ctx)
         cv_free(cmd);
         ctx->mstats.free_cmds--;
     }
+    parse_pool_free(&ctx->parse_pool);
 
     /* connection queue */
     while (!TAILQ_EMPTY(&ctx->conns)) {
         conn = TAILQ_FIRST(&ctx->conns);
         TAILQ_REMOVE(&ctx->conns, conn, next);
         if (conn->fd != -1) {
-            if (conn->ev != NULL) {
-                conn_free(conn->ev);
-                cv_free(conn->ev);
-                conn->ev = NULL;
-            }
             conn_free(conn);
             conn_buf_free(conn);
         }
@@ -285,6 +321,28 @@ void *main_loop(void *data)
         exit(EXIT_FAILURE);
     }
 
+    if (unix_fd != -1) {
+        if (proxy_init_unix(&ctx->unix_proxy, ctx, unix_fd) == -1) {
+            LOG(ERROR, "Fatal: fail to create unix socket proxy.");
+            exit(EXIT_FAILURE);
+        }
+        if (event_register(&ctx->loop, &ctx->unix_proxy, E_READABLE) == -1) {
+            LOG(ERROR, "Fatal: fail to register unix socket proxy.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.metrics_bind > 0) {
+        if (metrics_init(&ctx->metrics, ctx, "0.0.0.0", config.metrics_bind) == -1) {
+            LOG(ERROR, "Fatal: fail to create metrics endpoint.");
+            exit(EXIT_FAILURE);
+        }
+        if (event_register(&ctx->loop, &ctx->metrics, E_READABLE) == -1) {
+            LOG(ERROR, "Fatal: fail to register metrics endpoint.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (timer_init(&ctx->timer, ctx) == -1) {
         LOG(ERROR, "Fatal: fail to init timer.");
         exit(EXIT_FAILURE);
@@ -299,7 +357,9 @@ void *main_loop(void *data)
     }
 
     while (ctx->state != CTX_QUIT) {
-        event_wait(&ctx->loop, -1);
+        event_wait(&ctx->loop, TAILQ_EMPTY(&ctx->ready_conns) ? -1 : 0);
+        client_run_ready(ctx);
+        conn_flush_dirty(ctx);
     }
     LOG(DEBUG, "main loop quiting");
     return NULL;
@@ -474,6 +534,14 @@ int main(int argc, const char *argv[])
 
     cmd_map_init();
 
+    if (strlen(config.bind_unix) > 0) {
+        unix_fd = socket_create_unix_server(config.bind_unix, config.bind_unix_perm);
+        if (unix_fd == -1) {
+            LOG(ERROR, "fail to listen on %s", config.bind_unix);
+            return EXIT_FAILURE;
+        }
+    }
+
     // start slot management thread
     if (slot_start_manager(&contexts[config.thread]) == CORVUS_ERR) {
         LOG(ERROR, "fail to start slot manager thread");
@@ -504,6 +572,12 @@ int main(int argc, const char *argv[])
     }
 
     LOG(INFO, "serve at 0.0.0.0:%d", config.bind);
+    if (unix_fd != -1) {
+        LOG(INFO, "serve at %s", config.bind_unix);
+    }
+    if (config.metrics_bind > 0) {
+        LOG(INFO, "serve metrics at 0.0.0.0:%d", config.metrics_bind);
+    }
 
     for (i = 0; i < config.thread; i++) {
         if ((err = pthread_join(contexts[i].thread, NULL)) != 0) {
@@ -511,6 +585,11 @@ int main(int argc, const char *argv[])
         }
     }
 
+    if (unix_fd != -1) {
+        close(unix_fd);
+        unlink(config.bind_unix);
+    }
+
     // stop stats thread
     if (config.stats) {
         stats_kill();
@@ -527,7 +606,6 @@ int main(int argc, const char *argv[])
 
     // free `contexts`
     destroy_contexts();
-    cmd_map_destroy();
     cv_free(config.requirepass);
     config_free();
     if (config.syslog) closelog();
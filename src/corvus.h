@@ -7,6 +7,7 @@
 #include <stdbool.h>
 
 #include "mbuf.h"
+#include "arena.h"
 #include "command.h"
 #include "connection.h"
 #include "stats.h"
@@ -14,6 +15,11 @@
 #include "event.h"
 #include "slowlog.h"
 #include "config.h"
+#include "slot.h"
+#include "hotkey.h"
+#include "bigkey.h"
+#include "slotstats.h"
+#include "askcache.h"
 
 #define VERSION "0.2.7"
 
@@ -34,6 +40,7 @@
 
 #define THREAD_STACK_SIZE (1024*1024*4)
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define ATOMIC_GET(data) \
     __atomic_load_n(&(data), __ATOMIC_SEQ_CST)
@@ -59,14 +66,18 @@ enum {
 
 struct context {
     /* buffer related */
-    size_t mbuf_offset;
+    uint32_t mbuf_sizes[MBUF_CLASSES];
 
-    struct mhdr free_mbufq;
+    struct mhdr free_mbufq[MBUF_CLASSES];
+    struct arena arena;
+    struct parse_pool parse_pool;
     struct cmd_tqh free_cmdq;
     struct conn_info_tqh free_conn_infoq;
     struct buf_time_tqh free_buf_timeq;
 
     struct connection proxy;
+    struct connection unix_proxy;
+    struct connection metrics;
     struct connection timer;
 
     /* connection pool */
@@ -77,6 +88,20 @@ struct context {
 
     struct conn_tqh servers;
 
+    /* per thread routing table */
+    struct slot_table slot_table;
+    struct askcache askcache;
+
+    /* connections with pending writes in current loop iteration */
+    struct conn_tqh dirty_conns;
+
+    /* clients with unparsed input left, drained after each event_wait */
+    struct conn_tqh ready_conns;
+    int ready_count;
+
+    /* open connections of the metrics endpoint */
+    struct conn_tqh metrics_conns;
+
     /* event */
     struct event_loop loop;
 
@@ -85,9 +110,23 @@ struct context {
     pthread_t thread;
 
     /* stats */
-    struct basic_stats stats;
+    struct thread_stats stats;
     struct memory_stats mstats;
-    long long last_command_latency;
+
+    /* latency histograms indexed by command type, allocated on first use */
+    struct histogram **total_latency;
+    struct histogram **remote_latency;
+
+    /* request and reply sizes indexed by command type, allocated on first use */
+    struct histogram **request_size;
+    struct histogram **reply_size;
+    struct bigkey_table bigkeys;
+
+    /* traffic per slot */
+    struct slotstats slotstats;
+
+    /* sampled key frequencies */
+    struct hotkey_table hotkeys;
 
     /* slowlog */
     struct slowlog_queue slowlog;
@@ -94,7 +94,7 @@ int event_deregister(struct event_loop *loop, struct connection *c)
 
 int event_wait(struct event_loop *loop, int timeout)
 {
-    int i, j, nevents;
+    int i, nevents;
 
     while (true) {
         nevents = epoll_wait(loop->epfd, loop->events, loop->nevent, timeout);
@@ -104,20 +104,6 @@ int event_wait(struct event_loop *loop, int timeout)
                 struct connection *c = e->data.ptr;
                 uint32_t mask = 0;
 
-                bool duplicated = false;
-
-                if (c->parent != NULL) {
-                    for (j = i + 1; j < nevents; j++) {
-                        int fd = ((struct connection*)(loop->events[j].data.ptr))->fd;
-                        if (fd == c->parent->fd) {
-                            c->parent->event_triggered = false;
-                            duplicated = true;
-                            break;
-                        }
-                    }
-                }
-                if (duplicated) continue;
-
                 if (e->events & EPOLLIN) mask |= E_READABLE;
                 if (e->events & EPOLLOUT) mask |= E_WRITABLE;
                 if (e->events & EPOLLHUP) mask |= E_READABLE;
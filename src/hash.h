@@ -5,6 +5,8 @@
 #include "parser.h"
 
 uint32_t lookup3_hash(const char *key);
+uint16_t crc16_update(uint16_t crc, const uint8_t *s, size_t len);
 uint16_t crc16(const struct pos_array *pos);
+void crc16_batch(const uint8_t *bufs[], const size_t lens[], uint16_t crcs[], size_t n);
 
 #endif /* end of include guard: HASH_H */
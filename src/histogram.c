@@ -0,0 +1,85 @@
+#include "histogram.h"
+
+#define COUNT_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+#define COUNT_SET(c, v) __atomic_store_n(&(c), v, __ATOMIC_RELAXED)
+
+static inline int hist_index(int64_t value)
+{
+    int msb, shift;
+    uint64_t v = value < 0 ? 0 : value;
+
+    if (v < HIST_SUB_COUNT) return v;
+
+    msb = 63 - __builtin_clzll(v);
+    if (msb >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+
+    shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + ((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/* highest value falling in the bucket */
+static inline int64_t hist_value(int index)
+{
+    int shift = index / HIST_SUB_COUNT - 1;
+    int sub = index % HIST_SUB_COUNT;
+
+    if (shift < 0) return index;
+    return ((int64_t)(HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void hist_record(struct histogram *h, int64_t value)
+{
+    int i = hist_index(value);
+    // only the owner thread writes, a relaxed store is enough for readers
+    COUNT_SET(h->counts[i], COUNT_GET(h->counts[i]) + 1);
+}
+
+void hist_merge(struct histogram *dst, struct histogram *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += COUNT_GET(src->counts[i]);
+    }
+}
+
+/* dst -= src, src should be an earlier snapshot of dst */
+void hist_sub(struct histogram *dst, struct histogram *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] -= src->counts[i];
+    }
+}
+
+uint64_t hist_count(struct histogram *h)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        n += h->counts[i];
+    }
+    return n;
+}
+
+/* p in [0, 100], returns -1 if the histogram is empty */
+int64_t hist_percentile(struct histogram *h, double p)
+{
+    uint64_t n = 0, total = hist_count(h);
+    if (total == 0) return -1;
+
+    double r = p / 100.0 * total;
+    uint64_t rank = r;
+    if (rank < r) rank++;
+    if (rank == 0) rank = 1;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        n += h->counts[i];
+        if (n >= rank) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+int64_t hist_max(struct histogram *h)
+{
+    for (int i = HIST_BUCKETS - 1; i >= 0; i--) {
+        if (h->counts[i] > 0) return hist_value(i);
+    }
+    return -1;
+}
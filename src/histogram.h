@@ -0,0 +1,33 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of non-negative values, latency in microseconds or
+ * sizes in bytes.
+ * Each power of two is split into HIST_SUB_COUNT linear buckets, so a
+ * recorded value is reported with a relative error below 1/HIST_SUB_COUNT.
+ * Values of 2^HIST_MAX_BITS or more fall in the last bucket.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/*
+ * A histogram has a single writer, the thread owning it. Other threads may
+ * read it with `hist_merge` at any time.
+ */
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+};
+
+void hist_record(struct histogram *h, int64_t value);
+void hist_merge(struct histogram *dst, struct histogram *src);
+void hist_sub(struct histogram *dst, struct histogram *src);
+uint64_t hist_count(struct histogram *h);
+int64_t hist_percentile(struct histogram *h, double p);
+int64_t hist_max(struct histogram *h);
+
+#endif /* end of include guard: HISTOGRAM_H */
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <stdlib.h>
+#include "corvus.h"
+#include "hotkey.h"
+#include "alloc.h"
+#include "logging.h"
+
+#define HOTKEY_IDLE_COUNTDOWN 65536
+
+static uint64_t hotkey_hash(struct pos_array *key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < key->pos_len; i++) {
+        struct pos *p = &key->items[i];
+        for (j = 0; j < p->len; j++) {
+            h ^= p->str[j];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+static void hotkey_copy_key(struct hotkey_entry *e, struct pos_array *key)
+{
+    int i, n, len = 0;
+
+    for (i = 0; i < key->pos_len && len < HOTKEY_KEY_LEN; i++) {
+        n = MIN(key->items[i].len, HOTKEY_KEY_LEN - len);
+        memcpy(e->key + len, key->items[i].str, n);
+        len += n;
+    }
+    e->key[len] = '\0';
+    e->len = key->str_len;
+}
+
+static void hotkey_update_top(struct hotkey_table *t, struct pos_array *key,
+        uint64_t hash, uint32_t count)
+{
+    struct hotkey_entry *e = NULL;
+    int i;
+
+    for (i = 0; i < t->top_len; i++) {
+        if (t->top[i].hash == hash && t->top[i].len == key->str_len) {
+            t->top[i].count = count;
+            return;
+        }
+    }
+
+    if (t->top_len < HOTKEY_TOPK) {
+        e = &t->top[t->top_len++];
+    } else {
+        e = &t->top[0];
+        for (i = 1; i < t->top_len; i++) {
+            if (t->top[i].count < e->count) e = &t->top[i];
+        }
+        if (e->count >= count) return;
+    }
+
+    e->hash = hash;
+    e->count = count;
+    hotkey_copy_key(e, key);
+}
+
+void hotkey_init(struct hotkey_table *table)
+{
+    memset(table, 0, sizeof(struct hotkey_table));
+}
+
+/*
+ * Called for about one in `hotkey-sample-rate` keys. The sketch uses
+ * conservative update, only counters below the new estimate are raised.
+ */
+void hotkey_sample(struct context *ctx, struct pos_array *key)
+{
+    struct hotkey_table *t = &ctx->hotkeys;
+    uint32_t *c[HOTKEY_DEPTH], min = UINT32_MAX;
+    int i, rate = ATOMIC_GET(config.hotkey_sample_rate);
+
+    if (rate <= 0) {
+        t->countdown = HOTKEY_IDLE_COUNTDOWN;
+        return;
+    }
+    // random gaps averaging `rate`, so periodic patterns aren't aliased
+    t->countdown = rate == 1 ? 1 : 1 + rand_r(&ctx->seed) % (2 * rate - 1);
+
+    uint64_t hash = hotkey_hash(key);
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+    for (i = 0; i < HOTKEY_DEPTH; i++) {
+        c[i] = &t->sketch[i][(h1 + i * h2) & (HOTKEY_WIDTH - 1)];
+        if (*c[i] < min) min = *c[i];
+    }
+
+    uint32_t count = min > UINT32_MAX - rate ? UINT32_MAX : min + rate;
+    for (i = 0; i < HOTKEY_DEPTH; i++) {
+        if (*c[i] < count) *c[i] = count;
+    }
+
+    seq_write_begin(&t->seq);
+    hotkey_update_top(t, key, hash, count);
+    seq_write_end(&t->seq);
+}
+
+// called by the owner thread, `now` in seconds
+void hotkey_decay(struct hotkey_table *table, int64_t now)
+{
+    int i, j;
+
+    if (table->decay_time == 0) {
+        table->decay_time = now;
+        return;
+    }
+    if (now - table->decay_time < HOTKEY_DECAY_INTERVAL) return;
+    table->decay_time = now;
+
+    for (i = 0; i < HOTKEY_DEPTH; i++) {
+        for (j = 0; j < HOTKEY_WIDTH; j++) {
+            table->sketch[i][j] >>= 1;
+        }
+    }
+
+    seq_write_begin(&table->seq);
+    for (i = 0, j = 0; i < table->top_len; i++) {
+        table->top[i].count >>= 1;
+        if (table->top[i].count == 0) continue;
+        if (i != j) table->top[j] = table->top[i];
+        j++;
+    }
+    table->top_len = j;
+    seq_write_end(&table->seq);
+}
+
+static int hotkey_cmp_key(const void *lhs, const void *rhs)
+{
+    const struct hotkey_entry *e1 = lhs, *e2 = rhs;
+    if (e1->hash != e2->hash) return e1->hash < e2->hash ? -1 : 1;
+    return e1->len - e2->len;
+}
+
+static int hotkey_cmp_count(const void *lhs, const void *rhs)
+{
+    const struct hotkey_entry *e1 = lhs, *e2 = rhs;
+    if (e1->count != e2->count) return e1->count > e2->count ? -1 : 1;
+    return strcmp(e1->key, e2->key);
+}
+
+/*
+ * Merge top keys of all worker threads into `top`, hottest first.
+ * Returns the number of entries written, at most `n`. Worker threads
+ * are never blocked, a copy torn by an update is taken again.
+ */
+int hotkey_get_top(struct context *contexts, struct hotkey_entry *top, int n)
+{
+    int i, j, len, count = 0;
+    unsigned seq;
+    struct hotkey_entry *entries;
+
+    entries = cv_malloc(sizeof(struct hotkey_entry) * HOTKEY_TOPK * config.thread);
+    for (i = 0; i < config.thread; i++) {
+        struct hotkey_table *t = &contexts[i].hotkeys;
+        do {
+            seq = seq_read_begin(&t->seq);
+            len = MIN(__atomic_load_n(&t->top_len, __ATOMIC_RELAXED), HOTKEY_TOPK);
+            memcpy(entries + count, t->top, sizeof(struct hotkey_entry) * len);
+        } while (seq_read_retry(&t->seq, seq));
+        count += len;
+    }
+
+    if (count > 0) {
+        qsort(entries, count, sizeof(struct hotkey_entry), hotkey_cmp_key);
+        for (i = 1, j = 0; i < count; i++) {
+            if (hotkey_cmp_key(&entries[j], &entries[i]) == 0) {
+                uint32_t c = entries[j].count;
+                entries[j].count = c > UINT32_MAX - entries[i].count ?
+                    UINT32_MAX : c + entries[i].count;
+            } else {
+                entries[++j] = entries[i];
+            }
+        }
+        count = j + 1;
+        qsort(entries, count, sizeof(struct hotkey_entry), hotkey_cmp_count);
+    }
+
+    count = MIN(count, n);
+    memcpy(top, entries, sizeof(struct hotkey_entry) * count);
+    cv_free(entries);
+    return count;
+}
@@ -0,0 +1,50 @@
+#ifndef HOTKEY_H
+#define HOTKEY_H
+
+#include <stdint.h>
+#include "parser.h"
+
+#define HOTKEY_DEPTH 4
+#define HOTKEY_WIDTH 1024
+#define HOTKEY_TOPK 32
+#define HOTKEY_KEY_LEN 128
+#define HOTKEY_DECAY_INTERVAL 10
+
+struct context;
+
+struct hotkey_entry {
+    uint64_t hash;
+    uint32_t count;
+    int len;  // length of the whole key, `key` may be truncated
+    char key[HOTKEY_KEY_LEN + 1];
+};
+
+/*
+ * Sampled key frequencies of a worker thread. Only the owner thread
+ * writes the table, other threads copy the top keys out under `seq`.
+ * Counters are scaled by the sample rate and halved every
+ * `HOTKEY_DECAY_INTERVAL` seconds.
+ */
+struct hotkey_table {
+    int countdown;
+    int64_t decay_time;
+    uint32_t sketch[HOTKEY_DEPTH][HOTKEY_WIDTH];
+
+    unsigned seq;
+    int top_len;
+    struct hotkey_entry top[HOTKEY_TOPK];
+};
+
+// the sample rate is only read again when the countdown runs out
+#define HOTKEY_RECORD(ctx, key) do {                \
+    if (--(ctx)->hotkeys.countdown <= 0) {          \
+        hotkey_sample(ctx, key);                    \
+    }                                               \
+} while (0)
+
+void hotkey_init(struct hotkey_table *table);
+void hotkey_sample(struct context *ctx, struct pos_array *key);
+void hotkey_decay(struct hotkey_table *table, int64_t now);
+int hotkey_get_top(struct context *contexts, struct hotkey_entry *top, int n);
+
+#endif /* end of include guard: HOTKEY_H */
@@ -4,60 +4,76 @@
 #include "logging.h"
 #include "alloc.h"
 
-#define RECYCLE_LENGTH 8192 // 128mb
+#define RECYCLE_SIZE (128 << 20) // free buffers kept in all size classes
 #define BUF_TIME_LIMIT 512
 
-static struct mbuf *mbuf_create(struct context *ctx)
+static struct mbuf *mbuf_create(struct context *ctx, int size_class)
 {
     struct mbuf *mbuf;
     uint8_t *buf;
-
-    if (!TAILQ_EMPTY(&ctx->free_mbufq)) {
-        mbuf = TAILQ_FIRST(&ctx->free_mbufq);
-        TAILQ_REMOVE(&ctx->free_mbufq, mbuf, next);
+    struct arena_chunk *chunk = NULL;
+    struct mhdr *queue = &ctx->free_mbufq[size_class];
+
+    if ((buf = arena_alloc(&ctx->arena, size_class, &chunk)) != NULL) {
+        mbuf = (struct mbuf *)(buf + ctx->mbuf_sizes[size_class] - sizeof(struct mbuf));
+        mbuf->start = buf;
+        mbuf->size_class = size_class;
+        mbuf->chunk = chunk;
+    } else if (!TAILQ_EMPTY(queue)) {
+        mbuf = TAILQ_FIRST(queue);
+        TAILQ_REMOVE(queue, mbuf, next);
 
         ctx->mstats.free_buffers--;
+        ctx->mstats.free_class_buffers[size_class]--;
     } else {
-        buf = (uint8_t*)cv_malloc(config.bufsize);
+        buf = (uint8_t*)cv_malloc(ctx->mbuf_sizes[size_class]);
         if (buf == NULL) {
             return NULL;
         }
 
-        mbuf = (struct mbuf *)(buf + ctx->mbuf_offset);
+        mbuf = (struct mbuf *)(buf + ctx->mbuf_sizes[size_class] - sizeof(struct mbuf));
+        mbuf->start = buf;
+        mbuf->size_class = size_class;
+        mbuf->chunk = NULL;
     }
     return mbuf;
 }
 
 void mbuf_free(struct context *ctx, struct mbuf *mbuf)
 {
-    uint8_t *buf;
-
-    buf = (uint8_t *)mbuf - ctx->mbuf_offset;
-    cv_free(buf);
+    cv_free(mbuf->start);
 }
 
 void mbuf_init(struct context *ctx)
 {
     ctx->mstats.free_buffers = 0;
 
-    TAILQ_INIT(&ctx->free_mbufq);
-    ctx->mbuf_offset = config.bufsize - sizeof(struct mbuf);
+    ctx->mbuf_sizes[MBUF_SMALL] = MIN(512, config.bufsize);
+    ctx->mbuf_sizes[MBUF_MEDIUM] = MIN(4096, config.bufsize);
+    ctx->mbuf_sizes[MBUF_DEFAULT] = config.bufsize;
+    ctx->mbuf_sizes[MBUF_LARGE] = config.bufsize * 16;
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        TAILQ_INIT(&ctx->free_mbufq[i]);
+        ctx->mstats.free_class_buffers[i] = 0;
+    }
+    arena_init(&ctx->arena, config.buffer_arena, ctx->mbuf_sizes);
+}
+
+uint32_t mbuf_class_size(struct context *ctx, int size_class)
+{
+    return ctx->mbuf_sizes[size_class];
 }
 
-struct mbuf *mbuf_get(struct context *ctx)
+static struct mbuf *mbuf_get_class(struct context *ctx, int size_class)
 {
     struct mbuf *mbuf;
-    uint8_t *buf;
 
-    mbuf = mbuf_create(ctx);
+    mbuf = mbuf_create(ctx, size_class);
     if (mbuf == NULL) {
         return NULL;
     }
 
-    buf = (uint8_t *)mbuf - ctx->mbuf_offset;
-    mbuf->start = buf;
-    mbuf->end = buf + ctx->mbuf_offset;
-
+    mbuf->end = (uint8_t *)mbuf;
     mbuf->pos = mbuf->start;
     mbuf->last = mbuf->start;
     mbuf->queue = NULL;
@@ -65,23 +81,57 @@ struct mbuf *mbuf_get(struct context *ctx)
     TAILQ_NEXT(mbuf, next) = NULL;
 
     ctx->mstats.buffers++;
+    ctx->mstats.class_buffers[size_class]++;
 
     return mbuf;
 }
 
+struct mbuf *mbuf_get(struct context *ctx)
+{
+    return mbuf_get_class(ctx, MBUF_DEFAULT);
+}
+
+// the smallest buffer holding `size` bytes, or the largest one
+struct mbuf *mbuf_get_size(struct context *ctx, size_t size)
+{
+    int i;
+    for (i = 0; i < MBUF_CLASSES - 1; i++) {
+        if (size + sizeof(struct mbuf) <= ctx->mbuf_sizes[i]) break;
+    }
+    return mbuf_get_class(ctx, i);
+}
+
+static size_t mbuf_free_size(struct context *ctx)
+{
+    size_t size = 0;
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        size += ctx->mstats.free_class_buffers[i] * ctx->mbuf_sizes[i];
+    }
+    return size;
+}
+
 void mbuf_recycle(struct context *ctx, struct mbuf *mbuf)
 {
+    int size_class = mbuf->size_class;
+
     ctx->mstats.buffers--;
+    ctx->mstats.class_buffers[size_class]--;
+
+    if (mbuf->chunk != NULL) {
+        arena_free(&ctx->arena, size_class, mbuf->chunk, mbuf->start);
+        return;
+    }
 
-    if (ctx->mstats.free_buffers > RECYCLE_LENGTH) {
+    if (mbuf_free_size(ctx) + ctx->mbuf_sizes[size_class] > RECYCLE_SIZE) {
         mbuf_free(ctx, mbuf);
         return;
     }
 
     TAILQ_NEXT(mbuf, next) = NULL;
-    TAILQ_INSERT_HEAD(&ctx->free_mbufq, mbuf, next);
+    TAILQ_INSERT_HEAD(&ctx->free_mbufq[size_class], mbuf, next);
 
     ctx->mstats.free_buffers++;
+    ctx->mstats.free_class_buffers[size_class]++;
 }
 
 uint32_t mbuf_read_size(struct mbuf *mbuf)
@@ -97,13 +147,17 @@ uint32_t mbuf_write_size(struct mbuf *mbuf)
 void mbuf_destroy(struct context *ctx)
 {
     struct mbuf *buf;
-    while (!TAILQ_EMPTY(&ctx->free_mbufq)) {
-        buf = TAILQ_FIRST(&ctx->free_mbufq);
-        TAILQ_REMOVE(&ctx->free_mbufq, buf, next);
-        mbuf_free(ctx, buf);
-
-        ctx->mstats.free_buffers--;
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        while (!TAILQ_EMPTY(&ctx->free_mbufq[i])) {
+            buf = TAILQ_FIRST(&ctx->free_mbufq[i]);
+            TAILQ_REMOVE(&ctx->free_mbufq[i], buf, next);
+            mbuf_free(ctx, buf);
+
+            ctx->mstats.free_buffers--;
+            ctx->mstats.free_class_buffers[i]--;
+        }
     }
+    arena_destroy(&ctx->arena);
 }
 
 void mbuf_range_clear(struct context *ctx, struct buf_ptr ptr[])
@@ -14,7 +14,17 @@
              - (size_t)(&((struct type *)0)->field))))
 #endif
 
+// buffer sizes are 512B, 4KB, bufsize and 16 times bufsize
+enum {
+    MBUF_SMALL,
+    MBUF_MEDIUM,
+    MBUF_DEFAULT,
+    MBUF_LARGE,
+    MBUF_CLASSES,
+};
+
 struct context;
+struct arena_chunk;
 
 struct mbuf {
     TAILQ_ENTRY(mbuf) next;
@@ -24,6 +34,8 @@ struct mbuf {
     uint8_t *end;
     struct mhdr *queue; // the queue contain the buf
     int refcount;
+    int8_t size_class;
+    struct arena_chunk *chunk;  // NULL if not from the arena
 };
 
 // tracking the time after reading from client socket
@@ -45,6 +57,8 @@ struct buf_ptr {
 
 void mbuf_init(struct context *);
 struct mbuf *mbuf_get(struct context *);
+struct mbuf *mbuf_get_size(struct context *ctx, size_t size);
+uint32_t mbuf_class_size(struct context *ctx, int size_class);
 void mbuf_recycle(struct context *, struct mbuf *);
 uint32_t mbuf_read_size(struct mbuf *);
 uint32_t mbuf_write_size(struct mbuf *);
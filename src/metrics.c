@@ -0,0 +1,216 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "corvus.h"
+#include "metrics.h"
+#include "socket.h"
+#include "event.h"
+#include "stats.h"
+#include "array.h"
+#include "alloc.h"
+#include "logging.h"
+
+#define METRICS_REQUEST_SIZE 4096
+#define METRICS_TIMEOUT 10
+
+/*
+ * A scrape connection of the metrics endpoint, one request is served
+ * and the connection is closed after the response is written.
+ */
+struct metrics_conn {
+    struct connection conn;  // must be the first member
+
+    int64_t created;
+
+    char request[METRICS_REQUEST_SIZE + 1];
+    size_t request_len;
+
+    struct cvstr response;
+    size_t response_len;
+    size_t sent;
+};
+
+static void metrics_conn_free(struct metrics_conn *m)
+{
+    struct context *ctx = m->conn.ctx;
+
+    conn_free(&m->conn);
+    TAILQ_REMOVE(&ctx->metrics_conns, &m->conn, next);
+    cvstr_free(&m->response);
+    cv_free(m);
+}
+
+static int metrics_read(struct metrics_conn *m)
+{
+    ssize_t n;
+
+    while (m->request_len < METRICS_REQUEST_SIZE) {
+        n = read(m->conn.fd, m->request + m->request_len,
+                METRICS_REQUEST_SIZE - m->request_len);
+        if (n == 0) return CORVUS_EOF;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return CORVUS_AGAIN;
+            LOG(WARN, "metrics_read: %s", strerror(errno));
+            return CORVUS_ERR;
+        }
+        m->request_len += n;
+        m->request[m->request_len] = '\0';
+        if (strstr(m->request, "\r\n\r\n") != NULL) return CORVUS_OK;
+    }
+
+    LOG(WARN, "metrics_read: request too large");
+    return CORVUS_ERR;
+}
+
+static int metrics_write(struct metrics_conn *m)
+{
+    ssize_t n;
+
+    while (m->sent < m->response_len) {
+        n = write(m->conn.fd, m->response.data + m->sent,
+                m->response_len - m->sent);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return CORVUS_AGAIN;
+            LOG(WARN, "metrics_write: %s", strerror(errno));
+            return CORVUS_ERR;
+        }
+        m->sent += n;
+    }
+    return CORVUS_OK;
+}
+
+static void metrics_handle_request(struct metrics_conn *m)
+{
+    const char *status = "200 OK";
+    const char *path = "/metrics";
+    size_t path_len = strlen(path);
+
+    struct cvstr body = cvstr_new(4096);
+    size_t body_len;
+
+    if (strncmp(m->request, "GET ", 4) != 0) {
+        status = "405 Method Not Allowed";
+        body_len = snprintf(body.data, body.capacity, "%s\n", status);
+    } else if (strncmp(m->request + 4, path, path_len) != 0
+            || strchr(" ?", m->request[4 + path_len]) == NULL)
+    {
+        status = "404 Not Found";
+        body_len = snprintf(body.data, body.capacity, "%s\n", status);
+    } else {
+        body_len = stats_get_metrics(&body);
+    }
+
+    const char *fmt = "HTTP/1.1 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n";
+    int n = snprintf(NULL, 0, fmt, status, body_len);
+
+    m->response = cvstr_new(n + body_len + 1);
+    snprintf(m->response.data, m->response.capacity, fmt, status, body_len);
+    memcpy(m->response.data + n, body.data, body_len);
+    m->response_len = n + body_len;
+    cvstr_free(&body);
+}
+
+static void metrics_conn_ready(struct connection *self, uint32_t mask)
+{
+    struct metrics_conn *m = (struct metrics_conn*)self;
+    int status;
+
+    if (mask & E_ERROR) {
+        metrics_conn_free(m);
+        return;
+    }
+
+    if (m->response.data == NULL) {
+        if (!(mask & E_READABLE)) return;
+
+        status = metrics_read(m);
+        if (status == CORVUS_AGAIN) return;
+        if (status != CORVUS_OK) {
+            metrics_conn_free(m);
+            return;
+        }
+        metrics_handle_request(m);
+    }
+
+    if (metrics_write(m) == CORVUS_AGAIN) return;
+    metrics_conn_free(m);
+}
+
+static void metrics_ready(struct connection *self, uint32_t mask)
+{
+    struct context *ctx = self->ctx;
+    struct metrics_conn *m;
+    int fd;
+
+    if (!(mask & E_READABLE)) return;
+
+    while (1) {
+        fd = socket_accept(self->fd, NULL, 0, NULL);
+        if (fd == CORVUS_AGAIN) break;
+        if (fd == CORVUS_ERR) {
+            LOG(WARN, "metrics_ready: fail to accept");
+            break;
+        }
+        if (socket_set_nonblocking(fd) == -1) {
+            close(fd);
+            continue;
+        }
+
+        m = cv_calloc(1, sizeof(struct metrics_conn));
+        conn_init(&m->conn, ctx);
+        m->conn.fd = fd;
+        m->conn.ready = metrics_conn_ready;
+        m->created = time(NULL);
+        TAILQ_INSERT_TAIL(&ctx->metrics_conns, &m->conn, next);
+
+        if (conn_register(&m->conn) == CORVUS_ERR) {
+            LOG(ERROR, "metrics_ready: fail to register connection");
+            metrics_conn_free(m);
+        }
+    }
+    conn_register(self);
+}
+
+int metrics_init(struct connection *metrics, struct context *ctx, char *host, int port)
+{
+    int fd = socket_create_server(host, port);
+    if (fd == -1) {
+        LOG(ERROR, "metrics_init: fail to create server fd");
+        return CORVUS_ERR;
+    }
+
+    conn_init(metrics, ctx);
+    metrics->fd = fd;
+    metrics->ready = metrics_ready;
+    return CORVUS_OK;
+}
+
+void metrics_check_timeout(struct context *ctx)
+{
+    struct connection *c, *n;
+    int64_t now = time(NULL);
+
+    c = TAILQ_FIRST(&ctx->metrics_conns);
+    while (c != NULL) {
+        n = TAILQ_NEXT(c, next);
+        struct metrics_conn *m = (struct metrics_conn*)c;
+        if (now - m->created > METRICS_TIMEOUT) {
+            LOG(WARN, "metrics connection timed out");
+            metrics_conn_free(m);
+        }
+        c = n;
+    }
+}
+
+void metrics_close_all(struct context *ctx)
+{
+    while (!TAILQ_EMPTY(&ctx->metrics_conns)) {
+        metrics_conn_free((struct metrics_conn*)TAILQ_FIRST(&ctx->metrics_conns));
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+struct connection;
+struct context;
+
+int metrics_init(struct connection *metrics, struct context *ctx, char *host, int port);
+void metrics_check_timeout(struct context *ctx);
+void metrics_close_all(struct context *ctx);
+
+#endif /* end of include guard: METRICS_H */
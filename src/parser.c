@@ -35,6 +35,30 @@ do {                                                                   \
     return CORVUS_OK;                                                  \
 } while (0)
 
+/*
+ * Parse a "<number>\r\n" line when it's complete in [p, last),
+ * return the position after '\n' or NULL to fall back to the
+ * byte by byte state machine.
+ */
+static inline uint8_t *parse_number(uint8_t *p, uint8_t *last, long long *value)
+{
+    long long v = 0;
+    int sign = 1, n = 0;
+
+    if (p < last && *p == '-') {
+        sign = -1;
+        p++;
+    }
+    for (; p < last && *p >= '0' && *p <= '9' && n < 18; p++, n++) {
+        v = v * 10 + (*p - '0');
+    }
+    if (n == 0 || last - p < 2 || p[0] != '\r' || p[1] != '\n') {
+        return NULL;
+    }
+    *value = v * sign;
+    return p + 2;
+}
+
 int stack_pop(struct reader *r)
 {
     struct reader_task *cur, *top;
@@ -75,13 +99,80 @@ int stack_push(struct reader *r, int type)
     return CORVUS_OK;
 }
 
-struct pos *pos_array_push(struct pos_array *arr, int len, uint8_t *p)
+static void *parse_store_alloc(struct parse_store *store, size_t size)
+{
+    struct parse_block *block = store->blocks;
+    struct parse_pool *pool = store->pool;
+
+    size = (size + 7) & ~((size_t)7);
+    if (block == NULL || block->size - block->used < size) {
+        if (size <= PARSE_BLOCK_SIZE && pool->free != NULL) {
+            block = pool->free;
+            pool->free = block->next;
+            pool->len--;
+        } else {
+            size_t block_size = MAX(size, PARSE_BLOCK_SIZE);
+            block = cv_malloc(sizeof(struct parse_block) + block_size);
+            block->size = block_size;
+        }
+        block->used = 0;
+        block->next = store->blocks;
+        store->blocks = block;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+static struct redis_data *elements_alloc(struct reader *r, int n)
+{
+    struct parse_store *store = r->store;
+    struct redis_data *element;
+    int size;
+
+    if (store == NULL) {
+        for (size = 1; size * ARRAY_BASE_SIZE < n; size *= 2);
+        return cv_calloc(size * ARRAY_BASE_SIZE, sizeof(struct redis_data));
+    }
+    if (store->elements_used + n <= PARSE_INLINE_ELEMENTS) {
+        element = &store->elements[store->elements_used];
+        store->elements_used += n;
+    } else {
+        element = parse_store_alloc(store, sizeof(struct redis_data) * n);
+    }
+    memset(element, 0, sizeof(struct redis_data) * n);
+    return element;
+}
+
+static void pos_array_grow(struct parse_store *store, struct pos_array *arr)
+{
+    struct pos *items;
+    int size = arr->max_pos_size == 0 ? 2 : arr->max_pos_size * 2;
+
+    if (store->pos_used + size <= PARSE_INLINE_POS) {
+        items = &store->pos[store->pos_used];
+        store->pos_used += size;
+    } else {
+        items = parse_store_alloc(store, sizeof(struct pos) * size);
+    }
+    if (arr->pos_len > 0) {
+        memcpy(items, arr->items, sizeof(struct pos) * arr->pos_len);
+    }
+    arr->items = items;
+    arr->max_pos_size = size;
+}
+
+struct pos *pos_array_push(struct reader *r, struct pos_array *arr, int len, uint8_t *p)
 {
     struct pos *pos;
     if (arr->pos_len >= arr->max_pos_size) {
-        arr->max_pos_size *= 2;
-        if (arr->max_pos_size == 0) arr->max_pos_size = ARRAY_BASE_SIZE;
-        arr->items = cv_realloc(arr->items, sizeof(struct pos) * arr->max_pos_size);
+        if (r->store != NULL) {
+            pos_array_grow(r->store, arr);
+        } else {
+            arr->max_pos_size *= 2;
+            if (arr->max_pos_size == 0) arr->max_pos_size = ARRAY_BASE_SIZE;
+            arr->items = cv_realloc(arr->items, sizeof(struct pos) * arr->max_pos_size);
+        }
     }
     pos = &arr->items[arr->pos_len++];
     pos->len = len;
@@ -160,8 +251,7 @@ int process_type(struct reader *r)
 
 int process_array(struct reader *r)
 {
-    size_t size;
-    uint8_t *p;
+    uint8_t *p, *q;
     long long v;
     char c;
 
@@ -176,6 +266,14 @@ int process_array(struct reader *r)
         switch (r->item_type) {
             case PARSE_ARRAY_BEGIN:
                 r->item_type = PARSE_ARRAY_LENGTH;
+                if ((q = parse_number(p + 1, r->buf->last, &v)) == NULL) break;
+                r->item_size = v;
+                if (v >= 0) {
+                    task->elements = task->data.elements = v;
+                }
+                r->item_type = PARSE_ARRAY_END;
+                // continue at '\n'
+                r->buf->pos = q - 2;
                 break;
             case PARSE_ARRAY_LENGTH:
                 c = *p;
@@ -199,8 +297,8 @@ int process_array(struct reader *r)
             case PARSE_ARRAY_END:
                 task->data.element = NULL;
                 if (*p == '\n' && task->data.elements > 0 && r->mode == MODE_REQ) {
-                    for (size = 1; size * ARRAY_BASE_SIZE  < task->data.elements; size *= 2);
-                    task->data.element = cv_calloc(size * ARRAY_BASE_SIZE, sizeof(struct redis_data));
+                    task->data.element = elements_alloc(r, task->data.elements);
+                    task->data.stored = r->store != NULL;
                 }
                 END(r, task->data.elements, *p);
         }
@@ -212,7 +310,7 @@ int process_array(struct reader *r)
 int process_string(struct reader *r)
 {
     char c;
-    uint8_t *p;
+    uint8_t *p, *q;
     int remain;
     long long v;
 
@@ -228,6 +326,7 @@ int process_string(struct reader *r)
             return CORVUS_ERR;
         }
         arr = &data->pos;
+        data->stored = r->store != NULL;
     }
 
     while (r->buf->pos < r->buf->last) {
@@ -239,6 +338,18 @@ int process_string(struct reader *r)
                     data->buf[0].pos = r->buf->pos;
                 }
                 r->item_type = PARSE_STRING_LENGTH;
+                if ((q = parse_number(p + 1, r->buf->last, &v)) == NULL) break;
+                if (v < -1) break;
+                r->item_size = v;
+                if (task->elements > 0) task->elements--;
+                if (v == -1) {
+                    r->item_type = PARSE_STRING_END;
+                    r->buf->pos = q - 2;
+                } else {
+                    // the payload is skipped by PARSE_STRING_ENTITY
+                    r->item_type = PARSE_STRING_ENTITY;
+                    r->buf->pos = q - 1;
+                }
                 break;
             case PARSE_STRING_LENGTH:
                 c = *p;
@@ -268,14 +379,14 @@ int process_string(struct reader *r)
                     r->item_type = PARSE_STRING_END;
                     if (r->item_size != 0) {
                         r->buf->pos += r->item_size;
-                        if (arr != NULL) pos_array_push(arr, r->item_size, p);
+                        if (arr != NULL) pos_array_push(r, arr, r->item_size, p);
                         r->item_size = 0;
                     }
                 } else {
                     r->item_size -= remain;
                     // add 1 to pos after break
                     r->buf->pos += remain - 1;
-                    if (arr != NULL) pos_array_push(arr, remain, p);
+                    if (arr != NULL) pos_array_push(r, arr, remain, p);
                 }
                 break;
             case PARSE_STRING_END:
@@ -298,7 +409,7 @@ int process_integer(struct reader *r)
 {
     char c;
     long long v;
-    uint8_t *p;
+    uint8_t *p, *q;
     struct reader_task *task = &r->rstack[r->sidx];
 
     struct redis_data *data = NULL;
@@ -316,6 +427,12 @@ int process_integer(struct reader *r)
         switch (r->item_type) {
             case PARSE_INTEGER_BEGIN:
                 r->item_type = PARSE_INTEGER_LENGTH;
+                if ((q = parse_number(p + 1, r->buf->last, &v)) == NULL) break;
+                r->item_size = v;
+                if (data != NULL) data->integer = v;
+                if (task->elements > 0) task->elements--;
+                r->item_type = PARSE_INTEGER_END;
+                r->buf->pos = q - 2;
                 break;
             case PARSE_INTEGER_LENGTH:
                 c = *p;
@@ -344,8 +461,8 @@ int process_integer(struct reader *r)
 
 int process_simple_string(struct reader *r, int type)
 {
-    char c;
-    uint8_t *p;
+    int n;
+    uint8_t *p, *q;
     struct reader_task *task = &r->rstack[r->sidx];
 
     struct redis_data *data = NULL;
@@ -360,8 +477,9 @@ int process_simple_string(struct reader *r, int type)
         }
 
         arr = &data->pos;
+        data->stored = r->store != NULL;
         if (task->prev_buf != r->buf) {
-            pos = pos_array_push(arr, 0, NULL);
+            pos = pos_array_push(r, arr, 0, NULL);
             if (task->prev_buf != NULL) {
                 pos->str = r->buf->pos;
                 pos->len = 0;
@@ -385,14 +503,19 @@ int process_simple_string(struct reader *r, int type)
                 }
                 r->item_type = PARSE_SIMPLE_STRING_LENGTH;
             case PARSE_SIMPLE_STRING_LENGTH:
-                c = *p;
-                if (c == '\r') {
-                    if (task->elements > 0) task->elements--;
-                    r->item_type = PARSE_SIMPLE_STRING_END;
-                } else if (pos != NULL && arr != NULL) {
-                    pos->len++;
-                    arr->str_len++;
+                q = memchr(p, '\r', r->buf->last - p);
+                n = (q == NULL ? r->buf->last : q) - p;
+                if (pos != NULL && arr != NULL) {
+                    pos->len += n;
+                    arr->str_len += n;
+                }
+                if (q == NULL) {
+                    r->buf->pos = r->buf->last - 1;
+                    break;
                 }
+                if (task->elements > 0) task->elements--;
+                r->item_type = PARSE_SIMPLE_STRING_END;
+                r->buf->pos = q;
                 break;
             case PARSE_SIMPLE_STRING_END:
                 task->cur_data = NULL;
@@ -404,22 +527,197 @@ int process_simple_string(struct reader *r, int type)
     return CORVUS_OK;
 }
 
+static void frame_init(struct reader *r)
+{
+    redis_data_free(&r->data);
+    r->ready = false;
+    r->sign = 1;
+    r->item_type = PARSE_FRAME_TYPE;
+    r->item_size = 0;
+    r->redis_data_type = REP_UNKNOWN;
+    r->frames = 1;
+    r->frame_top = true;
+}
+
+// r->buf->pos is the '\n' ending the current item
+static void frame_end(struct reader *r)
+{
+    r->frame_top = false;
+    if (--r->frames > 0) {
+        r->item_type = PARSE_FRAME_TYPE;
+        r->buf->pos++;
+    } else {
+        // forward pos in `func:parse`
+        r->type = PARSE_END;
+    }
+}
+
+static int frame_header(struct reader *r)
+{
+    long long v = r->item_size;
+
+    if (v < -1 && r->frame_type != ':') {
+        LOG(ERROR, "%s: invalid length %lld", __func__, v);
+        return CORVUS_ERR;
+    }
+    switch (r->frame_type) {
+        case '*':
+            if (r->frame_top) {
+                r->data.type = REP_ARRAY;
+                r->data.elements = v > 0 ? v : 0;
+            }
+            if (v > 0) r->frames += v;
+            break;
+        case '$':
+            if (v == -1) break;
+            // the payload is skipped by its length
+            r->frame_top = false;
+            r->item_type = PARSE_STRING_ENTITY;
+            r->buf->pos++;
+            return CORVUS_OK;
+    }
+    frame_end(r);
+    return CORVUS_OK;
+}
+
+/*
+ * Find the end of a reply without building its redis_data, bulk payloads
+ * are jumped over and nested arrays only add to the count of items left.
+ */
+int process_frame(struct reader *r)
+{
+    char c;
+    long long v;
+    uint8_t *p, *q;
+
+    while (r->type == PARSE_FRAME && r->buf->pos < r->buf->last) {
+        p = r->buf->pos;
+        switch (r->item_type) {
+            case PARSE_FRAME_TYPE:
+                r->frame_type = *p;
+                switch (*p) {
+                    case '*':
+                    case '$':
+                    case ':':
+                        if (r->frame_top) {
+                            r->redis_data_type = *p == '*' ? REP_ARRAY
+                                : *p == '$' ? REP_STRING : REP_INTEGER;
+                        }
+                        if ((q = parse_number(p + 1, r->buf->last, &v)) != NULL) {
+                            r->item_size = v;
+                            r->buf->pos = q - 1;
+                            if (frame_header(r) == CORVUS_ERR) return CORVUS_ERR;
+                            break;
+                        }
+                        r->item_size = 0;
+                        r->sign = 1;
+                        r->item_type = PARSE_FRAME_NUMBER;
+                        r->buf->pos++;
+                        break;
+                    case '+':
+                    case '-':
+                        if (r->frame_top) {
+                            r->redis_data_type = *p == '+' ? REP_SIMPLE_STRING : REP_ERROR;
+                        }
+                        r->item_type = PARSE_FRAME_LINE;
+                        r->buf->pos++;
+                        break;
+                    default:
+                        LOG(ERROR, "unknown reply type '%c'", *p);
+                        return CORVUS_ERR;
+                }
+                break;
+            case PARSE_FRAME_NUMBER:
+                c = *p;
+                switch (c) {
+                    case '-': r->sign = -1; break;
+                    case '\r':
+                        r->item_size *= r->sign;
+                        r->sign = 1;
+                        r->item_type = PARSE_FRAME_NUMBER_END;
+                        break;
+                    default:
+                        v = r->item_size;
+                        TO_NUMBER(v, c);
+                        r->item_size = v;
+                        break;
+                }
+                r->buf->pos++;
+                break;
+            case PARSE_FRAME_NUMBER_END:
+                if (*p != '\n') {
+                    LOG(ERROR, "%s: unexpected charactor %c", __func__, *p);
+                    return CORVUS_ERR;
+                }
+                if (frame_header(r) == CORVUS_ERR) return CORVUS_ERR;
+                break;
+            case PARSE_FRAME_LINE:
+                q = memchr(p, '\r', r->buf->last - p);
+                if (q == NULL) {
+                    r->buf->pos = r->buf->last;
+                    break;
+                }
+                r->item_type = PARSE_FRAME_END;
+                r->buf->pos = q + 1;
+                break;
+            case PARSE_STRING_ENTITY:
+                if (r->item_size > r->buf->last - p) {
+                    r->item_size -= r->buf->last - p;
+                    r->buf->pos = r->buf->last;
+                    break;
+                }
+                r->buf->pos += r->item_size;
+                r->item_size = 0;
+                r->item_type = PARSE_FRAME_CR;
+                break;
+            case PARSE_FRAME_CR:
+                if (*p != '\r') {
+                    LOG(ERROR, "%s: unexpected charactor %c", __func__, *p);
+                    return CORVUS_ERR;
+                }
+                r->item_type = PARSE_FRAME_END;
+                r->buf->pos++;
+                break;
+            case PARSE_FRAME_END:
+                if (*p != '\n') {
+                    LOG(ERROR, "%s: unexpected charactor %c", __func__, *p);
+                    return CORVUS_ERR;
+                }
+                frame_end(r);
+                break;
+        }
+    }
+    return CORVUS_OK;
+}
+
 int parse(struct reader *r, int mode)
 {
     struct mbuf *buf;
+    struct parse_store *store;
     while (r->buf->pos < r->buf->last) {
         switch (r->type) {
             case PARSE_BEGIN:
                 buf = r->buf;
+                store = r->store;
                 buf->refcount++;
-                reader_init(r);
+                if (mode == MODE_REP) {
+                    frame_init(r);
+                } else {
+                    reader_init(r);
+                }
                 r->buf = buf;
+                r->store = store;
                 r->mode = mode;
 
-                r->type = PARSE_TYPE;
+                r->type = mode == MODE_REP ? PARSE_FRAME : PARSE_TYPE;
                 r->start.buf = r->buf;
                 r->start.pos = r->buf->pos;
                 break;
+            case PARSE_FRAME:
+                if (process_frame(r) == CORVUS_ERR) {
+                    return CORVUS_ERR;
+                }
+                break;
             case PARSE_TYPE:
                 if (process_type(r) == CORVUS_ERR) {
                     return CORVUS_ERR;
@@ -485,6 +783,12 @@ void redis_data_free(struct redis_data *data)
 {
     if (data == NULL) return;
 
+    // arrays of a parse store are released with the store
+    if (data->stored) {
+        memset(data, 0, sizeof(struct redis_data));
+        return;
+    }
+
     size_t i;
     switch (data->type) {
         case REP_STRING:
@@ -529,6 +833,53 @@ void reader_feed(struct reader *r, struct mbuf *buf)
     r->buf = buf;
 }
 
+// bytes left of the bulk string being parsed, zero if there is none
+size_t reader_pending(struct reader *r)
+{
+    if (r->item_type != PARSE_STRING_ENTITY || r->item_size <= 0) return 0;
+    return r->item_size + 2;
+}
+
+void parse_store_init(struct parse_store *store, struct parse_pool *pool)
+{
+    store->pool = pool;
+    store->blocks = NULL;
+    store->elements_used = 0;
+    store->pos_used = 0;
+}
+
+void parse_store_reset(struct parse_store *store)
+{
+    struct parse_block *block;
+    struct parse_pool *pool = store->pool;
+
+    while (store->blocks != NULL) {
+        block = store->blocks;
+        store->blocks = block->next;
+        if (block->size == PARSE_BLOCK_SIZE && pool->len < PARSE_FREE_BLOCKS) {
+            block->next = pool->free;
+            pool->free = block;
+            pool->len++;
+        } else {
+            cv_free(block);
+        }
+    }
+    store->elements_used = 0;
+    store->pos_used = 0;
+}
+
+void parse_pool_free(struct parse_pool *pool)
+{
+    struct parse_block *block;
+
+    while (pool->free != NULL) {
+        block = pool->free;
+        pool->free = block->next;
+        cv_free(block);
+    }
+    pool->len = 0;
+}
+
 int reader_ready(struct reader *r)
 {
     return r->ready;
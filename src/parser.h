@@ -62,6 +62,13 @@ enum {
     PARSE_SIMPLE_STRING_LENGTH,
     PARSE_SIMPLE_STRING_END,
     PARSE_ERROR,
+    PARSE_FRAME,
+    PARSE_FRAME_TYPE,
+    PARSE_FRAME_NUMBER,
+    PARSE_FRAME_NUMBER_END,
+    PARSE_FRAME_LINE,
+    PARSE_FRAME_CR,
+    PARSE_FRAME_END,
     PARSE_END,
 };
 
@@ -73,7 +80,7 @@ enum {
     REP_SIMPLE_STRING,
     REP_ERROR,
 
-    MODE_REP,
+    MODE_REP,  // framing only, no redis_data is built
     MODE_REQ,
 };
 
@@ -92,6 +99,7 @@ struct pos_array {
 struct redis_data {
     struct buf_ptr buf[2];
     int8_t type;
+    bool stored;  // arrays below are owned by a parse_store
     union {
         struct pos_array pos;
         long long integer;
@@ -102,6 +110,38 @@ struct redis_data {
     };
 };
 
+#define PARSE_INLINE_ELEMENTS 8
+#define PARSE_INLINE_POS 16
+#define PARSE_BLOCK_SIZE 4096
+#define PARSE_FREE_BLOCKS 64
+
+struct parse_block {
+    struct parse_block *next;
+    size_t size;
+    size_t used;
+    uint8_t data[];
+};
+
+// free blocks of a worker thread
+struct parse_pool {
+    struct parse_block *free;
+    int len;
+};
+
+/*
+ * Arrays parsed from one request, released at once when the command is
+ * recycled. Short requests fit in the inline arrays, others bump
+ * allocate from blocks taken from the pool of the thread.
+ */
+struct parse_store {
+    struct parse_pool *pool;
+    struct parse_block *blocks;
+    int elements_used;
+    int pos_used;
+    struct redis_data elements[PARSE_INLINE_ELEMENTS];
+    struct pos pos[PARSE_INLINE_POS];
+};
+
 struct reader_task {
     int8_t type;
     int elements;
@@ -131,12 +171,24 @@ struct reader {
 
     struct buf_ptr start;
     struct buf_ptr end;
+
+    // MODE_REP counts the items left in the reply instead of nesting
+    long long frames;
+    uint8_t frame_type;
+    bool frame_top;
+
+    // where arrays of requests are allocated, heap if NULL
+    struct parse_store *store;
 };
 
 void reader_init(struct reader *r);
 void reader_free(struct reader *r);
 void reader_feed(struct reader *r, struct mbuf *buf);
 int reader_ready(struct reader *r);
+size_t reader_pending(struct reader *r);
+void parse_store_init(struct parse_store *store, struct parse_pool *pool);
+void parse_store_reset(struct parse_store *store);
+void parse_pool_free(struct parse_pool *pool);
 int parse(struct reader *r, int mode);
 struct pos *pos_get(struct pos_array *arr, int idx);
 int pos_to_str(struct pos_array *pos, char *str);
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include "corvus.h"
 #include "proxy.h"
 #include "socket.h"
@@ -33,15 +34,9 @@ int proxy_accept(struct connection *proxy)
         return CORVUS_ERR;
     }
 
-    if (event_register(&client->ctx->loop, client->ev, E_READABLE) == CORVUS_ERR) {
-        LOG(ERROR, "proxy_accept: fail to register client event");
-        conn_free(client);
-        conn_recycle(ctx, client);
-        return CORVUS_ERR;
-    }
     TAILQ_INSERT_TAIL(&ctx->conns, client, next);
 
-    ATOMIC_INC(ctx->stats.connected_clients, 1);
+    STATS_INCR(ctx->stats.basic.connected_clients, 1);
     return CORVUS_OK;
 }
 
@@ -74,3 +69,18 @@ int proxy_init(struct connection *proxy, struct context *ctx, char *host, int po
     proxy->ready = proxy_ready;
     return CORVUS_OK;
 }
+
+int proxy_init_unix(struct connection *proxy, struct context *ctx, int listen_fd)
+{
+    // every thread accepts on its own duplicate of the shared listening socket
+    int fd = fcntl(listen_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG(ERROR, "proxy_init_unix: fail to duplicate unix socket fd");
+        return CORVUS_ERR;
+    }
+
+    conn_init(proxy, ctx);
+    proxy->fd = fd;
+    proxy->ready = proxy_ready;
+    return CORVUS_OK;
+}
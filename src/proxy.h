@@ -5,5 +5,6 @@ struct connection;
 struct context;
 
 int proxy_init(struct connection *proxy, struct context *ctx, char *host, int port);
+int proxy_init_unix(struct connection *proxy, struct context *ctx, int listen_fd);
 
 #endif /* end of include guard: PROXY_H */
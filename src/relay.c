@@ -0,0 +1,148 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "corvus.h"
+#include "relay.h"
+#include "alloc.h"
+#include "logging.h"
+
+#define RELAY_PIPE_SIZE (1024 * 1024)
+#define RELAY_FLAGS (SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+
+/*
+ * Called while the reply of `cmd` is a bulk string with a payload not read
+ * yet. The reply is relayed only if the client is waiting for nothing else,
+ * otherwise it's buffered as usual.
+ */
+bool relay_start(struct connection *server, struct command *cmd)
+{
+    struct reader *r = &server->info->reader;
+    struct connection *client = cmd->client;
+    size_t pending = reader_pending(r);
+    struct relay *relay;
+
+    if (config.splice_threshold <= 0 || pending < (size_t)config.splice_threshold) {
+        return false;
+    }
+    if (r->redis_data_type != REP_STRING || r->start.buf == NULL) return false;
+    if (cmd->parent != NULL || cmd->stale || cmd->asking) return false;
+    if (server->info->readonly_sent) return false;
+    if (client == NULL || client->eof || client->info->quit) return false;
+    if (STAILQ_FIRST(&client->info->cmd_queue) != cmd) return false;
+
+    relay = cv_calloc(1, sizeof(struct relay));
+    if (pipe2(relay->fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        LOG(WARN, "relay_start: fail to create pipe: %s", strerror(errno));
+        cv_free(relay);
+        return false;
+    }
+    // fewer rounds with a larger pipe, keep the default one if not allowed
+    fcntl(relay->fds[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+
+    // the buffered head of the reply goes to the client before the payload
+    cmd->rep_buf[1].buf = r->buf;
+    cmd->rep_buf[1].pos = r->buf->last;
+    if (r->buf != r->start.buf) {
+        r->buf->refcount++;
+    }
+    relay->total = mbuf_range_len(cmd->rep_buf) + pending;
+    cmd_create_iovec(cmd->rep_buf, &client->info->iov);
+    memset(cmd->rep_buf, 0, sizeof(cmd->rep_buf));
+    memset(&r->start, 0, sizeof(r->start));
+    conn_mark_dirty(client);
+
+    relay->left = pending;
+    relay->server = server;
+    relay->cmd = cmd;
+    server->info->relay = relay;
+    client->info->relay = relay;
+    return true;
+}
+
+/*
+ * Move the payload as far as both sockets allow. Returns CORVUS_OK once the
+ * whole reply is forwarded, CORVUS_AGAIN to wait for the server or client.
+ */
+int relay_run(struct connection *server)
+{
+    struct relay *relay = server->info->relay;
+    struct command *cmd = relay->cmd;
+    struct connection *client = cmd->client;
+    struct context *ctx = server->ctx;
+    struct reader *r = &server->info->reader;
+    uint8_t drop[4096];
+    bool progress = true;
+    ssize_t n;
+
+    while (progress) {
+        progress = false;
+        if (cmd->stale) relay->discard = true;
+
+        if (relay->left > 0) {
+            n = splice(server->fd, NULL, relay->fds[1], NULL, relay->left, RELAY_FLAGS);
+            if (n == 0) return CORVUS_EOF;
+            if (n > 0) {
+                relay->left -= n;
+                relay->piped += n;
+                progress = true;
+                STATS_INCR(ctx->stats.basic.recv_bytes, n);
+                STATS_INCR(ctx->stats.basic.spliced_bytes, n);
+                STATS_INCR(server->info->recv_bytes, n);
+            } else if (errno == EINTR) {
+                progress = true;
+            } else if (errno != EAGAIN) {
+                LOG(ERROR, "relay_run: fail to read server %d: %s",
+                        server->fd, strerror(errno));
+                return CORVUS_ERR;
+            }
+        }
+        if (relay->piped <= 0) continue;
+
+        if (relay->discard) {
+            n = read(relay->fds[0], drop, MIN(relay->piped, sizeof(drop)));
+        } else if (client->info->iov.cursor >= client->info->iov.len) {
+            n = splice(relay->fds[0], NULL, client->fd, NULL, relay->piped, RELAY_FLAGS);
+            if (n > 0) STATS_INCR(ctx->stats.basic.send_bytes, n);
+        } else {
+            // the head is still being written by client_write
+            continue;
+        }
+        if (n > 0) {
+            relay->piped -= n;
+            progress = true;
+        } else if (n < 0 && errno == EINTR) {
+            progress = true;
+        } else if (n < 0 && errno != EAGAIN) {
+            // the client will be closed on its error event
+            LOG(WARN, "relay_run: fail to write client %d: %s",
+                    client->fd, strerror(errno));
+            relay->discard = true;
+            progress = true;
+        }
+    }
+    if (relay->left > 0 || relay->piped > 0) return CORVUS_AGAIN;
+
+    r->type = PARSE_BEGIN;
+    r->item_size = 0;
+    r->redis_data_type = REP_UNKNOWN;
+
+    cmd->reply_type = REP_STRING;
+    cmd->rep_spliced = relay->total;
+    STATS_INCR(ctx->stats.basic.spliced_replies, 1);
+
+    relay_free(server);
+    return CORVUS_OK;
+}
+
+void relay_free(struct connection *server)
+{
+    struct relay *relay = server->info->relay;
+    if (relay == NULL) return;
+
+    close(relay->fds[0]);
+    close(relay->fds[1]);
+    relay->cmd->client->info->relay = NULL;
+    server->info->relay = NULL;
+    cv_free(relay);
+}
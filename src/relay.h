@@ -0,0 +1,28 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct connection;
+struct command;
+
+/*
+ * Payload of a large bulk reply moved from the server socket to the client
+ * socket through a pipe with splice(2), without copying it to mbufs.
+ */
+struct relay {
+    int fds[2];
+    size_t left;   // bytes still to read from the server
+    size_t piped;  // bytes in the pipe
+    size_t total;  // length of the whole reply
+    bool discard;  // the client is gone, the payload is dropped
+    struct connection *server;
+    struct command *cmd;
+};
+
+bool relay_start(struct connection *server, struct command *cmd);
+int relay_run(struct connection *server);
+void relay_free(struct connection *server);
+
+#endif /* end of include guard: RELAY_H */
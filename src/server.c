@@ -7,10 +7,11 @@
 #include "logging.h"
 #include "socket.h"
 #include "slot.h"
+#include "client.h"
+#include "relay.h"
 
 #define SERVER_RETRY_TIMES 3
 #define SERVER_NULL -1
-#define SERVER_REGISTER_ERROR -2
 
 #define CHECK_REDIRECTED(c, info_addr, msg)                               \
 do {                                                                      \
@@ -39,6 +40,7 @@ static const char *req_readonly = "*1\r\n$8\r\nREADONLY\r\n";
 void server_make_iov(struct conn_info *info)
 {
     struct command *cmd;
+    struct cmd_key *key;
     int64_t t = get_time();
 
     while (!STAILQ_EMPTY(&info->ready_queue)) {
@@ -73,7 +75,13 @@ void server_make_iov(struct conn_info *info)
         if (cmd->prefix != NULL) {
             cmd_iov_add(&info->iov, (void*)cmd->prefix, strlen(cmd->prefix), NULL);
         }
-        cmd_create_iovec(cmd->req_buf, &info->iov);
+        if (cmd->key_list != NULL) {
+            for (key = cmd->key_list; key != NULL; key = key->next) {
+                cmd_create_iovec(key->req_buf, &info->iov);
+            }
+        } else {
+            cmd_create_iovec(cmd->req_buf, &info->iov);
+        }
         STAILQ_INSERT_TAIL(&info->waiting_queue, cmd, waiting_next);
     }
 }
@@ -97,17 +105,14 @@ int server_write(struct connection *server)
     }
     if (status == CORVUS_AGAIN) return CORVUS_OK;
 
-    ATOMIC_INC(info->send_bytes, status);
+    STATS_INCR(info->send_bytes, status);
 
     if (info->iov.cursor >= info->iov.len) {
         cmd_iov_free(&info->iov);
     }
 
     if (!STAILQ_EMPTY(&info->ready_queue) || info->iov.cursor < info->iov.len) {
-        if (conn_register(server) == CORVUS_ERR) {
-            LOG(ERROR, "server_write: fail to reregister server %d", server->fd);
-            return CORVUS_ERR;
-        }
+        conn_mark_dirty(server);
     }
 
     info->last_active = time(NULL);
@@ -122,9 +127,7 @@ int server_enqueue(struct connection *server, struct command *cmd)
         cmd_mark_fail(cmd, rep_server_err);
         return SERVER_NULL;
     }
-    if (conn_register(server) == CORVUS_ERR) {
-        return SERVER_REGISTER_ERROR;
-    }
+    conn_mark_dirty(server);
     server->info->last_active = time(NULL);
     mbuf_range_clear(cmd->ctx, cmd->rep_buf);
     cmd->server = server;
@@ -140,9 +143,6 @@ int server_retry(struct command *cmd)
         case SERVER_NULL:
             LOG(WARN, "server_retry: slot %d fail to get server", cmd->slot);
             return CORVUS_OK;
-        case SERVER_REGISTER_ERROR:
-            LOG(ERROR, "server_retry: fail to reregister connection %d", server->fd);
-            return CORVUS_ERR;
         default:
             return CORVUS_OK;
     }
@@ -168,20 +168,49 @@ int server_redirect(struct command *cmd, struct redirect_info *info)
         case SERVER_NULL:
             LOG(WARN, "server_redirect: fail to get server %s", info->addr);
             return CORVUS_OK;
-        case SERVER_REGISTER_ERROR:
-            LOG(ERROR, "server_redirect: fail to reregister connection %d", server->fd);
-            return CORVUS_ERR;
         default:
             return CORVUS_OK;
     }
 }
 
+int server_split(struct command *cmd)
+{
+    int i, n;
+
+    LOG(DEBUG, "server_split: retry %d keys one by one", cmd->key_count);
+    mbuf_range_clear(cmd->ctx, cmd->rep_buf);
+
+    n = cmd_split_keys(cmd);
+    for (i = 0; i < n; i++, cmd = STAILQ_NEXT(cmd, sub_cmd_next)) {
+        server_retry(cmd);
+    }
+    return CORVUS_OK;
+}
+
+// sizes of a successful reply for the size histograms, slot stats and big keys
+static void server_record_sizes(struct command *cmd)
+{
+    struct command *c = cmd->parent != NULL ? cmd->parent : cmd;
+    if (c->cmd_type < 0) return;
+    if (cmd->rep_buf[0].buf == NULL && cmd->rep_spliced == 0) return;
+
+    uint32_t req_bytes = cmd_req_len(cmd);
+    uint32_t rep_bytes = cmd->rep_spliced > 0 ? cmd->rep_spliced
+        : mbuf_range_len(cmd->rep_buf);
+
+    stats_record_size(cmd->ctx, c->cmd_type, req_bytes, rep_bytes);
+    if (cmd->slot >= 0) {
+        slotstats_record(&cmd->ctx->slotstats, cmd->slot, req_bytes, rep_bytes);
+    }
+    bigkey_record(cmd, req_bytes, rep_bytes);
+}
+
 int server_read_reply(struct connection *server, struct command *cmd)
 {
     int status = cmd_read_rep(cmd, server);
     if (status != CORVUS_OK) return status;
 
-    ATOMIC_INC(server->info->completed_commands, 1);
+    STATS_INCR(server->info->completed_commands, 1);
 
     if (server->info->readonly_sent) {
         return CORVUS_READONLY;
@@ -195,6 +224,10 @@ int server_read_reply(struct connection *server, struct command *cmd)
     }
 
     if (cmd->reply_type != REP_ERROR) {
+        if (cmd->ask_cached) {
+            STATS_INCR(cmd->ctx->stats.basic.ask_cache_hits, 1);
+        }
+        server_record_sizes(cmd);
         cmd_mark_done(cmd);
         return CORVUS_OK;
     }
@@ -207,14 +240,25 @@ int server_read_reply(struct connection *server, struct command *cmd)
         cmd_mark_fail(cmd, rep_redirect_err);
         return CORVUS_OK;
     }
+    if (cmd->ask_cached && (info.type == CMD_ERR_MOVED || info.type == CMD_ERR_ASK)) {
+        STATS_INCR(cmd->ctx->stats.basic.ask_cache_misses, 1);
+        askcache_del(&cmd->ctx->askcache, cmd);
+        cmd->ask_cached = false;
+    }
+
     switch (info.type) {
         case CMD_ERR_MOVED:
-            ATOMIC_INC(cmd->ctx->stats.moved_recv, 1);
+            STATS_INCR(cmd->ctx->stats.basic.moved_recv, 1);
+            // route the slot to its new owner now, the full update follows
+            if (slot_map_move(info.slot, info.addr) == CORVUS_ERR) {
+                LOG(WARN, "fail to move slot %d to %s", info.slot, info.addr);
+            }
             slot_create_job(SLOT_UPDATE);
             CHECK_REDIRECTED(cmd, info.addr, rep_redirect_err);
             return server_redirect(cmd, &info);
         case CMD_ERR_ASK:
-            ATOMIC_INC(cmd->ctx->stats.ask_recv, 1);
+            STATS_INCR(cmd->ctx->stats.basic.ask_recv, 1);
+            askcache_set(&cmd->ctx->askcache, cmd, info.addr);
             CHECK_REDIRECTED(cmd, info.addr, rep_redirect_err);
             cmd->asking = 1;
             return server_redirect(cmd, &info);
@@ -222,6 +266,13 @@ int server_read_reply(struct connection *server, struct command *cmd)
             slot_create_job(SLOT_UPDATE);
             CHECK_REDIRECTED(cmd, NULL, NULL);
             return server_retry(cmd);
+        case CMD_ERR_CROSSSLOT:
+        case CMD_ERR_TRYAGAIN:
+            if (cmd->key_count > 1) {
+                return server_split(cmd);
+            }
+            cmd_mark_done(cmd);
+            break;
         default:
             cmd_mark_done(cmd);
             break;
@@ -293,7 +344,8 @@ void server_ready(struct connection *self, uint32_t mask)
             return;
         }
     }
-    if (mask & E_READABLE) {
+    // a spliced reply is also resumed when the client can take more
+    if ((mask & E_READABLE) || info->relay != NULL) {
         LOG(DEBUG, "server readable");
 
         if (!STAILQ_EMPTY(&info->waiting_queue)) {
@@ -336,6 +388,13 @@ void server_eof(struct connection *server, const char *reason)
         }
     }
 
+    // the client got part of a spliced reply and can't be answered any more
+    if (server->info->relay != NULL) {
+        c = server->info->relay->cmd;
+        relay_free(server);
+        if (!c->stale) client_eof(c->client);
+    }
+
     // remove unprocessed data
     struct mbuf *b = TAILQ_LAST(&server->info->data, mhdr);
     if (b != NULL && b->pos < b->last) {
@@ -5,6 +5,8 @@
 #include <sys/queue.h>
 #include <pthread.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include "corvus.h"
 #include "hash.h"
 #include "slot.h"
@@ -21,337 +23,605 @@ static pthread_cond_t signal_cond;
 
 static int slot_job = SLOT_UPDATE_UNKNOWN;
 
+// a slot moved by a MOVED reply
+struct slot_move {
+    uint16_t slot;
+    uint16_t index;
+};
+
 static struct {
     pthread_rwlock_t lock;
-    struct node_info *data[REDIS_CLUSTER_SLOTS];
-    struct dict free_nodes;
-    struct dict node_map;
+    // index of shard in `shards` plus one, zero if slot is not covered
+    uint16_t data[REDIS_CLUSTER_SLOTS];
+    struct node_info *shards;
+    size_t len;
+    size_t size;
+    uint64_t version;
+    // version of the last full replace, each later version is one move
+    uint64_t replaced;
+    struct slot_move moves[SLOT_MOVE_LOG];  // indexed by version
 } slot_map = {.lock = PTHREAD_RWLOCK_INITIALIZER};
 
+enum {
+    SLOT_PROBE_CONNECTING,
+    SLOT_PROBE_READING,
+    SLOT_PROBE_DONE,
+    SLOT_PROBE_FAILED,
+};
+
+// a CLUSTER NODES query to one node during slot map update
+struct slot_probe {
+    struct connection *server;
+    int status;
+    int count;  // slots covered by the answer
+    int agree;  // answers with the same digest, including this one
+    uint64_t epoch;
+    uint64_t digest;
+};
+
+// nodes of the cluster, only replaced by the slot manager thread
 static struct {
     pthread_rwlock_t lock;
-    struct address nodes[MAX_NODE_LIST];
+    struct address *nodes;
     int len;
 } node_list = {.lock = PTHREAD_RWLOCK_INITIALIZER};
-/*
-There are some certain places where write operation
-of node_list.len is not protected by lock.
-This is ok and its reason is quite subtle:
-(1) we assume that assignment for `int` is atomic,
-    which rely on the alignment of node_list and
-    that only one instruction is generated for the
-    assignment statement.
-(2) `len` is not protected but node_list.nodes is.
-(3) its write operations are all in the thread managing slots
-    and all of them are resetting node_list.len to zero.
-(4) its read operation from other threads is only in node_list_get,
-    inside which `<` operation is used instead of `!=`
-    to determine the loop exit.
-*/
-
-static inline void node_list_init()
+
+static void node_list_replace(struct address *nodes, int len)
 {
-    struct node_conf *node = config_get_node();
     pthread_rwlock_wrlock(&node_list.lock);
-    node_list.len = 0;
-    for (int i = 0; i < MIN(node->len, MAX_NODE_LIST); i++) {
-        memcpy(&node_list.nodes[i], &node->addr[i], sizeof(struct address));
-        node_list.len++;
-    }
+    struct address *old = node_list.nodes;
+    node_list.nodes = nodes;
+    node_list.len = len;
     pthread_rwlock_unlock(&node_list.lock);
+    cv_free(old);
+}
+
+static void node_list_init()
+{
+    struct node_conf *node = config_get_node();
+    struct address *nodes = cv_malloc(sizeof(struct address) * MAX(node->len, 1));
+    memcpy(nodes, node->addr, sizeof(struct address) * node->len);
+    node_list_replace(nodes, node->len);
     config_node_dec_ref(node);
 }
 
-static inline void node_list_replace(struct address *nodes, size_t len)
+// copy of node list, freed by the caller
+static struct address *node_list_copy(int *len)
 {
-    pthread_rwlock_wrlock(&node_list.lock);
-    node_list.len = len;
-    // memcpy works for zero len
-    memcpy(node_list.nodes, nodes, sizeof(struct address) * len);
+    pthread_rwlock_rdlock(&node_list.lock);
+    struct address *nodes = cv_malloc(sizeof(struct address) * MAX(node_list.len, 1));
+    memcpy(nodes, node_list.nodes, sizeof(struct address) * node_list.len);
+    *len = node_list.len;
     pthread_rwlock_unlock(&node_list.lock);
+    return nodes;
 }
 
-static inline void node_map_free(struct dict *map)
+static void shards_free(struct node_info *shards, size_t len)
 {
-    struct dict_iter iter = DICT_ITER_INITIALIZER;
-    DICT_FOREACH(map, &iter) {
-        struct node_info *n = iter.value;
-        if (n->refcount <= 0) {
-            cv_free(iter.value);
-        }
+    for (size_t i = 0; i < len; i++) {
+        cv_free(shards[i].nodes);
     }
+    cv_free(shards);
 }
 
-void node_desc_add(struct node_desc *b, uint8_t *start, uint8_t *end, bool partial)
+static void node_desc_add(struct node_desc *d, char *part)
 {
-    if (b->len <= b->index) {
-        b->len = (b->len <= 0) ? 16 : b->len << 1;
-        b->parts = cv_realloc(b->parts, sizeof(struct desc_part) * b->len);
-        memset(b->parts + b->index, 0,
-                sizeof(struct desc_part) * (b->len - b->index));
-    }
-    struct desc_part *d = &b->parts[b->index];
-    memcpy(d->data + d->len, start, end - start);
-    d->len += end - start;
-    if (!partial) {
-        b->index++;
+    if (d->len >= d->size) {
+        d->size = d->size == 0 ? 16 : d->size << 1;
+        d->parts = cv_realloc(d->parts, sizeof(char*) * d->size);
     }
+    d->parts[d->len++] = part;
 }
 
-int split_node_description(struct node_desc *desc, struct pos_array *pos_array)
+/*
+ * Split `text` into lines of space separated fields in place. Returns
+ * the number of lines in `*desc`, which is freed by node_desc_free.
+ */
+int split_node_description(struct node_desc **desc, char *text)
 {
-    int i, desc_count = 0;
-    for(i = 0; i < pos_array->pos_len; i++) {
-        struct pos *pos = &pos_array->items[i];
-        uint8_t *p = pos->str, *s = p;
-        while (p - pos->str < pos->len) {
-            if (*p == ' ' || *p == '\n') {
-                node_desc_add(&desc[desc_count], s, p, false);
-                s = p + 1;
-            }
-            if (*(p++) == '\n') {
-                desc_count++;
-            }
+    int n = 0, size = 0;
+    char *line, *part, *line_end, *part_end;
+
+    *desc = NULL;
+    for (line = strtok_r(text, "\n", &line_end); line != NULL;
+            line = strtok_r(NULL, "\n", &line_end))
+    {
+        if (n >= size) {
+            size = size == 0 ? 16 : size << 1;
+            *desc = cv_realloc(*desc, sizeof(struct node_desc) * size);
         }
-        if (p > s) {
-            node_desc_add(&desc[desc_count], s, p, true);
+        struct node_desc *d = &(*desc)[n++];
+        memset(d, 0, sizeof(struct node_desc));
+        for (part = strtok_r(line, " ", &part_end); part != NULL;
+                part = strtok_r(NULL, " ", &part_end))
+        {
+            node_desc_add(d, part);
         }
     }
-    return desc_count;
+    return n;
+}
+
+void node_desc_free(struct node_desc *desc, int n)
+{
+    for (int i = 0; i < n; i++) {
+        cv_free(desc[i].parts);
+    }
+    cv_free(desc);
 }
 
-int parse_slots()
+// copy of the reply text, freed by the caller
+static char *slot_nodes_text(struct redis_data *data)
+{
+    if (data->type != REP_STRING || data->pos.str_len <= 0) return NULL;
+    char *text = cv_malloc(data->pos.str_len + 1);
+    pos_to_str(&data->pos, text);
+    return text;
+}
+
+// parse a slot or slot range, skipping importing and migrating slots
+static int slot_parse_range(char *spec, int *start, int *stop)
 {
     char *p;
-    int start, stop, slot_count = 0;
-    struct node_info *node;
-    struct address tmp_nodes[MAX_NODE_LIST];
-    size_t tmp_nodes_len = 0;
-
-    struct dict_iter iter = DICT_ITER_INITIALIZER;
-    DICT_FOREACH(&slot_map.node_map, &iter) {
-        struct node_info *n = iter.value;
-
-        // the node has no slots
-        if (n->spec_length <= 0) {
-            cv_free(n);
-            continue;
-        }
+    if (spec[0] == '[') return CORVUS_AGAIN;
 
-        size_t num = MIN(n->index, MAX_NODE_LIST - tmp_nodes_len);
-        if (num > 0) {
-            memcpy(tmp_nodes + tmp_nodes_len, n->nodes, num * sizeof(struct address));
-            tmp_nodes_len += num;
+    if ((p = strchr(spec, '-')) != NULL) {
+        *start = atoi(spec);
+        *stop = atoi(p + 1);
+    } else {
+        *start = *stop = atoi(spec);
+    }
+    if (*start < 0 || *stop >= REDIS_CLUSTER_SLOTS || *start > *stop) {
+        LOG(WARN, "slot map: invalid slot range %s", spec);
+        return CORVUS_ERR;
+    }
+    return CORVUS_OK;
+}
+
+static void shard_add_node(struct node_info *shard, struct address *addr)
+{
+    shard->nodes = cv_realloc(shard->nodes, sizeof(struct address) * (shard->len + 1));
+    memcpy(&shard->nodes[shard->len++], addr, sizeof(struct address));
+}
+
+/*
+ * Build a shard for each master with slots, followed by its slaves, and
+ * the shard owning each slot in `data`. Returns the number of slots
+ * covered or CORVUS_ERR.
+ */
+static int slot_build_map(struct node_desc *desc, int n, uint16_t *data,
+        struct node_info **shards, size_t *len)
+{
+    int i, j, start, stop, slot_count = 0;
+    struct address addr;
+    struct dict masters;
+
+    *shards = NULL;
+    *len = 0;
+    for (i = 0; i < n; i++) {
+        if (desc[i].len < 8) {
+            LOG(ERROR, "slot map: invalid cluster nodes line");
+            return CORVUS_ERR;
         }
+    }
 
-        for (int i = 8; i < n->spec_length + 8; i++) {
-            if (n->slot_spec[i].data[0] == '[') {
-                continue;
-            }
-            if ((p = strchr(n->slot_spec[i].data, '-')) != NULL) {
-                *p = '\0';
-                start = atoi(n->slot_spec[i].data);
-                stop = atoi(p + 1);
-            } else {
-                start = stop = atoi(n->slot_spec[i].data);
-            }
-            n->refcount += stop - start + 1;
-            while (start <= stop) {
-                slot_count++;
-                node = ATOMIC_IGET(slot_map.data[start++], n);
-                if (node == NULL) {
-                    continue;
-                }
-                node->refcount--;
-                snprintf(node->name, sizeof(node->name), "%p", node);
-                struct node_info *m = dict_get(&slot_map.free_nodes, node->name);
-                if (m == NULL) {
-                    dict_set(&slot_map.free_nodes, node->name, node);
-                }
+    // at most one shard per line, so shards are never moved
+    *shards = cv_malloc(sizeof(struct node_info) * MAX(n, 1));
+    dict_init(&masters);
+    for (i = 0; i < n; i++) {
+        struct node_desc *d = &desc[i];
+        if (d->parts[3][0] != '-' || d->len <= 8) continue;
+        if (*len >= UINT16_MAX) {
+            LOG(ERROR, "slot map: too many masters");
+            slot_count = CORVUS_ERR;
+            break;
+        }
+        if (socket_parse_addr(d->parts[1], &addr) == CORVUS_ERR) continue;
+
+        struct node_info *shard = &(*shards)[(*len)++];
+        memset(shard, 0, sizeof(struct node_info));
+        shard_add_node(shard, &addr);
+        dict_set(&masters, d->parts[0], shard);
+
+        for (j = 8; j < d->len; j++) {
+            if (slot_parse_range(d->parts[j], &start, &stop) != CORVUS_OK) continue;
+            for (; start <= stop; start++) {
+                if (data[start] == 0) slot_count++;
+                data[start] = *len;
             }
         }
-        n->spec_length = 0;
-        n->slot_spec = NULL;
     }
 
+    for (i = 0; i < n && slot_count != CORVUS_ERR; i++) {
+        struct node_desc *d = &desc[i];
+        if (strcasecmp(d->parts[2], "slave") != 0
+                && strcasecmp(d->parts[2], "myself,slave") != 0)
+        {
+            continue;
+        }
+        struct node_info *shard = dict_get(&masters, d->parts[3]);
+        if (shard != NULL && socket_parse_addr(d->parts[1], &addr) != CORVUS_ERR) {
+            shard_add_node(shard, &addr);
+        }
+    }
+    dict_free(&masters);
+    return slot_count;
+}
+
+static void slot_map_replace(uint16_t *data, struct node_info *shards, size_t len)
+{
     pthread_rwlock_wrlock(&slot_map.lock);
-    node_map_free(&slot_map.free_nodes);
+    struct node_info *old = slot_map.shards;
+    size_t old_len = slot_map.len;
+    memcpy(slot_map.data, data, sizeof(slot_map.data));
+    slot_map.shards = shards;
+    slot_map.len = slot_map.size = len;
+    // notify worker threads to rebuild their slot tables
+    slot_map.replaced = ATOMIC_INC(slot_map.version, 1);
     pthread_rwlock_unlock(&slot_map.lock);
 
-    node_list_replace(tmp_nodes, tmp_nodes_len);
-
-    dict_clear(&slot_map.free_nodes);
-    return slot_count;
+    shards_free(old, old_len);
 }
 
 int parse_cluster_nodes(struct redis_data *data)
 {
-    ASSERT_TYPE(data, REP_STRING);
+    struct node_desc *desc;
+    struct node_info *shards;
+    size_t i, len, nodes_len = 0;
 
-    struct node_desc desc[REDIS_CLUSTER_SLOTS];
-    memset(desc, 0, sizeof(desc));
-    int slot_count = 0, node_count = split_node_description(desc, &data->pos);
-    if (node_count <= 0) {
+    char *text = slot_nodes_text(data);
+    if (text == NULL) {
         LOG(ERROR, "fail to parse cluster nodes infomation");
+        return 0;
+    }
+    int node_count = split_node_description(&desc, text);
+    uint16_t *map = cv_calloc(REDIS_CLUSTER_SLOTS, sizeof(uint16_t));
+
+    int slot_count = slot_build_map(desc, node_count, map, &shards, &len);
+    if (slot_count == CORVUS_ERR) {
+        shards_free(shards, len);
+        slot_count = 0;
         goto end;
     }
 
-    for (int i = 0; i < node_count; i++) {
+    for (i = 0; i < len; i++) {
+        nodes_len += shards[i].len;
+    }
+    struct address *nodes = cv_malloc(sizeof(struct address) * MAX(nodes_len, 1));
+    for (i = 0, nodes_len = 0; i < len; i++) {
+        memcpy(nodes + nodes_len, shards[i].nodes, sizeof(struct address) * shards[i].len);
+        nodes_len += shards[i].len;
+    }
+
+    slot_map_replace(map, shards, len);
+    node_list_replace(nodes, nodes_len);
+
+end:
+    cv_free(map);
+    node_desc_free(desc, node_count);
+    cv_free(text);
+    return slot_count;
+}
+
+/*
+ * Summary of a CLUSTER NODES reply without applying it: the number of
+ * slots covered, the highest config epoch of masters and a digest of
+ * masters with their slots, which doesn't depend on the order of lines.
+ */
+int slot_check_nodes(struct redis_data *data, uint64_t *epoch, uint64_t *digest)
+{
+    int i, j, start, stop, slot_count = 0;
+    struct node_desc *desc;
+    char *p;
+
+    *epoch = 0;
+    *digest = 0;
+    char *text = slot_nodes_text(data);
+    if (text == NULL) return CORVUS_ERR;
+
+    int node_count = split_node_description(&desc, text);
+
+    for (i = 0; i < node_count; i++) {
         struct node_desc *d = &desc[i];
-        if (d->index < 8) {
-            node_map_free(&slot_map.node_map);
-            goto end;
-        }
-        bool is_master = d->parts[3].data[0] == '-';
-        char *name = is_master ? d->parts[0].data : d->parts[3].data;
-        struct node_info *node = dict_get(&slot_map.node_map, name);
-        if (node == NULL) {
-            node = cv_calloc(1, sizeof(struct node_info));
-            node->index = 1;
-            strcpy(node->name, name);
-            dict_set(&slot_map.node_map, node->name, node);
+        if (d->len < 8) {
+            slot_count = CORVUS_ERR;
+            break;
         }
-        if (is_master) {
-            socket_parse_addr(d->parts[1].data, &node->nodes[0]);
-            node->slot_spec = d->parts;
-            node->spec_length = d->index - 8;
-        } else if (node->index <= MAX_SLAVE_NODES && (
-                    strcasecmp(d->parts[2].data, "slave") == 0 ||
-                    strcasecmp(d->parts[2].data, "myself,slave") == 0)) {
-            socket_parse_addr(d->parts[1].data, &node->nodes[node->index++]);
+        if (d->parts[3][0] != '-') continue;
+
+        uint64_t e = strtoull(d->parts[6], NULL, 10);
+        if (e > *epoch) *epoch = e;
+
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (j = 1; j < d->len; j++) {
+            // only the address and slots, not flags or ping times
+            if (j > 1 && j < 8) continue;
+            if (d->parts[j][0] == '[') continue;
+            for (p = d->parts[j]; *p != '\0'; p++) {
+                h ^= (uint8_t)*p;
+                h *= 0x100000001b3ULL;
+            }
+            h ^= ' ';
+            h *= 0x100000001b3ULL;
+            if (j < 8) continue;
+
+            if (slot_parse_range(d->parts[j], &start, &stop) == CORVUS_OK) {
+                slot_count += stop - start + 1;
+            }
         }
+        *digest += h;
     }
 
-    slot_count = parse_slots();
+    node_desc_free(desc, node_count);
+    cv_free(text);
+    return slot_count;
+}
 
-end:
-    dict_clear(&slot_map.node_map);
-    for (int i = 0; i < node_count; i++) {
-        cv_free(desc[i].parts);
+static int slot_probe_start(struct context *ctx, struct slot_probe *p,
+        struct address *addr)
+{
+    memset(p, 0, sizeof(struct slot_probe));
+    p->server = conn_create(ctx);
+    p->server->info = conn_info_create(ctx);
+    memcpy(&p->server->info->addr, addr, sizeof(struct address));
+
+    p->server->fd = socket_create_stream();
+    if (p->server->fd == -1
+            || socket_set_nonblocking(p->server->fd) == -1
+            || conn_connect(p->server) == CORVUS_ERR)
+    {
+        LOG(WARN, "update slot map, fail to connect %s:%d", addr->ip, addr->port);
+        p->status = SLOT_PROBE_FAILED;
+        return CORVUS_ERR;
     }
-    return slot_count;
+    p->status = SLOT_PROBE_CONNECTING;
+    return CORVUS_OK;
+}
+
+static void slot_probe_free(struct context *ctx, struct slot_probe *p)
+{
+    if (p->status == SLOT_PROBE_DONE) {
+        redis_data_free(&p->server->info->reader.data);
+    }
+    conn_free(p->server);
+    conn_buf_free(p->server);
+    conn_recycle(ctx, p->server);
+    p->server = NULL;
 }
 
-int slot_parse_data(struct reader *r, struct mbuf *buf, int *count)
+static int slot_probe_write(struct slot_probe *p)
 {
-    reader_feed(r, buf);
-    if (parse(r, MODE_REQ) == -1) {
-        LOG(ERROR, "slot_map: parse cluster slots error");
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct connection *server = p->server;
+
+    if (getsockopt(server->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+        LOG(WARN, "update slot map, fail to connect %s:%d: %s",
+                server->info->addr.ip, server->info->addr.port,
+                strerror(err != 0 ? err : errno));
         return CORVUS_ERR;
     }
-    if (reader_ready(r)) {
-        *count = parse_cluster_nodes(&r->data);
-        redis_data_free(&r->data);
+    server->info->status = CONNECTED;
+
+    struct iovec iov;
+    iov.iov_base = (void*)SLOTS_CMD;
+    iov.iov_len = strlen(SLOTS_CMD);
+
+    // the command always fits in the send buffer of a new connection
+    if (socket_write(server->fd, &iov, 1) != (int)iov.iov_len) {
+        LOG(ERROR, "update slot map, socket write: %s", strerror(errno));
+        return CORVUS_ERR;
     }
     return CORVUS_OK;
 }
 
-int slot_read_data(struct connection *server, int *count)
+static int slot_probe_read(struct slot_probe *p)
 {
-    int n, rsize;
+    int n;
     struct mbuf *buf;
+    struct connection *server = p->server;
     struct reader *r = &server->info->reader;
 
     while (1) {
         buf = conn_get_buf(server, true, false);
-        rsize = mbuf_read_size(buf);
 
-        if (rsize > 0) {
-            if (slot_parse_data(r, buf, count) == CORVUS_ERR) return CORVUS_ERR;
-            if (reader_ready(r)) return CORVUS_OK;
+        if (mbuf_read_size(buf) > 0) {
+            reader_feed(r, buf);
+            if (parse(r, MODE_REQ) == -1) {
+                LOG(ERROR, "slot_map: parse cluster slots error");
+                return CORVUS_ERR;
+            }
+            if (reader_ready(r)) break;
             continue;
         }
 
         n = socket_read(server->fd, buf);
-        if (n == 0 || n == CORVUS_ERR || n == CORVUS_AGAIN) return CORVUS_ERR;
+        if (n == CORVUS_AGAIN) return CORVUS_AGAIN;
+        if (n == 0 || n == CORVUS_ERR) return CORVUS_ERR;
+    }
+
+    p->count = slot_check_nodes(&r->data, &p->epoch, &p->digest);
+    if (p->count == CORVUS_ERR) {
+        redis_data_free(&r->data);
+        return CORVUS_ERR;
     }
     return CORVUS_OK;
 }
 
-int do_update_slot_map(struct connection *server)
+// advance a probe with the events returned by poll
+static void slot_probe_ready(struct slot_probe *p, short revents)
 {
-    if (conn_connect(server) == CORVUS_ERR) return CORVUS_ERR;
-    if (server->info->status != CONNECTED) {
-        LOG(ERROR, "update slot map, server not connected: %s", strerror(errno));
-        return CORVUS_ERR;
+    struct address *addr = &p->server->info->addr;
+
+    if (p->status == SLOT_PROBE_CONNECTING) {
+        if (slot_probe_write(p) == CORVUS_ERR) {
+            p->status = SLOT_PROBE_FAILED;
+            return;
+        }
+        p->status = SLOT_PROBE_READING;
+    } else if (revents & (POLLIN | POLLERR | POLLHUP)) {
+        switch (slot_probe_read(p)) {
+            case CORVUS_AGAIN:
+                return;
+            case CORVUS_OK:
+                LOG(DEBUG, "slot map from %s:%d: %d slots, epoch %llu",
+                        addr->ip, addr->port, p->count,
+                        (unsigned long long)p->epoch);
+                p->status = SLOT_PROBE_DONE;
+                return;
+            default:
+                LOG(ERROR, "update slot map, cmd read error from %s:%d",
+                        addr->ip, addr->port);
+                p->status = SLOT_PROBE_FAILED;
+                return;
+        }
+    }
+}
+
+/*
+ * Whether `a` is a better answer than `b`: answers covering all slots
+ * first, then those with higher config epoch, then those more nodes
+ * agree with.
+ */
+static bool slot_probe_better(struct slot_probe *a, struct slot_probe *b)
+{
+    bool full_a = a->count >= REDIS_CLUSTER_SLOTS, full_b = b->count >= REDIS_CLUSTER_SLOTS;
+    if (full_a != full_b) return full_a;
+    if (a->epoch != b->epoch) return a->epoch > b->epoch;
+    return a->agree > b->agree;
+}
+
+/*
+ * Query up to SLOT_UPDATE_FANOUT nodes at once, replacing nodes that
+ * fail by the next ones, until all answered or SLOT_UPDATE_TIMEOUT.
+ * Once an answer covers all slots, the others get SLOT_UPDATE_GRACE to
+ * answer for cross checking. Returns the slots covered by the applied
+ * answer or CORVUS_ERR.
+ */
+int slot_update_from(struct context *ctx, struct address *nodes, int len)
+{
+    int i, j, next = 0, started = 0, pending;
+    struct slot_probe *probes = cv_calloc(MAX(len, 1), sizeof(struct slot_probe));
+    struct pollfd fds[SLOT_UPDATE_FANOUT];
+    struct slot_probe *polled[SLOT_UPDATE_FANOUT];
+    int64_t now = get_time(), full_time = -1;
+    int64_t deadline = now + SLOT_UPDATE_TIMEOUT * 1000000LL;
+
+    while (now < deadline) {
+        pending = 0;
+        for (i = 0; i < started; i++) {
+            if (probes[i].status == SLOT_PROBE_CONNECTING
+                    || probes[i].status == SLOT_PROBE_READING)
+            {
+                pending++;
+            }
+        }
+        while (pending < SLOT_UPDATE_FANOUT && next < len && full_time < 0) {
+            LOG(INFO, "updating slot map using %s:%d", nodes[next].ip, nodes[next].port);
+            if (slot_probe_start(ctx, &probes[started++], &nodes[next++]) == CORVUS_OK) {
+                pending++;
+            }
+        }
+        if (pending == 0) break;
+        if (full_time >= 0 && now - full_time >= SLOT_UPDATE_GRACE * 1000000LL) break;
+
+        for (i = 0, j = 0; i < started; i++) {
+            struct slot_probe *p = &probes[i];
+            if (p->status != SLOT_PROBE_CONNECTING && p->status != SLOT_PROBE_READING) {
+                continue;
+            }
+            fds[j].fd = p->server->fd;
+            fds[j].events = p->status == SLOT_PROBE_CONNECTING ? POLLOUT : POLLIN;
+            fds[j].revents = 0;
+            polled[j++] = p;
+        }
+
+        int64_t wait = deadline - now;
+        if (full_time >= 0) wait = MIN(wait, full_time + SLOT_UPDATE_GRACE * 1000000LL - now);
+        int n = poll(fds, j, wait / 1000000 + 1);
+        if (n == -1 && errno != EINTR) {
+            LOG(ERROR, "update slot map, poll: %s", strerror(errno));
+            break;
+        }
+        for (i = 0; i < j && n > 0; i++) {
+            if (fds[i].revents == 0) continue;
+            slot_probe_ready(polled[i], fds[i].revents);
+            if (polled[i]->status == SLOT_PROBE_DONE && full_time < 0
+                    && polled[i]->count >= REDIS_CLUSTER_SLOTS)
+            {
+                full_time = get_time();
+            }
+        }
+        now = get_time();
     }
 
-    struct iovec iov;
-    iov.iov_base = (void*)SLOTS_CMD;
-    iov.iov_len = strlen(SLOTS_CMD);
+    struct slot_probe *best = NULL;
+    int answers = 0;
+    for (i = 0; i < started; i++) {
+        if (probes[i].status != SLOT_PROBE_DONE) continue;
+        answers++;
+        for (j = 0; j < started; j++) {
+            if (probes[j].status == SLOT_PROBE_DONE && probes[j].digest == probes[i].digest) {
+                probes[i].agree++;
+            }
+        }
+    }
+    for (i = 0; i < started; i++) {
+        if (probes[i].status != SLOT_PROBE_DONE) continue;
+        if (best == NULL || slot_probe_better(&probes[i], best)) best = &probes[i];
+    }
 
-    if (socket_write(server->fd, &iov, 1) <= 0) {
-        LOG(ERROR, "update slot map, socket write: %s", strerror(errno));
-        return CORVUS_ERR;
+    int count = CORVUS_ERR;
+    if (best != NULL) {
+        if (best->agree < answers) {
+            LOG(WARN, "slot map: %d of %d nodes disagree with %s:%d, using epoch %llu",
+                    answers - best->agree, answers, best->server->info->addr.ip,
+                    best->server->info->addr.port, (unsigned long long)best->epoch);
+        }
+        count = parse_cluster_nodes(&best->server->info->reader.data);
+    } else if (started < len) {
+        LOG(WARN, "update slot map: no answer in %d ms", SLOT_UPDATE_TIMEOUT);
     }
 
-    int count = -1;
-    LOG(INFO, "updating slot map using %s:%d",
-            server->info->addr.ip, server->info->addr.port);
-    if(slot_read_data(server, &count) != CORVUS_OK) {
-        LOG(ERROR, "update slot map, cmd read error");
-        return CORVUS_ERR;
+    for (i = 0; i < started; i++) {
+        slot_probe_free(ctx, &probes[i]);
     }
+    cv_free(probes);
     return count;
 }
 
 void slot_map_update(struct context *ctx, bool reload)
 {
-    int i, count = 0;
-    struct address node;
+    int i, len, count;
+    int64_t start = get_time();
 
-    struct connection *server = conn_create(ctx);
-    server->info = conn_info_create(ctx);
-
-    if (node_list.len <= 0) {
+    if (reload) {
         node_list_init();
     }
-
-    int len;
-    struct address nodes[MAX_NODE_LIST];
-    if (reload) {
-        struct node_conf *node = config_get_node();
-        len = node->len;
-        memcpy(nodes, node->addr, len * sizeof(struct address));
-        config_node_dec_ref(node);
-    } else {
-        memcpy(nodes, node_list.nodes, sizeof(node_list.nodes));
-        len = node_list.len;
+    struct address *nodes = node_list_copy(&len);
+    if (len <= 0) {
+        cv_free(nodes);
+        node_list_init();
+        nodes = node_list_copy(&len);
     }
 
-    for (i = len; i > 0; i--) {
+    // query nodes in random order
+    for (i = len; i > 1; i--) {
         int r = rand_r(&ctx->seed) % i;
-        node = nodes[r];
+        struct address tmp = nodes[r];
         nodes[r] = nodes[i - 1];
-
-        server->fd = socket_create_stream();
-        if (server->fd == -1) continue;
-
-        if (socket_set_timeout(server->fd, 5) == CORVUS_ERR) {
-            close(server->fd);
-            continue;
-        }
-
-        memcpy(&server->info->addr, &node, sizeof(struct address));
-
-        count = do_update_slot_map(server);
-        if (count < REDIS_CLUSTER_SLOTS) {
-            conn_free(server);
-            conn_buf_free(server);
-            continue;
-        }
-        break;
+        nodes[i - 1] = tmp;
     }
-    conn_free(server);
-    conn_buf_free(server);
-    conn_recycle(ctx, server);
+
+    count = slot_update_from(ctx, nodes, len);
+    stats_record_slot_update((get_time() - start) / 1000);
 
     if (count == CORVUS_ERR) {
-        node_list.len = 0;  // clear it if we can't update slot map
+        node_list_replace(NULL, 0);  // clear it if we can't update slot map
         LOG(WARN, "can not update slot map");
     } else {
         LOG(INFO, "slot map updated: corverd %d slots", count);
     }
+    cv_free(nodes);
 }
 
 void do_job(struct context *ctx, int job)
@@ -396,18 +666,14 @@ void *slot_manager(void *data)
     }
     pthread_mutex_unlock(&job_mutex);
 
-    for (int i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
-        struct node_info *n = ATOMIC_IGET(slot_map.data[i], NULL);
-        if (n == NULL) {
-            continue;
-        }
-        n->refcount--;
-        if (n->refcount <= 0) {
-            cv_free(n);
-        }
-    }
-    dict_free(&slot_map.free_nodes);
-    dict_free(&slot_map.node_map);
+    pthread_rwlock_wrlock(&slot_map.lock);
+    memset(slot_map.data, 0, sizeof(slot_map.data));
+    shards_free(slot_map.shards, slot_map.len);
+    slot_map.shards = NULL;
+    slot_map.len = slot_map.size = 0;
+    slot_map.replaced = ATOMIC_INC(slot_map.version, 1);
+    pthread_rwlock_unlock(&slot_map.lock);
+    node_list_replace(NULL, 0);
 
     pthread_rwlock_destroy(&node_list.lock);
     pthread_rwlock_destroy(&slot_map.lock);
@@ -417,88 +683,234 @@ void *slot_manager(void *data)
     return NULL;
 }
 
+/*
+ * Hash the part between the first '{' and the first '}' after it,
+ * or the whole key if there is no such non empty part. The key may
+ * be split across mbufs.
+ */
 uint16_t slot_get(struct pos_array *pos)
 {
-    uint32_t s, len;
-    uint8_t *str;
-    int j, h, found = 0, found_s = 0;
-    struct pos *q, *p;
-
-    struct pos temp_pos[pos->pos_len];
-    struct pos_array arr;
-    memset(&arr, 0, sizeof(arr));
-    arr.items = temp_pos;
-
-    for (j = 0, h = 0; h < pos->pos_len; h++) {
-        p = &pos->items[h];
-        len = p->len;
-        str = p->str;
-
-        q = &arr.items[j];
-        q->len = len;
-        q->str = str;
-
-        for (s = 0; s < len; s++) {
-            if (str[s] == '}' && found_s) {
-                found = 1;
-                q->len -= len - s;
-                break;
-            }
+    int i, j, n = pos->pos_len;
+    uint8_t *l = NULL, *r = NULL, *s, *e;
+    uint16_t crc = 0;
+    size_t len = 0;
+
+    for (i = 0; i < n; i++) {
+        l = memchr(pos->items[i].str, '{', pos->items[i].len);
+        if (l != NULL) break;
+    }
+    if (l == NULL) return crc16(pos) & 0x3FFF;
+
+    // hash the tag while looking for '}'
+    for (j = i, s = l + 1; j < n; j++) {
+        if (j > i) s = pos->items[j].str;
+        e = pos->items[j].str + pos->items[j].len;
+        r = memchr(s, '}', e - s);
+        if (r != NULL) e = r;
+
+        crc = crc16_update(crc, s, e - s);
+        len += e - s;
+        if (r != NULL) break;
+    }
+    if (r == NULL || len == 0) return crc16(pos) & 0x3FFF;
+    return crc & 0x3FFF;
+}
+
+/* narrow a key in one piece down to its hash tag */
+static inline void slot_get_tag(const uint8_t **s, size_t *len)
+{
+    const uint8_t *l, *r, *e = *s + *len;
+
+    if ((l = memchr(*s, '{', *len)) == NULL) return;
+    if ((r = memchr(l + 1, '}', e - l - 1)) == NULL || r == l + 1) return;
+    *s = l + 1;
+    *len = r - l - 1;
+}
 
-            if (str[s] == '{' && !found_s) {
-                if (s == len - 1) {
-                    if (h + 1 >= pos->pos_len) goto end;
-                    if ((p + 1)->len <= 0 || (p + 1)->str[0] == '}') goto end;
-                    found_s = 1;
-                    j = -1;
-                    arr.pos_len = -1;
-                } else {
-                    q->str += s + 1;
-                    q->len -= s + 1;
-                    if (q->str[0] == '}') goto end;
-                    found_s = 1;
-                }
+void slot_get_batch(struct pos_array *keys[], uint16_t slots[], size_t n)
+{
+    size_t i, j, m, idx[SLOT_BATCH_SIZE], lens[SLOT_BATCH_SIZE];
+    const uint8_t *bufs[SLOT_BATCH_SIZE];
+    uint16_t crcs[SLOT_BATCH_SIZE];
+
+    for (i = 0; i < n; i += SLOT_BATCH_SIZE) {
+        for (j = i, m = 0; j < n && j < i + SLOT_BATCH_SIZE; j++) {
+            if (keys[j]->pos_len != 1) {
+                slots[j] = slot_get(keys[j]);
+                continue;
             }
+            bufs[m] = keys[j]->items[0].str;
+            lens[m] = keys[j]->items[0].len;
+            slot_get_tag(&bufs[m], &lens[m]);
+            idx[m++] = j;
+        }
+        crc16_batch(bufs, lens, crcs, m);
+        for (j = 0; j < m; j++) {
+            slots[idx[j]] = crcs[j] & 0x3FFF;
         }
+    }
+}
 
-        if (found_s) {
-            j++;
-            arr.pos_len++;
+static inline bool slot_addr_equal(struct address *a, struct address *b)
+{
+    return a->port == b->port && strcmp(a->ip, b->ip) == 0;
+}
+
+/*
+ * Route `slot` to the master at `addr` after a MOVED reply, so that all
+ * worker threads use it before the slot manager fetches the whole map
+ * again. The slot joins the shard of that master, including its slaves,
+ * if there is any.
+ */
+int slot_map_move(int slot, char *addr)
+{
+    size_t i;
+    uint16_t index;
+    struct address target;
+
+    if (slot < 0 || slot >= REDIS_CLUSTER_SLOTS) return CORVUS_ERR;
+    if (socket_parse_addr(addr, &target) == CORVUS_ERR) return CORVUS_ERR;
+
+    pthread_rwlock_wrlock(&slot_map.lock);
+    index = slot_map.data[slot];
+    if (index > 0 && slot_addr_equal(&slot_map.shards[index - 1].nodes[0], &target)) {
+        // already moved by another thread
+        pthread_rwlock_unlock(&slot_map.lock);
+        return CORVUS_OK;
+    }
+
+    for (i = 0; i < slot_map.len; i++) {
+        if (slot_addr_equal(&slot_map.shards[i].nodes[0], &target)) break;
+    }
+    if (i == slot_map.len) {
+        if (slot_map.len >= UINT16_MAX) {
+            pthread_rwlock_unlock(&slot_map.lock);
+            return CORVUS_ERR;
         }
-        if (found) break;
+        if (slot_map.len >= slot_map.size) {
+            slot_map.size = slot_map.size == 0 ? 16 : slot_map.size << 1;
+            slot_map.shards = cv_realloc(slot_map.shards,
+                    sizeof(struct node_info) * slot_map.size);
+        }
+        struct node_info *shard = &slot_map.shards[slot_map.len++];
+        shard->nodes = cv_malloc(sizeof(struct address));
+        shard->len = 1;
+        memcpy(&shard->nodes[0], &target, sizeof(struct address));
     }
-end:
-    if (found) pos = &arr;
-    return crc16(pos) & 0x3FFF;
+    slot_map.data[slot] = i + 1;
+    // worker threads only apply the moves since their last update
+    uint64_t version = ATOMIC_INC(slot_map.version, 1);
+    slot_map.moves[version % SLOT_MOVE_LOG].slot = slot;
+    slot_map.moves[version % SLOT_MOVE_LOG].index = i + 1;
+    pthread_rwlock_unlock(&slot_map.lock);
+
+    return CORVUS_OK;
 }
 
-bool slot_get_node_addr(uint16_t slot, struct node_info *info)
+/*
+ * Copy at most `n` nodes of the shard owning `slot`, master first.
+ * Returns the number of nodes of the shard, zero if not covered.
+ */
+int slot_get_node_addr(uint16_t slot, struct address *nodes, int n)
 {
-    bool hit = false;
+    int len = 0;
 
     pthread_rwlock_rdlock(&slot_map.lock);
-    struct node_info *n = ATOMIC_GET(slot_map.data[slot]);
-    if (n != NULL) {
-        hit = true;
-        memcpy(info, n, sizeof(struct node_info));
+    uint16_t index = slot_map.data[slot];
+    if (index > 0) {
+        struct node_info *shard = &slot_map.shards[index - 1];
+        len = shard->len;
+        memcpy(nodes, shard->nodes, sizeof(struct address) * MIN(len, n));
     }
     pthread_rwlock_unlock(&slot_map.lock);
 
-    return hit;
+    return len;
+}
+
+static struct slot_route *slot_table_add(struct slot_table *table, struct node_info *n)
+{
+    if (table->len >= table->size) {
+        table->size = table->size == 0 ? 16 : table->size << 1;
+        table->routes = cv_realloc(table->routes,
+                sizeof(struct slot_route) * table->size);
+    }
+    struct slot_route *route = &table->routes[table->len++];
+    route->len = n->len;
+    route->nodes = cv_malloc(sizeof(struct address) * n->len);
+    route->servers = cv_calloc(n->len, sizeof(struct connection*));
+    memcpy(route->nodes, n->nodes, sizeof(struct address) * n->len);
+    return route;
 }
 
-void node_list_get(char *dest)
+/*
+ * Only the slots moved since the last update are patched if the moves are
+ * still in the log, so resolved servers of the routes are kept. Otherwise
+ * the table is copied from slot map.
+ */
+static void slot_table_update(struct slot_table *table)
 {
-    int i, pos = 0;
+    pthread_rwlock_rdlock(&slot_map.lock);
+    uint64_t version = ATOMIC_GET(slot_map.version);
+
+    if (table->version >= slot_map.replaced
+            && version - table->version <= SLOT_MOVE_LOG)
+    {
+        for (uint64_t v = table->version + 1; v <= version; v++) {
+            struct slot_move *move = &slot_map.moves[v % SLOT_MOVE_LOG];
+            table->data[move->slot] = move->index;
+        }
+    } else {
+        slot_table_free(table);
+        memcpy(table->data, slot_map.data, sizeof(table->data));
+    }
+    // routes have the same indexes as shards, moves only append shards
+    for (size_t i = table->len; i < slot_map.len; i++) {
+        slot_table_add(table, &slot_map.shards[i]);
+    }
+    table->version = version;
+    pthread_rwlock_unlock(&slot_map.lock);
+
+    LOG(DEBUG, "slot table updated to version %llu: %zu routes",
+            (unsigned long long)table->version, table->len);
+}
+
+struct slot_route *slot_get_route(struct slot_table *table, uint16_t slot)
+{
+    if (table->version != ATOMIC_GET(slot_map.version)) {
+        slot_table_update(table);
+    }
+    uint16_t index = table->data[slot];
+    return index == 0 ? NULL : &table->routes[index - 1];
+}
+
+void slot_table_free(struct slot_table *table)
+{
+    for (size_t i = 0; i < table->len; i++) {
+        cv_free(table->routes[i].nodes);
+        cv_free(table->routes[i].servers);
+    }
+    table->len = 0;
+}
+
+// comma separated addresses of cluster nodes, freed by the caller
+char *node_list_get()
+{
+    int i, n;
+    size_t pos = 0;
+
     pthread_rwlock_rdlock(&node_list.lock);
+    char *dest = cv_malloc((ADDRESS_LEN + 1) * node_list.len + 1);
     for (i = 0; i < node_list.len; i++) {
         if (i > 0) {
             dest[pos++] = ',';
         }
-        pos += snprintf(dest + pos, ADDRESS_LEN, "%s:%d",
+        n = snprintf(dest + pos, ADDRESS_LEN, "%s:%d",
                 node_list.nodes[i].ip, node_list.nodes[i].port);
+        pos += MIN(n, ADDRESS_LEN - 1);
     }
+    dest[pos] = '\0';
     pthread_rwlock_unlock(&node_list.lock);
+    return dest;
 }
 
 void slot_create_job(int type)
@@ -516,9 +928,7 @@ void slot_create_job(int type)
 int slot_start_manager(struct context *ctx)
 {
     int err;
-    memset(slot_map.data, 0, sizeof(struct node_info*) * REDIS_CLUSTER_SLOTS);
-    dict_init(&slot_map.free_nodes);
-    dict_init(&slot_map.node_map);
+    memset(slot_map.data, 0, sizeof(slot_map.data));
     node_list_init();
 
     if ((err = pthread_mutex_init(&job_mutex, NULL)) != 0) {
@@ -5,12 +5,15 @@
 #include "parser.h"
 #include "socket.h"
 
-#define MAX_DESC_PART_LEN 64
-#define MAX_NODE_LIST 16
-#define MAX_SLAVE_NODES 64
+#define SLOT_BATCH_SIZE 16
+#define SLOT_UPDATE_FANOUT 3
+#define SLOT_UPDATE_TIMEOUT 1000  // ms
+#define SLOT_UPDATE_GRACE 100  // ms
+#define SLOT_MOVE_LOG 128
 #define REDIS_CLUSTER_SLOTS 16384
 
 struct context;
+struct connection;
 
 enum {
     SLOT_UPDATE_UNKNOWN,
@@ -20,30 +23,46 @@ enum {
     SLOT_UPDATER_QUIT,
 };
 
-struct desc_part {
-    char data[MAX_DESC_PART_LEN];
-    uint8_t len;
-};
-
+// fields of one line of CLUSTER NODES, pointing into the reply text
 struct node_desc {
-    struct desc_part *parts;
-    uint16_t index, len;
+    char **parts;
+    int len;
+    int size;
 };
 
+// master and slaves of one shard
 struct node_info {
-    char name[64];
-    // contains master and slaves of one shard
-    struct address nodes[MAX_SLAVE_NODES + 1];
-    size_t index;  // length of `nodes` above
-    int refcount;
-    // for parsing slots of a master node
-    struct desc_part *slot_spec;
-    int spec_length;
+    struct address *nodes;
+    size_t len;
+};
+
+// per thread copy of one shard in slot map
+struct slot_route {
+    struct address *nodes;  // master and slaves
+    struct connection **servers;  // resolved lazily from `nodes`
+    size_t len;
+};
+
+/*
+ * Per thread routing table updated from slot map when the version
+ * published by slot manager changes.
+ */
+struct slot_table {
+    uint64_t version;
+    struct slot_route *routes;
+    size_t len;
+    size_t size;
+    // index of route in `routes` plus one, zero if slot is not covered
+    uint16_t data[REDIS_CLUSTER_SLOTS];
 };
 
 uint16_t slot_get(struct pos_array *pos);
-void node_list_get(char *dest);
-bool slot_get_node_addr(uint16_t slot, struct node_info *info);
+void slot_get_batch(struct pos_array *keys[], uint16_t slots[], size_t n);
+struct slot_route *slot_get_route(struct slot_table *table, uint16_t slot);
+void slot_table_free(struct slot_table *table);
+char *node_list_get();
+int slot_get_node_addr(uint16_t slot, struct address *nodes, int n);
+int slot_map_move(int slot, char *addr);
 void slot_create_job(int type);
 int slot_start_manager(struct context *ctx);
 
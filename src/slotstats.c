@@ -0,0 +1,68 @@
+#include <string.h>
+#include "corvus.h"
+#include "slotstats.h"
+#include "alloc.h"
+
+void slotstats_init(struct slotstats *stats)
+{
+    stats->decay_time = 0;
+    stats->slots = cv_calloc(REDIS_CLUSTER_SLOTS, sizeof(struct slot_counter));
+}
+
+void slotstats_free(struct slotstats *stats)
+{
+    cv_free(stats->slots);
+    stats->slots = NULL;
+}
+
+void slotstats_record(struct slotstats *stats, uint16_t slot,
+        uint32_t req_bytes, uint32_t rep_bytes)
+{
+    struct slot_counter *c = &stats->slots[slot & (REDIS_CLUSTER_SLOTS - 1)];
+
+    STATS_INCR(c->ops, 1);
+    STATS_INCR(c->req_bytes, req_bytes);
+    STATS_INCR(c->rep_bytes, rep_bytes);
+}
+
+// called by the owner thread, `now` in seconds
+void slotstats_decay(struct slotstats *stats, int64_t now)
+{
+    struct slot_counter *c;
+
+    if (stats->decay_time == 0) {
+        stats->decay_time = now;
+        return;
+    }
+    if (now - stats->decay_time < SLOTSTATS_DECAY_INTERVAL) return;
+    stats->decay_time = now;
+
+    for (int i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        c = &stats->slots[i];
+        if (STATS_GET(c->ops) == 0) continue;
+        STATS_SET(c->ops, STATS_GET(c->ops) >> 1);
+        STATS_SET(c->req_bytes, STATS_GET(c->req_bytes) >> 1);
+        STATS_SET(c->rep_bytes, STATS_GET(c->rep_bytes) >> 1);
+    }
+}
+
+/*
+ * Sum the counters of slots `start` to `end` (inclusive) of all worker
+ * threads into `slots`, indexed from `start`.
+ */
+void slotstats_get(struct context *contexts, struct slot_counter *slots,
+        int start, int end)
+{
+    int i, j, n = end - start + 1;
+    struct slot_counter *c;
+
+    memset(slots, 0, sizeof(struct slot_counter) * n);
+    for (i = 0; i < config.thread; i++) {
+        c = contexts[i].slotstats.slots + start;
+        for (j = 0; j < n; j++) {
+            slots[j].ops += STATS_GET(c[j].ops);
+            slots[j].req_bytes += STATS_GET(c[j].req_bytes);
+            slots[j].rep_bytes += STATS_GET(c[j].rep_bytes);
+        }
+    }
+}
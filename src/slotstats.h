@@ -0,0 +1,35 @@
+#ifndef SLOTSTATS_H
+#define SLOTSTATS_H
+
+#include <stdint.h>
+
+#define SLOTSTATS_DECAY_INTERVAL 60
+
+struct context;
+
+struct slot_counter {
+    long long ops;
+    long long req_bytes;
+    long long rep_bytes;
+};
+
+/*
+ * Traffic of each slot seen by a worker thread. Only the owner thread
+ * writes the counters, others read them with relaxed loads. Counters are
+ * halved every SLOTSTATS_DECAY_INTERVAL seconds, so they follow the
+ * recent load of a slot.
+ */
+struct slotstats {
+    int64_t decay_time;
+    struct slot_counter *slots;
+};
+
+void slotstats_init(struct slotstats *stats);
+void slotstats_free(struct slotstats *stats);
+void slotstats_record(struct slotstats *stats, uint16_t slot,
+        uint32_t req_bytes, uint32_t rep_bytes);
+void slotstats_decay(struct slotstats *stats, int64_t now);
+void slotstats_get(struct context *contexts, struct slot_counter *slots,
+        int start, int end);
+
+#endif /* end of include guard: SLOTSTATS_H */
@@ -14,6 +14,10 @@ extern const size_t CMD_NUM;
 struct dict slow_counts;  // node dsn => slow cmd counts
 uint32_t *counts_sum;
 
+// totals at last `slowlog_prepare_stats`, counters of workers are never reset
+static struct dict last_slow_counts;
+static uint32_t *last_counts_sum;
+
 const int multi_key_cmd[] = {CMD_MGET, CMD_MSET, CMD_DEL, CMD_EXISTS};
 const size_t MULTI_KEY_CMD_NUM = sizeof multi_key_cmd / sizeof(int);
 uint32_t multi_key_cmd_counts[4];  // for mget, mset, del, exists
@@ -196,6 +200,14 @@ bool slowlog_statsd_enabled()
         && config.stats;
 }
 
+// slow commands are also counted for the metrics endpoint
+bool slowlog_count_enabled()
+{
+    return slowlog_statsd_enabled()
+        || (ATOMIC_GET(config.slowlog_log_slower_than) >= 0
+            && config.metrics_bind > 0);
+}
+
 bool slowlog_type_need_log(struct command *cmd)
 {
     return cmd->request_type != CMD_EXTRA
@@ -217,6 +229,8 @@ void slowlog_init_stats()
 {
     dict_init(&slow_counts);
     counts_sum = cv_calloc(CMD_NUM, sizeof(uint32_t));
+    dict_init(&last_slow_counts);
+    last_counts_sum = cv_calloc(CMD_NUM, sizeof(uint32_t));
 }
 
 void slowlog_free_stats()
@@ -228,6 +242,13 @@ void slowlog_free_stats()
 
     dict_free(&slow_counts);
     cv_free(counts_sum);
+
+    struct dict_iter last_iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&last_slow_counts, &last_iter) {
+        cv_free(last_iter.value);
+    }
+    dict_free(&last_slow_counts);
+    cv_free(last_counts_sum);
 }
 
 static uint32_t *slowlog_multi_key_cmd_count(int cmd_type)
@@ -255,15 +276,10 @@ void slowlog_add_count(struct command *cmd)
     }
 }
 
-// Collect slow command count into `slow_counts` and `counts_sum`.
-void slowlog_prepare_stats(struct context *contexts)
+// Add slow command counts since startup of all worker threads into `counts`
+// (node dsn => counts, allocated here and freed by caller) and `sum`.
+void slowlog_get_counts(struct context *contexts, struct dict *counts, uint32_t *sum)
 {
-    struct dict_iter iter = DICT_ITER_INITIALIZER;
-    DICT_FOREACH(&slow_counts, &iter) {
-        memset(iter.value, 0, CMD_NUM * sizeof(uint32_t));
-    }
-    memset(counts_sum, 0, CMD_NUM * sizeof(uint32_t));
-
     struct connection *server;
 
     for (size_t i = 0; i != config.thread; i++) {
@@ -273,18 +289,18 @@ void slowlog_prepare_stats(struct context *contexts)
             const char *dsn = server->info->dsn;
             uint32_t *node_counts = NULL;
             for (size_t j = 0; j != CMD_NUM; j++) {
-                uint32_t count = ATOMIC_IGET(server->info->slow_cmd_counts[j], 0);
+                uint32_t count = ATOMIC_GET(server->info->slow_cmd_counts[j]);
                 if (count == 0) continue;
 
                 if (!node_counts) {
-                    node_counts = (uint32_t*)dict_get(&slow_counts, dsn);
+                    node_counts = (uint32_t*)dict_get(counts, dsn);
                     if (!node_counts) {
                         node_counts = cv_calloc(CMD_NUM, sizeof(uint32_t));
-                        dict_set(&slow_counts, dsn, node_counts);
+                        dict_set(counts, dsn, node_counts);
                     }
                 }
                 node_counts[j] += count;
-                counts_sum[j] += count;
+                sum[j] += count;
             }
         }
     }
@@ -292,6 +308,39 @@ void slowlog_prepare_stats(struct context *contexts)
     for (size_t i = 0; i != MULTI_KEY_CMD_NUM; i++) {
         int cmd_type = multi_key_cmd[i];
         uint32_t *count = slowlog_multi_key_cmd_count(cmd_type);
-        counts_sum[cmd_type] = ATOMIC_IGET(*count, 0);
+        sum[cmd_type] = ATOMIC_GET(*count);
+    }
+}
+
+// Collect slow command count since last call into `slow_counts` and `counts_sum`.
+void slowlog_prepare_stats(struct context *contexts)
+{
+    struct dict_iter iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&slow_counts, &iter) {
+        memset(iter.value, 0, CMD_NUM * sizeof(uint32_t));
+    }
+    memset(counts_sum, 0, CMD_NUM * sizeof(uint32_t));
+
+    slowlog_get_counts(contexts, &slow_counts, counts_sum);
+
+    uint32_t total;
+    struct dict_iter count_iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&slow_counts, &count_iter) {
+        uint32_t *counts = (uint32_t*)count_iter.value;
+        uint32_t *last = (uint32_t*)dict_get(&last_slow_counts, count_iter.key);
+        if (!last) {
+            last = cv_calloc(CMD_NUM, sizeof(uint32_t));
+            dict_set(&last_slow_counts, count_iter.key, last);
+        }
+        for (size_t j = 0; j != CMD_NUM; j++) {
+            total = counts[j];
+            counts[j] -= last[j];
+            last[j] = total;
+        }
+    }
+    for (size_t j = 0; j != CMD_NUM; j++) {
+        total = counts_sum[j];
+        counts_sum[j] -= last_counts_sum[j];
+        last_counts_sum[j] = total;
     }
 }
@@ -32,6 +32,7 @@ struct slowlog_queue {
 };
 
 struct context;
+struct dict;
 struct command;
 
 int slowlog_init(struct slowlog_queue *slowlog);
@@ -53,7 +54,9 @@ bool slowlog_need_log(struct command *cmd, long long latency);
 bool slowlog_statsd_enabled();
 void slowlog_init_stats();
 void slowlog_free_stats();
+bool slowlog_count_enabled();
 void slowlog_add_count(struct command *cmd);  // called by worker threads
+void slowlog_get_counts(struct context *contexts, struct dict *counts, uint32_t *sum);
 void slowlog_prepare_stats(struct context *contexts);  // called by stats thread
 
 #endif
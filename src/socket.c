@@ -1,8 +1,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
 #include <sys/uio.h>
-#include <sys/eventfd.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -132,6 +133,8 @@ int socket_set_tcpnodelay(int fd)
 {
     int optval = 1;
     if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int)) == -1) {
+        // not a tcp socket, e.g. a unix domain socket client
+        if (errno == EOPNOTSUPP) return CORVUS_OK;
         LOG(WARN, "setsockopt TCP_NODELAY: %s", strerror(errno));
         return CORVUS_ERR;
     }
@@ -204,6 +207,56 @@ int socket_create_server(char *bindaddr, int port)
     return s;
 }
 
+int socket_create_unix_server(const char *path, int perm)
+{
+    int s;
+    struct stat st;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG(ERROR, "socket_create_unix_server: path too long");
+        return CORVUS_ERR;
+    }
+
+    // remove socket file left by a previous run
+    if (stat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOG(ERROR, "socket_create_unix_server: %s is not a socket", path);
+            return CORVUS_ERR;
+        }
+        if (unlink(path) == -1) {
+            LOG(ERROR, "unlink: %s", strerror(errno));
+            return CORVUS_ERR;
+        }
+    }
+
+    if ((s = cv_socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        return CORVUS_ERR;
+    }
+
+    if (socket_set_nonblocking(s) == -1) {
+        close(s);
+        return CORVUS_ERR;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (cv_listen(s, (struct sockaddr*)&addr, sizeof(addr), 1024) == -1) {
+        close(s);
+        return CORVUS_ERR;
+    }
+
+    if (perm > 0 && chmod(path, perm) == -1) {
+        LOG(ERROR, "chmod: %s", strerror(errno));
+        close(s);
+        unlink(path);
+        return CORVUS_ERR;
+    }
+    return s;
+}
+
 int socket_create_stream()
 {
     return cv_socket(AF_INET, SOCK_STREAM, 0);
@@ -223,6 +276,12 @@ int socket_accept(int fd, char *ip, size_t ip_len, int *port)
     s = cv_accept(fd, (struct sockaddr*)&sa, &salen);
     if (s == CORVUS_AGAIN || s == CORVUS_ERR) return s;
 
+    if (sa.ss_family == AF_UNIX) {
+        if (ip) strncpy(ip, "unix", ip_len);
+        if (port) *port = 0;
+        return s;
+    }
+
     struct sockaddr_in *addr = (struct sockaddr_in*)&sa;
     if (ip) inet_ntop(AF_INET, (void*)&(addr->sin_addr), ip, ip_len);
     if (port) *port = ntohs(addr->sin_port);
@@ -372,22 +431,3 @@ int socket_parse_addr(char *addr, struct address *address)
     return port;
 }
 
-int socket_create_eventfd()
-{
-    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-    if (fd == -1) {
-        LOG(WARN, "%s: %s", __func__, strerror(errno));
-    }
-    return fd;
-}
-
-int socket_trigger_event(int evfd)
-{
-    uint64_t u = 1;
-    ssize_t s = write(evfd, &u, sizeof(u));
-    if (s != sizeof(u)) {
-        LOG(ERROR, "%s: %s", __func__, strerror(errno));
-        return CORVUS_ERR;
-    }
-    return CORVUS_OK;
-}
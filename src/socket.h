@@ -18,6 +18,7 @@ struct address {
 
 int socket_accept(int fd, char *ip, size_t ip_len, int *port);
 int socket_create_server(char *bindaddr, int port);
+int socket_create_unix_server(const char *path, int perm);
 int socket_create_stream();
 int socket_create_udp_client();
 int socket_connect(int fd, char *addr, int port);
@@ -31,7 +32,5 @@ int socket_set_timeout(int fd, int timeout);
 int socket_parse_port(char *ptr, uint16_t *res);
 int socket_parse_addr(char *addr, struct address *address);
 int socket_parse_ip(char *addr, struct address *address);
-int socket_create_eventfd();
-int socket_trigger_event(int evfd);
 
 #endif /* end of include guard: SOCKET_H */
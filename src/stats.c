@@ -3,14 +3,21 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <ctype.h>
 #include "stats.h"
 #include "corvus.h"
 #include "socket.h"
 #include "logging.h"
 #include "slot.h"
 #include "slowlog.h"
+#include "array.h"
+#include "alloc.h"
 
 #define HOST_LEN 255
+#define HOTKEY_EXPORT 10
+#define BIGKEY_EXPORT 10
 
 struct bytes {
     char key[ADDRESS_LEN + 1];
@@ -28,13 +35,21 @@ static char hostname[HOST_LEN + 1];
 // only used `stats_ctx.thread` currently
 static struct context stats_ctx;
 
-static struct stats cumulation;
+// Counters of worker threads are never reset, so that they can be scraped
+// as monotonic counters, statsd is sent the difference to the last push.
+static struct basic_stats last_sent;
 static struct {
     double sys;
     double user;
 } used_cpu;
 
 static int slot_update_job_count;
+static long long slot_update_usec;
+static long long slot_update_last_usec;
+
+// latency histograms sent in the last metric interval
+static struct histogram **last_cmd_latency;
+static struct dict last_node_latency;
 
 static inline void stats_get_cpu_usage(struct stats *stats)
 {
@@ -46,28 +61,20 @@ static inline void stats_get_cpu_usage(struct stats *stats)
     stats->used_cpu_user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0;
 }
 
-static inline void stats_copy_basic_fields(struct basic_stats *dst, struct basic_stats *src)
-{
-    dst->completed_commands = ATOMIC_GET(src->completed_commands);
-    dst->slot_update_jobs = ATOMIC_GET(src->slot_update_jobs);
-    dst->remote_latency = ATOMIC_GET(src->remote_latency);
-    dst->total_latency = ATOMIC_GET(src->total_latency);
-    dst->recv_bytes = ATOMIC_GET(src->recv_bytes);
-    dst->send_bytes = ATOMIC_GET(src->send_bytes);
-    dst->ask_recv = ATOMIC_GET(src->ask_recv);
-    dst->moved_recv = ATOMIC_GET(src->moved_recv);
-}
-
-static inline void stats_cumulate(struct stats *stats)
+static inline void stats_sub_basic_fields(struct basic_stats *dst, struct basic_stats *src)
 {
-    ATOMIC_INC(cumulation.basic.completed_commands, stats->basic.completed_commands);
-    ATOMIC_INC(cumulation.basic.slot_update_jobs, stats->basic.slot_update_jobs);
-    ATOMIC_INC(cumulation.basic.remote_latency, stats->basic.remote_latency);
-    ATOMIC_INC(cumulation.basic.total_latency, stats->basic.total_latency);
-    ATOMIC_INC(cumulation.basic.recv_bytes, stats->basic.recv_bytes);
-    ATOMIC_INC(cumulation.basic.send_bytes, stats->basic.send_bytes);
-    ATOMIC_INC(cumulation.basic.ask_recv, stats->basic.ask_recv);
-    ATOMIC_INC(cumulation.basic.moved_recv, stats->basic.moved_recv);
+    dst->completed_commands -= src->completed_commands;
+    dst->slot_update_jobs -= src->slot_update_jobs;
+    dst->remote_latency -= src->remote_latency;
+    dst->total_latency -= src->total_latency;
+    dst->recv_bytes -= src->recv_bytes;
+    dst->send_bytes -= src->send_bytes;
+    dst->ask_recv -= src->ask_recv;
+    dst->moved_recv -= src->moved_recv;
+    dst->ask_cache_hits -= src->ask_cache_hits;
+    dst->ask_cache_misses -= src->ask_cache_misses;
+    dst->spliced_replies -= src->spliced_replies;
+    dst->spliced_bytes -= src->spliced_bytes;
 }
 
 static void stats_send(char *metric, double value)
@@ -101,21 +108,60 @@ void stats_get_memory(struct memory_stats *stats)
         stats->free_conns     += contexts[i].mstats.free_conns;
         stats->free_conn_info += contexts[i].mstats.free_conn_info;
         stats->free_buf_times += contexts[i].mstats.free_buf_times;
+        for (int j = 0; j < MBUF_CLASSES; j++) {
+            stats->class_buffers[j] += contexts[i].mstats.class_buffers[j];
+            stats->free_class_buffers[j] += contexts[i].mstats.free_class_buffers[j];
+        }
+        stats->arena_chunks += contexts[i].arena.nchunks;
+        stats->arena_huge_chunks += contexts[i].arena.huge_chunks;
     }
 }
 
+/*
+ * Read the counters of a worker thread, retrying while the owner is in
+ * the middle of updating them. The owner never waits for readers.
+ */
+void stats_snapshot(struct thread_stats *s, struct basic_stats *basic,
+        long long *last_command_latency)
+{
+    unsigned seq;
+
+    do {
+        seq = seq_read_begin(&s->seq);
+        basic->connected_clients = STATS_GET(s->basic.connected_clients);
+        basic->completed_commands = STATS_GET(s->basic.completed_commands);
+        basic->slot_update_jobs = STATS_GET(s->basic.slot_update_jobs);
+        basic->recv_bytes = STATS_GET(s->basic.recv_bytes);
+        basic->send_bytes = STATS_GET(s->basic.send_bytes);
+        basic->remote_latency = STATS_GET(s->basic.remote_latency);
+        basic->total_latency = STATS_GET(s->basic.total_latency);
+        basic->ask_recv = STATS_GET(s->basic.ask_recv);
+        basic->moved_recv = STATS_GET(s->basic.moved_recv);
+        basic->ask_cache_hits = STATS_GET(s->basic.ask_cache_hits);
+        basic->ask_cache_misses = STATS_GET(s->basic.ask_cache_misses);
+        basic->spliced_replies = STATS_GET(s->basic.spliced_replies);
+        basic->spliced_bytes = STATS_GET(s->basic.spliced_bytes);
+        if (last_command_latency != NULL) {
+            *last_command_latency = STATS_GET(s->last_command_latency);
+        }
+    } while (seq_read_retry(&s->seq, seq));
+}
+
 void incr_slot_update_counter()
 {
     ATOMIC_INC(slot_update_job_count, 1);
 }
 
-void stats_get_simple(struct stats *stats, bool reset)
+void stats_record_slot_update(long long usec)
 {
-    if (!reset) {
-        stats->basic.connected_clients = 0;
-        stats_copy_basic_fields(&stats->basic, &cumulation.basic);
-    }
+    ATOMIC_INC(slot_update_usec, usec);
+    ATOMIC_SET(slot_update_last_usec, usec);
+}
 
+// With `reset` only the counts since last reset are returned,
+// only the stats thread resets.
+void stats_get_simple(struct stats *stats, bool reset)
+{
     stats_get_cpu_usage(stats);
     if (reset) {
         double temp_sys = stats->used_cpu_sys;
@@ -128,20 +174,19 @@ void stats_get_simple(struct stats *stats, bool reset)
         used_cpu.user = temp_user;
     }
 
-    if (reset){
-        stats->basic.slot_update_jobs = ATOMIC_IGET(slot_update_job_count, 0);
-    }else{
-        stats->basic.slot_update_jobs += ATOMIC_GET(slot_update_job_count);
-    }
+    struct basic_stats *basic = &stats->basic;
+    memset(basic, 0, sizeof(struct basic_stats));
+    basic->slot_update_jobs = ATOMIC_GET(slot_update_job_count);
+    stats->slot_update_usec = ATOMIC_GET(slot_update_usec);
+    stats->slot_update_last_usec = ATOMIC_GET(slot_update_last_usec);
 
     struct context *contexts = get_contexts();
+    struct basic_stats s;
 
-#define STATS_ASSIGN(field) \
-    stats->basic.field += reset ? \
-        ATOMIC_IGET(contexts[i].stats.field, 0) : \
-        ATOMIC_GET(contexts[i].stats.field)
+#define STATS_ASSIGN(field) basic->field += s.field
 
     for (int i = 0; i < config.thread; i++) {
+        stats_snapshot(&contexts[i].stats, &s, NULL);
         STATS_ASSIGN(completed_commands);
         STATS_ASSIGN(remote_latency);
         STATS_ASSIGN(total_latency);
@@ -149,45 +194,41 @@ void stats_get_simple(struct stats *stats, bool reset)
         STATS_ASSIGN(send_bytes);
         STATS_ASSIGN(ask_recv);
         STATS_ASSIGN(moved_recv);
-        stats->basic.connected_clients += ATOMIC_GET(contexts[i].stats.connected_clients);
+        STATS_ASSIGN(ask_cache_hits);
+        STATS_ASSIGN(ask_cache_misses);
+        STATS_ASSIGN(spliced_replies);
+        STATS_ASSIGN(spliced_bytes);
+        STATS_ASSIGN(connected_clients);
     }
 
     if (reset) {
-        stats_cumulate(stats);
+        struct basic_stats total = *basic;
+        stats_sub_basic_fields(basic, &last_sent);
+        last_sent = total;
     }
 }
 
-void stats_node_info_agg(struct bytes *bytes)
+// Sum counters of the connections to the same node into `nodes`,
+// keyed by node dsn, values should be freed by caller.
+static void stats_node_info_agg(struct dict *nodes)
 {
     struct bytes *b = NULL;
     struct connection *server;
     struct context *contexts = get_contexts();
-    int j, n, m = 0;
 
     for (int i = 0; i < config.thread; i++) {
         TAILQ_FOREACH(server, &contexts[i].servers, next) {
-            n = strlen(server->info->addr.ip);
-            if (n <= 0) continue;
-
-            char ip[n + 8];
-            for (j = 0; j < n; j++) {
-                ip[j] = server->info->addr.ip[j];
-                if (ip[j] == '.') ip[j] = '-';
-            }
-            sprintf(ip + j, "-%d", server->info->addr.port);
+            if (strlen(server->info->dsn) <= 0) continue;
 
-            b = dict_get(&bytes_map, ip);
+            b = dict_get(nodes, server->info->dsn);
             if (b == NULL) {
-                b = &bytes[m++];
-                strncpy(b->key, ip, sizeof(b->key));
-                b->send = 0;
-                b->recv = 0;
-                b->completed = 0;
-                dict_set(&bytes_map, b->key, (void*)b);
+                b = cv_calloc(1, sizeof(struct bytes));
+                strcpy(b->key, server->info->dsn);
+                dict_set(nodes, b->key, (void*)b);
             }
-            b->send += ATOMIC_IGET(server->info->send_bytes, 0);
-            b->recv += ATOMIC_IGET(server->info->recv_bytes, 0);
-            b->completed += ATOMIC_IGET(server->info->completed_commands, 0);
+            b->send += STATS_GET(server->info->send_bytes);
+            b->recv += STATS_GET(server->info->recv_bytes);
+            b->completed += STATS_GET(server->info->completed_commands);
         }
     }
 }
@@ -205,49 +246,590 @@ void stats_send_simple()
     stats_send("latency", stats.basic.total_latency / 1000000.0);
 }
 
+// node dsn `127.0.0.1:8000` to metric name `127-0-0-1-8000`
+static void stats_node_name(char *dst, const char *dsn)
+{
+    strncpy(dst, dsn, ADDRESS_LEN);
+    dst[ADDRESS_LEN] = '\0';
+    for (char *p = dst; *p != '\0'; p++) {
+        if (*p == '.' || *p == ':') *p = '-';
+    }
+}
+
 void stats_send_node_info()
 {
-    struct bytes *value;
+    struct bytes *value, *last;
+    char addr[ADDRESS_LEN + 1];
 
     /* redis-node.127-0-0-1-8000.bytes.{send,recv} */
     int len = HOST_LEN + 64;
     char name[len];
 
-    struct bytes bytes[REDIS_CLUSTER_SLOTS];
-    stats_node_info_agg(bytes);
+    struct dict nodes;
+    dict_init(&nodes);
+    stats_node_info_agg(&nodes);
 
     struct dict_iter iter = DICT_ITER_INITIALIZER;
-    DICT_FOREACH(&bytes_map, &iter) {
+    DICT_FOREACH(&nodes, &iter) {
         value = (struct bytes*)iter.value;
-        snprintf(name, len, "redis-node.%s.bytes.send", iter.key);
-        stats_send(name, value->send);
-        snprintf(name, len, "redis-node.%s.bytes.recv", iter.key);
-        stats_send(name, value->recv);
-        snprintf(name, len, "redis-node.%s.commands.completed", iter.key);
-        stats_send(name, value->completed);
-        value->send = 0;
-        value->recv = 0;
-        value->completed = 0;
+        last = dict_get(&bytes_map, iter.key);
+        if (last == NULL) {
+            last = cv_calloc(1, sizeof(struct bytes));
+            strcpy(last->key, value->key);
+            dict_set(&bytes_map, last->key, (void*)last);
+        }
+
+        stats_node_name(addr, iter.key);
+        snprintf(name, len, "redis-node.%s.bytes.send", addr);
+        stats_send(name, value->send - last->send);
+        snprintf(name, len, "redis-node.%s.bytes.recv", addr);
+        stats_send(name, value->recv - last->recv);
+        snprintf(name, len, "redis-node.%s.commands.completed", addr);
+        stats_send(name, value->completed - last->completed);
+        memcpy(last, value, sizeof(struct bytes));
+        cv_free(value);
     }
-    dict_clear(&bytes_map);
+    dict_free(&nodes);
 }
 
 void stats_get(struct stats *stats)
 {
     stats_get_simple(stats, false);
 
-    memset(stats->remote_nodes, 0, sizeof(stats->remote_nodes));
-    node_list_get(stats->remote_nodes);
+    stats->remote_nodes = node_list_get();
 
     struct context *contexts = get_contexts();
 
-    memset(stats->last_command_latency, 0, sizeof(stats->last_command_latency));
+    stats->last_command_latency = cv_calloc(config.thread, sizeof(long long));
     for (int i = 0; i < config.thread; i++) {
-        if (i >= MAX_NODE_LIST) break;
-        stats->last_command_latency[i] = ATOMIC_GET(contexts[i].last_command_latency);
+        stats->last_command_latency[i] = STATS_GET(contexts[i].stats.last_command_latency);
+    }
+}
+
+void stats_free(struct stats *stats)
+{
+    cv_free(stats->remote_nodes);
+    cv_free(stats->last_command_latency);
+}
+
+static inline struct histogram *stats_hist_get(struct histogram **hists, int type)
+{
+    if (hists[type] == NULL) {
+        ATOMIC_SET(hists[type], cv_calloc(1, sizeof(struct histogram)));
+    }
+    return hists[type];
+}
+
+static inline void stats_record_node_latency(struct command *cmd)
+{
+    if (cmd->server == NULL || cmd->server->info->latency == NULL) return;
+    if (cmd->rep_time[0] <= 0 || cmd->rep_time[1] < cmd->rep_time[0]) return;
+    hist_record(cmd->server->info->latency, (cmd->rep_time[1] - cmd->rep_time[0]) / 1000);
+}
+
+// Called by worker threads, each thread only writes its own histograms.
+// Latencies are given in nanoseconds and recorded in microseconds.
+void stats_record_latency(struct command *cmd, int64_t total_latency)
+{
+    extern const size_t CMD_NUM;
+    struct context *ctx = cmd->ctx;
+    struct command *c;
+
+    if (cmd->cmd_type < 0 || cmd->cmd_type >= (int)CMD_NUM) return;
+
+    hist_record(stats_hist_get(ctx->total_latency, cmd->cmd_type), total_latency / 1000);
+
+    // not sent to any node
+    if (cmd->rep_time[0] <= 0 || cmd->rep_time[1] < cmd->rep_time[0]) return;
+
+    hist_record(stats_hist_get(ctx->remote_latency, cmd->cmd_type),
+            (cmd->rep_time[1] - cmd->rep_time[0]) / 1000);
+
+    if (STAILQ_EMPTY(&cmd->sub_cmds)) {
+        stats_record_node_latency(cmd);
+    } else {
+        STAILQ_FOREACH(c, &cmd->sub_cmds, sub_cmd_next) {
+            stats_record_node_latency(c);
+        }
     }
 }
 
+// Sizes are recorded for each reply from redis, in bytes.
+void stats_record_size(struct context *ctx, int type, uint32_t req_bytes, uint32_t rep_bytes)
+{
+    extern const size_t CMD_NUM;
+
+    if (type < 0 || type >= (int)CMD_NUM) return;
+
+    hist_record(stats_hist_get(ctx->request_size, type), req_bytes);
+    hist_record(stats_hist_get(ctx->reply_size, type), rep_bytes);
+}
+
+enum {
+    HIST_TOTAL_LATENCY,
+    HIST_REMOTE_LATENCY,
+    HIST_REQUEST_SIZE,
+    HIST_REPLY_SIZE,
+};
+
+static inline struct histogram **stats_cmd_hists(struct context *ctx, int kind)
+{
+    switch (kind) {
+        case HIST_TOTAL_LATENCY: return ctx->total_latency;
+        case HIST_REMOTE_LATENCY: return ctx->remote_latency;
+        case HIST_REQUEST_SIZE: return ctx->request_size;
+        default: return ctx->reply_size;
+    }
+}
+
+// Merge histograms of command `type` of all worker threads into `dst`,
+// returns false if the command has never been recorded.
+static bool stats_merge_cmd_hist(struct histogram *dst, int type, int kind)
+{
+    struct context *contexts = get_contexts();
+    struct histogram *h;
+    bool found = false;
+
+    memset(dst, 0, sizeof(struct histogram));
+    for (int i = 0; i < config.thread; i++) {
+        h = ATOMIC_GET(stats_cmd_hists(&contexts[i], kind)[type]);
+        if (h == NULL) continue;
+        hist_merge(dst, h);
+        found = true;
+    }
+    return found;
+}
+
+// Merge histograms of the connections to the same node into `nodes`,
+// keyed by dsn, values should be freed by caller.
+static void stats_merge_node_latency(struct dict *nodes)
+{
+    struct context *contexts = get_contexts();
+    struct connection *server;
+    struct histogram *h;
+
+    for (int i = 0; i < config.thread; i++) {
+        TAILQ_FOREACH(server, &contexts[i].servers, next) {
+            if (server->info->latency == NULL) continue;
+
+            // server will not be freed until corvus stop
+            h = dict_get(nodes, server->info->dsn);
+            if (h == NULL) {
+                h = cv_calloc(1, sizeof(struct histogram));
+                dict_set(nodes, server->info->dsn, h);
+            }
+            hist_merge(h, server->info->latency);
+        }
+    }
+}
+
+static void cvstr_printf(struct cvstr *s, size_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    cvstr_reserve(s, *len + n + 1);
+
+    va_start(ap, fmt);
+    vsnprintf(s->data + *len, s->capacity - *len, fmt, ap);
+    va_end(ap);
+    *len += n;
+}
+
+static void stats_format_hist(struct cvstr *s, size_t *len, struct histogram *h)
+{
+    cvstr_printf(s, len, "calls=%" PRIu64 ",p50=%" PRId64 ",p99=%" PRId64
+            ",p99.9=%" PRId64 ",max=%" PRId64 "\r\n",
+            hist_count(h), hist_percentile(h, 50), hist_percentile(h, 99),
+            hist_percentile(h, 99.9), hist_max(h));
+}
+
+static void stats_lower_name(char *dst, const char *src)
+{
+    while (*src != '\0') {
+        *dst++ = tolower(*src++);
+    }
+    *dst = '\0';
+}
+
+/*
+ * Latency percentiles in microseconds since corvus started, per command
+ * type and per redis node, as `INFO` lines. Returns length of `info`.
+ */
+size_t stats_get_latency(struct cvstr *info)
+{
+    extern struct cmd_item cmds[];
+    extern const size_t CMD_NUM;
+    struct histogram h;
+    size_t len = 0;
+    int n;
+
+    info->data[0] = '\0';
+
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        char name[strlen(cmds[i].cmd) + 1];
+        stats_lower_name(name, cmds[i].cmd);
+
+        if (stats_merge_cmd_hist(&h, i, HIST_TOTAL_LATENCY) && hist_count(&h) > 0) {
+            cvstr_printf(info, &len, "latency_total_usec_%s:", name);
+            stats_format_hist(info, &len, &h);
+        }
+        if (stats_merge_cmd_hist(&h, i, HIST_REMOTE_LATENCY) && hist_count(&h) > 0) {
+            cvstr_printf(info, &len, "latency_remote_usec_%s:", name);
+            stats_format_hist(info, &len, &h);
+        }
+    }
+
+    struct dict nodes;
+    dict_init(&nodes);
+    stats_merge_node_latency(&nodes);
+
+    n = 0;
+    struct dict_iter iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&nodes, &iter) {
+        cvstr_printf(info, &len, "latency_node%d:addr=%s,", n++, iter.key);
+        stats_format_hist(info, &len, (struct histogram*)iter.value);
+        cv_free(iter.value);
+    }
+    dict_free(&nodes);
+
+    return len;
+}
+
+/*
+ * Request and reply sizes in bytes since corvus started per command type,
+ * as `INFO` lines. Returns length of `info`.
+ */
+size_t stats_get_sizes(struct cvstr *info)
+{
+    extern struct cmd_item cmds[];
+    extern const size_t CMD_NUM;
+    struct histogram h;
+    size_t len = 0;
+
+    info->data[0] = '\0';
+
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        char name[strlen(cmds[i].cmd) + 1];
+        stats_lower_name(name, cmds[i].cmd);
+
+        if (stats_merge_cmd_hist(&h, i, HIST_REQUEST_SIZE) && hist_count(&h) > 0) {
+            cvstr_printf(info, &len, "size_request_bytes_%s:", name);
+            stats_format_hist(info, &len, &h);
+        }
+        if (stats_merge_cmd_hist(&h, i, HIST_REPLY_SIZE) && hist_count(&h) > 0) {
+            cvstr_printf(info, &len, "size_reply_bytes_%s:", name);
+            stats_format_hist(info, &len, &h);
+        }
+    }
+    return len;
+}
+
+/* slot,ops,request_bytes,reply_bytes lines of slots with traffic */
+size_t stats_get_slotstats(struct cvstr *buf)
+{
+    struct slot_counter *slots;
+    size_t len = 0;
+
+    buf->data[0] = '\0';
+    cvstr_printf(buf, &len, "slot,ops,request_bytes,reply_bytes\n");
+
+    slots = cv_malloc(sizeof(struct slot_counter) * REDIS_CLUSTER_SLOTS);
+    slotstats_get(get_contexts(), slots, 0, REDIS_CLUSTER_SLOTS - 1);
+    for (int i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        if (slots[i].ops == 0) continue;
+        cvstr_printf(buf, &len, "%d,%lld,%lld,%lld\n", i,
+                slots[i].ops, slots[i].req_bytes, slots[i].rep_bytes);
+    }
+    cv_free(slots);
+    return len;
+}
+
+/*
+ * Escape `n` bytes of a key for a Prometheus label value, which must be
+ * valid UTF-8. Printable ASCII is kept with `\` and `"` escaped by a
+ * backslash, `%` and other bytes are written as %XX. `dst` needs 3n + 1
+ * bytes. Returns the length written.
+ */
+static int stats_escape_key(char *dst, const char *src, int n)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = dst;
+
+    for (int i = 0; i < n; i++) {
+        unsigned char c = src[i];
+        if (c == '\\' || c == '"') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20 || c > 0x7e || c == '%') {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        } else {
+            *p++ = c;
+        }
+    }
+    *p = '\0';
+    return p - dst;
+}
+
+#define METRIC_TYPE(name, type) \
+    cvstr_printf(buf, &len, "# TYPE corvus_%s %s\n", name, type)
+
+#define METRIC(name, type, fmt, value) do {                   \
+    METRIC_TYPE(name, type);                                  \
+    cvstr_printf(buf, &len, "corvus_%s " fmt "\n", name, value); \
+} while (0)
+
+/*
+ * Stats since startup in Prometheus text format, counters never decrease.
+ * Only atomic loads are done on the worker stats. Returns length of `buf`.
+ */
+size_t stats_get_metrics(struct cvstr *buf)
+{
+    extern struct cmd_item cmds[];
+    extern const size_t CMD_NUM;
+    struct stats stats;
+    struct memory_stats mstats;
+    size_t len = 0;
+
+    memset(&stats, 0, sizeof(stats));
+    memset(&mstats, 0, sizeof(mstats));
+    stats_get_simple(&stats, false);
+    stats_get_memory(&mstats);
+
+    buf->data[0] = '\0';
+
+    METRIC("connected_clients", "gauge", "%lld", stats.basic.connected_clients);
+    METRIC("completed_commands_total", "counter", "%lld", stats.basic.completed_commands);
+    METRIC("slot_update_jobs_total", "counter", "%lld", stats.basic.slot_update_jobs);
+    METRIC("slot_update_seconds_total", "counter", "%.6f", stats.slot_update_usec / 1000000.0);
+    METRIC("slot_update_last_seconds", "gauge", "%.6f", stats.slot_update_last_usec / 1000000.0);
+    METRIC("recv_bytes_total", "counter", "%lld", stats.basic.recv_bytes);
+    METRIC("send_bytes_total", "counter", "%lld", stats.basic.send_bytes);
+    METRIC("remote_latency_seconds_total", "counter", "%.9f",
+            stats.basic.remote_latency / 1000000000.0);
+    METRIC("total_latency_seconds_total", "counter", "%.9f",
+            stats.basic.total_latency / 1000000000.0);
+    METRIC("ask_recv_total", "counter", "%lld", stats.basic.ask_recv);
+    METRIC("moved_recv_total", "counter", "%lld", stats.basic.moved_recv);
+    METRIC("ask_cache_hits_total", "counter", "%lld", stats.basic.ask_cache_hits);
+    METRIC("ask_cache_misses_total", "counter", "%lld", stats.basic.ask_cache_misses);
+    METRIC("spliced_replies_total", "counter", "%lld", stats.basic.spliced_replies);
+    METRIC("spliced_bytes_total", "counter", "%lld", stats.basic.spliced_bytes);
+    METRIC("used_cpu_sys_seconds_total", "counter", "%.6f", stats.used_cpu_sys);
+    METRIC("used_cpu_user_seconds_total", "counter", "%.6f", stats.used_cpu_user);
+
+    METRIC("in_use_buffers", "gauge", "%lld", mstats.buffers);
+    METRIC("free_buffers", "gauge", "%lld", mstats.free_buffers);
+    METRIC("in_use_cmds", "gauge", "%lld", mstats.cmds);
+    METRIC("free_cmds", "gauge", "%lld", mstats.free_cmds);
+    METRIC("in_use_conns", "gauge", "%lld", mstats.conns);
+    METRIC("free_conns", "gauge", "%lld", mstats.free_conns);
+    METRIC("in_use_conn_info", "gauge", "%lld", mstats.conn_info);
+    METRIC("free_conn_info", "gauge", "%lld", mstats.free_conn_info);
+    METRIC("in_use_buf_times", "gauge", "%lld", mstats.buf_times);
+    METRIC("free_buf_times", "gauge", "%lld", mstats.free_buf_times);
+
+    METRIC("arena_chunks", "gauge", "%lld", mstats.arena_chunks);
+    METRIC("arena_huge_chunks", "gauge", "%lld", mstats.arena_huge_chunks);
+
+    METRIC_TYPE("class_buffers", "gauge");
+    for (int i = 0; i < MBUF_CLASSES; i++) {
+        uint32_t size = mbuf_class_size(&get_contexts()[0], i);
+        cvstr_printf(buf, &len, "corvus_class_buffers{size=\"%u\",state=\"in_use\"} %lld\n",
+                size, mstats.class_buffers[i]);
+        cvstr_printf(buf, &len, "corvus_class_buffers{size=\"%u\",state=\"free\"} %lld\n",
+                size, mstats.free_class_buffers[i]);
+    }
+
+    struct dict nodes;
+    struct bytes *b;
+    dict_init(&nodes);
+    stats_node_info_agg(&nodes);
+
+    const char *node_metrics[] = {
+        "node_send_bytes_total",
+        "node_recv_bytes_total",
+        "node_completed_commands_total",
+    };
+    for (int i = 0; i < 3; i++) {
+        METRIC_TYPE(node_metrics[i], "counter");
+        struct dict_iter iter = DICT_ITER_INITIALIZER;
+        DICT_FOREACH(&nodes, &iter) {
+            b = (struct bytes*)iter.value;
+            cvstr_printf(buf, &len, "corvus_%s{node=\"%s\"} %lld\n", node_metrics[i],
+                    iter.key, i == 0 ? b->send : i == 1 ? b->recv : b->completed);
+        }
+    }
+
+    struct dict_iter iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&nodes, &iter) {
+        cv_free(iter.value);
+    }
+    dict_free(&nodes);
+
+    // slow commands
+    struct dict slow;
+    uint32_t sum[CMD_NUM];
+    dict_init(&slow);
+    memset(sum, 0, sizeof(sum));
+    slowlog_get_counts(get_contexts(), &slow, sum);
+
+    METRIC_TYPE("slow_queries_total", "counter");
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        if (sum[i] == 0) continue;
+        cvstr_printf(buf, &len, "corvus_slow_queries_total{command=\"%s\"} %u\n",
+                cmds[i].cmd, sum[i]);
+    }
+
+    METRIC_TYPE("node_slow_queries_total", "counter");
+    struct dict_iter slow_iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&slow, &slow_iter) {
+        uint32_t *counts = (uint32_t*)slow_iter.value;
+        for (size_t i = 0; i < CMD_NUM; i++) {
+            if (counts[i] == 0) continue;
+            cvstr_printf(buf, &len,
+                    "corvus_node_slow_queries_total{node=\"%s\",command=\"%s\"} %u\n",
+                    slow_iter.key, cmds[i].cmd, counts[i]);
+        }
+        cv_free(counts);
+    }
+    dict_free(&slow);
+
+    // estimated operations of the hottest keys in the decay window
+    struct hotkey_entry top[HOTKEY_EXPORT];
+    int count = 0;
+    if (ATOMIC_GET(config.hotkey_sample_rate) > 0) {
+        count = hotkey_get_top(get_contexts(), top, HOTKEY_EXPORT);
+    }
+
+    METRIC_TYPE("hotkey_ops", "gauge");
+    for (int i = 0; i < count; i++) {
+        int n = MIN(top[i].len, HOTKEY_KEY_LEN);
+        char key[n * 3 + 64];
+        int k = stats_escape_key(key, top[i].key, n);
+        // keys are merged by hash, which keeps truncated ones apart
+        if (top[i].len > n) {
+            snprintf(key + k, 64, "...(len=%d,hash=%016" PRIx64 ")", top[i].len, top[i].hash);
+        }
+        cvstr_printf(buf, &len, "corvus_hotkey_ops{key=\"%s\"} %u\n", key, top[i].count);
+    }
+
+    // largest requests and replies since startup
+    struct bigkey_entry big[BIGKEY_EXPORT];
+    count = bigkey_get_top(get_contexts(), big, BIGKEY_EXPORT);
+
+    METRIC_TYPE("bigkey_bytes", "gauge");
+    for (int i = 0; i < count; i++) {
+        int n = MIN(big[i].len, BIGKEY_KEY_LEN);
+        char key[n * 3 + 32];
+        int k = stats_escape_key(key, big[i].key, n);
+        // keys are merged by their first bytes and length
+        if (big[i].len > n) {
+            snprintf(key + k, 32, "...(len=%d)", big[i].len);
+        }
+        cvstr_printf(buf, &len, "corvus_bigkey_bytes{kind=\"%s\",command=\"%s\","
+                "key=\"%s\",node=\"%s\"} %u\n",
+                big[i].kind == BIGKEY_REQUEST ? "request" : "reply",
+                cmds[big[i].cmd_type].cmd, key, big[i].node, big[i].bytes);
+    }
+
+    // size percentiles, quantile 1 is the max
+    const char *size_metrics[] = {"request_size_bytes", "reply_size_bytes"};
+    struct histogram h;
+    for (int k = 0; k < 2; k++) {
+        METRIC_TYPE(size_metrics[k], "gauge");
+        for (size_t i = 0; i < CMD_NUM; i++) {
+            if (!stats_merge_cmd_hist(&h, i, k == 0 ? HIST_REQUEST_SIZE : HIST_REPLY_SIZE)
+                    || hist_count(&h) == 0)
+            {
+                continue;
+            }
+            const char *fmt = "corvus_%s{command=\"%s\",quantile=\"%s\"} %" PRId64 "\n";
+            cvstr_printf(buf, &len, fmt, size_metrics[k], cmds[i].cmd, "0.5",
+                    hist_percentile(&h, 50));
+            cvstr_printf(buf, &len, fmt, size_metrics[k], cmds[i].cmd, "0.99",
+                    hist_percentile(&h, 99));
+            cvstr_printf(buf, &len, fmt, size_metrics[k], cmds[i].cmd, "0.999",
+                    hist_percentile(&h, 99.9));
+            cvstr_printf(buf, &len, fmt, size_metrics[k], cmds[i].cmd, "1",
+                    hist_max(&h));
+        }
+    }
+
+    return len;
+}
+
+static void stats_send_hist(const char *prefix, struct histogram *h)
+{
+    int len = HOST_LEN + 64;
+    char name[len];
+
+    if (hist_count(h) == 0) return;
+
+    // milliseconds, same as `latency`
+    snprintf(name, len, "%s.latency.p50", prefix);
+    stats_send(name, hist_percentile(h, 50) / 1000.0);
+    snprintf(name, len, "%s.latency.p99", prefix);
+    stats_send(name, hist_percentile(h, 99) / 1000.0);
+    snprintf(name, len, "%s.latency.p999", prefix);
+    stats_send(name, hist_percentile(h, 99.9) / 1000.0);
+}
+
+static void stats_send_latency()
+{
+    extern struct cmd_item cmds[];
+    extern const size_t CMD_NUM;
+    struct histogram h, *last;
+    int len = HOST_LEN + 64;
+    char name[len];
+
+    /* command.GET.latency.{p50,p99,p999} */
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        if (!stats_merge_cmd_hist(&h, i, HIST_TOTAL_LATENCY)) continue;
+
+        if (last_cmd_latency[i] == NULL) {
+            last_cmd_latency[i] = cv_calloc(1, sizeof(struct histogram));
+        }
+        last = last_cmd_latency[i];
+        hist_sub(&h, last);
+        hist_merge(last, &h);
+
+        snprintf(name, len, "command.%s", cmds[i].cmd);
+        stats_send_hist(name, &h);
+    }
+
+    /* redis-node.127-0-0-1-8000.latency.{p50,p99,p999} */
+    struct dict nodes;
+    dict_init(&nodes);
+    stats_merge_node_latency(&nodes);
+
+    struct dict_iter iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&nodes, &iter) {
+        struct histogram *cur = iter.value;
+
+        last = dict_get(&last_node_latency, iter.key);
+        if (last == NULL) {
+            last = cv_calloc(1, sizeof(struct histogram));
+            dict_set(&last_node_latency, iter.key, last);
+        }
+        hist_sub(cur, last);
+        hist_merge(last, cur);
+
+        char addr[ADDRESS_LEN + 1];
+        stats_node_name(addr, iter.key);
+        snprintf(name, len, "redis-node.%s", addr);
+        stats_send_hist(name, cur);
+        cv_free(cur);
+    }
+    dict_free(&nodes);
+}
+
 static void stats_send_slow_log()
 {
     if (!slowlog_statsd_enabled())
@@ -269,12 +851,8 @@ static void stats_send_slow_log()
         const char *dsn = iter.key;
         uint32_t *counts = (uint32_t*)iter.value;
 
-        char addr[ADDRESS_LEN] = {0};
-        strncpy(addr, dsn, ADDRESS_LEN);
-        for (size_t i = 0; i < ADDRESS_LEN; i++) {
-            if (addr[i] == '.' || addr[i] == ':')
-                addr[i] = '-';
-        }
+        char addr[ADDRESS_LEN + 1];
+        stats_node_name(addr, dsn);
 
         for (size_t i = 0; i < CMD_NUM; i++) {
             if(counts[i] == 0) continue;
@@ -299,6 +877,29 @@ static void stats_send_slow_log()
     }
 }
 
+static void stats_send_hotkeys()
+{
+    struct hotkey_entry top[HOTKEY_EXPORT];
+    char key[HOTKEY_KEY_LEN + 1];
+    int len = HOTKEY_KEY_LEN + 64;
+    char name[len];
+
+    if (ATOMIC_GET(config.hotkey_sample_rate) <= 0) return;
+
+    /* hotkey.<key>, with characters other than [0-9A-Za-z_-] replaced */
+    int count = hotkey_get_top(get_contexts(), top, HOTKEY_EXPORT);
+    for (int i = 0; i < count; i++) {
+        int n = MIN(top[i].len, HOTKEY_KEY_LEN);
+        for (int j = 0; j < n; j++) {
+            char c = top[i].key[j];
+            key[j] = (isalnum((unsigned char)c) || c == '_' || c == '-') ? c : '_';
+        }
+        key[n] = '\0';
+        snprintf(name, len, "hotkey.%s", key);
+        stats_send(name, top[i].count);
+    }
+}
+
 void *stats_daemon(void *data)
 {
     /* Make the thread killable at any time can work reliably. */
@@ -310,6 +911,8 @@ void *stats_daemon(void *data)
         stats_send_simple();
         stats_send_node_info();
         stats_send_slow_log();
+        stats_send_latency();
+        stats_send_hotkeys();
         LOG(DEBUG, "sending metrics");
     }
     return NULL;
@@ -320,7 +923,7 @@ int stats_init()
     int len;
     dict_init(&bytes_map);
 
-    memset(&cumulation, 0, sizeof(cumulation));
+    memset(&last_sent, 0, sizeof(last_sent));
     memset(&used_cpu, 0, sizeof(used_cpu));
 
     gethostname(hostname, HOST_LEN + 1);
@@ -336,6 +939,10 @@ int stats_init()
 
     slowlog_init_stats();
 
+    extern const size_t CMD_NUM;
+    last_cmd_latency = cv_calloc(CMD_NUM, sizeof(struct histogram*));
+    dict_init(&last_node_latency);
+
     LOG(INFO, "starting stats thread");
     return thread_spawn(&stats_ctx, stats_daemon);
 }
@@ -344,15 +951,32 @@ void stats_kill()
 {
     int err;
 
-    dict_free(&bytes_map);
-    slowlog_free_stats();
-
     if (pthread_cancel(stats_ctx.thread) == 0) {
         if ((err = pthread_join(stats_ctx.thread, NULL)) != 0) {
             LOG(WARN, "fail to kill stats thread: %s", strerror(err));
         }
     }
     LOG(DEBUG, "killing stats thread");
+
+    slowlog_free_stats();
+
+    struct dict_iter iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&bytes_map, &iter) {
+        cv_free(iter.value);
+    }
+    dict_free(&bytes_map);
+
+    extern const size_t CMD_NUM;
+    for (size_t i = 0; i < CMD_NUM; i++) {
+        cv_free(last_cmd_latency[i]);
+    }
+    cv_free(last_cmd_latency);
+
+    struct dict_iter latency_iter = DICT_ITER_INITIALIZER;
+    DICT_FOREACH(&last_node_latency, &latency_iter) {
+        cv_free(latency_iter.value);
+    }
+    dict_free(&last_node_latency);
 }
 
 int stats_resolve_addr(char *addr)
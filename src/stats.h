@@ -1,9 +1,12 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <stdbool.h>
 #include <sys/types.h>
 #include "socket.h"
+#include "mbuf.h"
 #include "slot.h"
+#include "histogram.h"
 
 struct memory_stats {
     long long buffers;
@@ -17,6 +20,14 @@ struct memory_stats {
     long long free_conns;
     long long free_conn_info;
     long long free_buf_times;
+
+    // buffers of each size class
+    long long class_buffers[MBUF_CLASSES];
+    long long free_class_buffers[MBUF_CLASSES];
+
+    // huge pages reserved by buffer arenas
+    long long arena_chunks;
+    long long arena_huge_chunks;
 };
 
 struct basic_stats {
@@ -31,14 +42,88 @@ struct basic_stats {
 
     long long ask_recv;
     long long moved_recv;
+    long long ask_cache_hits;
+    long long ask_cache_misses;
+    long long spliced_replies;
+    long long spliced_bytes;
 };
 
+#define STATS_CACHE_LINE 64
+
+/*
+ * Counters of a worker thread. Only the owner thread writes them, with
+ * plain relaxed stores instead of locked instructions. They are padded to
+ * cache lines of their own, so readers don't steal the lines of other
+ * fields of the context from the owner. Fields updated together for a
+ * command are written inside `stats_write_begin` / `stats_write_end`,
+ * `stats_snapshot` retries until it reads them consistently.
+ */
+struct thread_stats {
+    char head_pad[STATS_CACHE_LINE];
+    unsigned seq;
+    struct basic_stats basic;
+    long long last_command_latency;
+    char tail_pad[STATS_CACHE_LINE];
+};
+
+#define STATS_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+// only for counters with a single writer
+#define STATS_INCR(field, n) \
+    __atomic_store_n(&(field), STATS_GET(field) + (n), __ATOMIC_RELAXED)
+
+#define STATS_SET(field, value) \
+    __atomic_store_n(&(field), value, __ATOMIC_RELAXED)
+
+/*
+ * Sequence lock of data with a single writer. Readers copy the data
+ * between `seq_read_begin` and `seq_read_retry` and retry if the writer
+ * changed it meanwhile. The writer never waits for readers.
+ */
+static inline void seq_write_begin(unsigned *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(unsigned *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned seq_read_begin(unsigned *seq)
+{
+    unsigned start;
+    while ((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1);
+    return start;
+}
+
+static inline bool seq_read_retry(unsigned *seq, unsigned start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return start != __atomic_load_n(seq, __ATOMIC_RELAXED);
+}
+
+static inline void stats_write_begin(struct thread_stats *s)
+{
+    seq_write_begin(&s->seq);
+}
+
+static inline void stats_write_end(struct thread_stats *s)
+{
+    seq_write_end(&s->seq);
+}
+
 struct stats {
     double used_cpu_sys;
     double used_cpu_user;
 
-    long long last_command_latency[MAX_NODE_LIST];
-    char remote_nodes[MAX_NODE_LIST * ADDRESS_LEN];
+    // time spent updating slot map, in microseconds
+    long long slot_update_usec;
+    long long slot_update_last_usec;
+
+    long long *last_command_latency;  // one per thread
+    char *remote_nodes;
 
     struct basic_stats basic;
 };
@@ -47,8 +132,22 @@ int stats_init();
 void stats_kill();
 int stats_resolve_addr(char *addr);
 void stats_get(struct stats *stats);
+void stats_free(struct stats *stats);
 void stats_get_memory(struct memory_stats *stats);
 
 void incr_slot_update_counter();
+void stats_record_slot_update(long long usec);
+void stats_snapshot(struct thread_stats *s, struct basic_stats *basic,
+        long long *last_command_latency);
+
+struct command;
+struct context;
+struct cvstr;
+void stats_record_latency(struct command *cmd, int64_t total_latency);
+size_t stats_get_latency(struct cvstr *info);
+void stats_record_size(struct context *ctx, int type, uint32_t req_bytes, uint32_t rep_bytes);
+size_t stats_get_sizes(struct cvstr *info);
+size_t stats_get_slotstats(struct cvstr *buf);
+size_t stats_get_metrics(struct cvstr *buf);
 
 #endif /* end of include guard: STATS_H */
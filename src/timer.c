@@ -10,6 +10,7 @@
 #include "client.h"
 #include "server.h"
 #include "timer.h"
+#include "metrics.h"
 
 bool conn_active(struct context *ctx)
 {
@@ -27,6 +28,9 @@ void check_context(struct context *ctx)
             config.client_timeout = 5;
             event_deregister(&ctx->loop, &ctx->proxy);
             conn_free(&ctx->proxy);
+            conn_free(&ctx->unix_proxy);
+            conn_free(&ctx->metrics);
+            metrics_close_all(ctx);
             ctx->state = CTX_QUITTING;
         case CTX_QUITTING:
             LOG(DEBUG, "do quit");
@@ -96,6 +100,9 @@ void timer_ready(struct connection *self, uint32_t mask)
         if (config.client_timeout > 0 || config.server_timeout > 0) {
             check_connections(self->ctx);
         }
+        metrics_check_timeout(self->ctx);
+        hotkey_decay(&self->ctx->hotkeys, time(NULL));
+        slotstats_decay(&self->ctx->slotstats, time(NULL));
         check_context(self->ctx);
     }
 }
@@ -67,6 +67,12 @@ extern TEST_CASE(test_config);
 extern TEST_CASE(test_stats);
 extern TEST_CASE(test_mbuf);
 extern TEST_CASE(test_slowlog);
+extern TEST_CASE(test_histogram);
+extern TEST_CASE(test_hotkey);
+extern TEST_CASE(test_bigkey);
+extern TEST_CASE(test_slotstats);
+extern TEST_CASE(test_askcache);
+extern TEST_CASE(test_arena);
 
 int main(int argc, const char *argv[])
 {
@@ -102,6 +108,12 @@ int main(int argc, const char *argv[])
     RUN_CASE(test_stats);
     RUN_CASE(test_mbuf);
     RUN_CASE(test_slowlog);
+    RUN_CASE(test_histogram);
+    RUN_CASE(test_hotkey);
+    RUN_CASE(test_bigkey);
+    RUN_CASE(test_slotstats);
+    RUN_CASE(test_askcache);
+    RUN_CASE(test_arena);
 
     usleep(10000);
     slot_create_job(SLOT_UPDATER_QUIT);
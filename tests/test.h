@@ -9,6 +9,7 @@
 #include "logging.h"
 #include "event.h"
 #include "corvus.h"
+#include "alloc.h"
 
 #define MSG_LEN 1024
 
@@ -198,4 +199,76 @@ struct context;
 extern void context_init(struct context *ctx);
 extern void context_free(struct context *ctx);
 
+/* `data` laid out in two linked buffers */
+struct test_bufs {
+    struct mhdr queue;
+    struct mbuf bufs[2];
+};
+
+static void test_bufs_init(struct test_bufs *t, char *data, int split)
+{
+    int len = strlen(data);
+    if (split > len) split = len;
+
+    TAILQ_INIT(&t->queue);
+    memset(t->bufs, 0, sizeof(t->bufs));
+    t->bufs[0].start = t->bufs[0].pos = (uint8_t*)data;
+    t->bufs[0].last = t->bufs[0].end = (uint8_t*)data + split;
+    t->bufs[1].start = t->bufs[1].pos = (uint8_t*)data + split;
+    t->bufs[1].last = t->bufs[1].end = (uint8_t*)data + len;
+    TAILQ_INSERT_TAIL(&t->queue, &t->bufs[0], next);
+    TAILQ_INSERT_TAIL(&t->queue, &t->bufs[1], next);
+}
+
+static void test_bufs_range(struct test_bufs *t, struct buf_ptr range[], int start, int end)
+{
+    int split = t->bufs[0].end - t->bufs[0].start;
+
+    range[0].buf = start < split ? &t->bufs[0] : &t->bufs[1];
+    range[0].pos = t->bufs[0].start + start;
+    range[1].buf = end <= split ? &t->bufs[0] : &t->bufs[1];
+    range[1].pos = t->bufs[0].start + end;
+}
+
+/*
+ * GET `key` formatted in `data` and split in two buffers, `req_buf` and
+ * `key_buf` of `cmd` point to it. Clear both before freeing `cmd`.
+ */
+static int test_get_req(struct test_bufs *t, char *data, size_t size,
+        struct command *cmd, const char *key)
+{
+    int n = snprintf(data, size, "*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n", strlen(key), key);
+    test_bufs_init(t, data, 16);
+    test_bufs_range(t, cmd->req_buf, 0, n);
+    test_bufs_range(t, cmd->key_buf, 13, n);
+    return n;
+}
+
+/* contexts of `n` worker threads, config.thread is restored on free */
+struct test_contexts {
+    struct context *ctxs;
+    int n;
+    int thread;
+};
+
+static void test_contexts_init(struct test_contexts *t, int n)
+{
+    t->ctxs = cv_calloc(n, sizeof(struct context));
+    t->n = n;
+    t->thread = config.thread;
+    config.thread = n;
+    for (int i = 0; i < n; i++) {
+        context_init(&t->ctxs[i]);
+    }
+}
+
+static void test_contexts_free(struct test_contexts *t)
+{
+    for (int i = 0; i < t->n; i++) {
+        context_free(&t->ctxs[i]);
+    }
+    cv_free(t->ctxs);
+    config.thread = t->thread;
+}
+
 #endif
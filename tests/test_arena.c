@@ -0,0 +1,72 @@
+#include <string.h>
+#include "test.h"
+#include "corvus.h"
+#include "arena.h"
+
+TEST(test_arena_alloc) {
+    struct arena arena;
+    struct arena_chunk *chunk, *first = NULL;
+    uint32_t sizes[MBUF_CLASSES] = {512, 4096, 16384, 1 << 20};
+    void *bufs[5];
+
+    arena_init(&arena, false, sizes);
+    ASSERT(arena_alloc(&arena, MBUF_SMALL, &chunk) == NULL);
+
+    arena_init(&arena, true, sizes);
+    for (int i = 0; i < 5; i++) {
+        bufs[i] = arena_alloc(&arena, MBUF_LARGE, &chunk);
+        ASSERT(bufs[i] != NULL);
+        if (i == 0) first = chunk;
+        ASSERT(((uintptr_t)bufs[i] & ((1 << 20) - 1)) == 0);
+        memset(bufs[i], i, sizes[MBUF_LARGE]);
+    }
+    // two buffers per chunk
+    ASSERT(arena.nchunks == 3);
+    ASSERT(first->used == 2);
+
+    // freed buffers are reused first
+    arena_free(&arena, MBUF_LARGE, first, bufs[1]);
+    ASSERT(arena_alloc(&arena, MBUF_LARGE, &chunk) == bufs[1]);
+    ASSERT(chunk == first);
+
+    // empty chunks are unmapped beyond ARENA_FREE_CHUNKS
+    for (int i = 0; i < 5; i++) {
+        chunk = TAILQ_FIRST(&arena.chunks[MBUF_LARGE]);
+        while (chunk != NULL) {
+            uint8_t *b = bufs[i];
+            if (b >= chunk->base && b < chunk->base + ARENA_CHUNK_SIZE) break;
+            chunk = TAILQ_NEXT(chunk, next);
+        }
+        ASSERT(chunk != NULL);
+        arena_free(&arena, MBUF_LARGE, chunk, bufs[i]);
+    }
+    ASSERT(arena.nchunks == ARENA_FREE_CHUNKS);
+
+    arena_destroy(&arena);
+    ASSERT(arena.nchunks == 0 && arena.huge_chunks == 0);
+    PASS(NULL);
+}
+
+TEST(test_arena_mbuf) {
+    arena_destroy(&ctx->arena);
+    arena_init(&ctx->arena, true, ctx->mbuf_sizes);
+
+    struct mbuf *buf = mbuf_get_size(ctx, 30);
+    ASSERT(buf->chunk != NULL);
+    ASSERT(buf->size_class == MBUF_SMALL);
+    ASSERT(mbuf_write_size(buf) == ctx->mbuf_sizes[MBUF_SMALL] - sizeof(struct mbuf));
+    ASSERT(ctx->arena.nchunks == 1);
+
+    // back to the arena rather than the free queue
+    mbuf_recycle(ctx, buf);
+    ASSERT(ctx->mstats.free_buffers == 0);
+    ASSERT(TAILQ_EMPTY(&ctx->free_mbufq[MBUF_SMALL]));
+    ASSERT(mbuf_get_size(ctx, 30) == buf);
+    mbuf_recycle(ctx, buf);
+    PASS(NULL);
+}
+
+TEST_CASE(test_arena) {
+    RUN_TEST(test_arena_alloc);
+    RUN_TEST(test_arena_mbuf);
+}
@@ -0,0 +1,79 @@
+#include <string.h>
+#include "test.h"
+#include "corvus.h"
+#include "askcache.h"
+
+TEST(test_askcache_get) {
+    char d1[256], d2[256];
+    struct test_bufs r1, r2;
+    struct address addr;
+    struct command *c1 = cmd_create(ctx), *c2 = cmd_create(ctx);
+
+    test_get_req(&r1, d1, sizeof(d1), c1, "moved");
+    test_get_req(&r2, d2, sizeof(d2), c2, "other");
+    c1->slot = c2->slot = 100;
+
+    ASSERT(!askcache_get(&ctx->askcache, c1, &addr));
+    askcache_set(&ctx->askcache, c1, "127.0.0.1:8001");
+    ASSERT(askcache_get(&ctx->askcache, c1, &addr));
+    ASSERT(strcmp(addr.ip, "127.0.0.1") == 0 && addr.port == 8001);
+
+    // other keys of the slot are still sent to the migrating node
+    ASSERT(!askcache_get(&ctx->askcache, c2, &addr));
+    c2->slot = 101;
+    askcache_set(&ctx->askcache, c2, "127.0.0.1:8002");
+    ASSERT(askcache_get(&ctx->askcache, c2, &addr) && addr.port == 8002);
+    c2->slot = 100;
+    ASSERT(!askcache_get(&ctx->askcache, c2, &addr));
+
+    askcache_del(&ctx->askcache, c1);
+    ASSERT(!askcache_get(&ctx->askcache, c1, &addr));
+
+    // expired
+    askcache_set(&ctx->askcache, c1, "127.0.0.1:8001");
+    ctx->askcache.slot_expire[100] = time(NULL) - 1;
+    ASSERT(!askcache_get(&ctx->askcache, c1, &addr));
+    ASSERT(ctx->askcache.slot_expire[100] == 0);
+
+    askcache_set(&ctx->askcache, c1, "bad addr");
+    ASSERT(!askcache_get(&ctx->askcache, c1, &addr));
+
+    // a bad address keeps the entry already in the bucket
+    askcache_set(&ctx->askcache, c1, "127.0.0.1:8001");
+    askcache_set(&ctx->askcache, c1, "bad addr");
+    ASSERT(askcache_get(&ctx->askcache, c1, &addr) && addr.port == 8001);
+
+    memset(c1->req_buf, 0, sizeof(c1->req_buf));
+    memset(c1->key_buf, 0, sizeof(c1->key_buf));
+    memset(c2->req_buf, 0, sizeof(c2->req_buf));
+    memset(c2->key_buf, 0, sizeof(c2->key_buf));
+    cmd_free(c1);
+    cmd_free(c2);
+    PASS(NULL);
+}
+
+TEST(test_askcache_long_key) {
+    char data[256];
+    struct test_bufs r;
+    struct address addr;
+    char key[ASKCACHE_KEY_LEN + 2];
+    struct command *cmd = cmd_create(ctx);
+
+    memset(key, 'a', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    test_get_req(&r, data, sizeof(data), cmd, key);
+    cmd->slot = 1;
+
+    askcache_set(&ctx->askcache, cmd, "127.0.0.1:8001");
+    ASSERT(!askcache_get(&ctx->askcache, cmd, &addr));
+
+    memset(cmd->req_buf, 0, sizeof(cmd->req_buf));
+    memset(cmd->key_buf, 0, sizeof(cmd->key_buf));
+    cmd_free(cmd);
+    PASS(NULL);
+}
+
+TEST_CASE(test_askcache) {
+    RUN_TEST(test_askcache_get);
+    RUN_TEST(test_askcache_long_key);
+}
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "test.h"
+#include "corvus.h"
+#include "bigkey.h"
+
+static void record(struct context *ctx, char *key, int rep_bytes, int rep_elements)
+{
+    char req[256], rep[rep_bytes + 1];
+    struct test_bufs reqs, reps;
+    struct command *cmd = cmd_create(ctx);
+
+    test_get_req(&reqs, req, sizeof(req), cmd, key);
+
+    memset(rep, 'x', rep_bytes);
+    rep[rep_bytes] = '\0';
+    test_bufs_init(&reps, rep, rep_bytes / 2);
+    test_bufs_range(&reps, cmd->rep_buf, 0, rep_bytes);
+
+    cmd->cmd_type = CMD_GET;
+    cmd->keys = 1;
+    cmd->reply_type = rep_elements > 0 ? REP_ARRAY : REP_STRING;
+    cmd->rep_elements = rep_elements;
+    bigkey_record(cmd, cmd_req_len(cmd), rep_bytes);
+
+    memset(cmd->req_buf, 0, sizeof(cmd->req_buf));
+    memset(cmd->rep_buf, 0, sizeof(cmd->rep_buf));
+    cmd_free(cmd);
+}
+
+TEST(test_cmd_copy_key) {
+    char req[] = "*2\r\n$3\r\nGET\r\n$11\r\nhello world\r\n";
+    char key[8];
+    struct test_bufs bufs;
+    struct command *cmd = cmd_create(ctx);
+
+    ASSERT(cmd_copy_key(cmd, key, 7) == -1);
+
+    // split in the middle of the key
+    test_bufs_init(&bufs, req, 22);
+    test_bufs_range(&bufs, cmd->key_buf, 13, strlen(req));
+    ASSERT(cmd_copy_key(cmd, key, 7) == 11);
+    ASSERT(strcmp(key, "hello w") == 0);
+
+    // split in the length line
+    test_bufs_init(&bufs, req, 15);
+    test_bufs_range(&bufs, cmd->key_buf, 13, strlen(req));
+    ASSERT(cmd_copy_key(cmd, key, 5) == 11);
+    ASSERT(strcmp(key, "hello") == 0);
+
+    memset(cmd->key_buf, 0, sizeof(cmd->key_buf));
+    cmd_free(cmd);
+    PASS(NULL);
+}
+
+TEST(test_bigkey_record) {
+    struct bigkey_entry top[BIGKEY_TOPN * 2];
+    char key[16];
+
+    bigkey_reset(ctx);
+
+    record(ctx, "small", 10, 0);
+    record(ctx, "list", 300, 20);
+    record(ctx, "list", 200, 10);
+
+    int n = bigkey_get_top(ctx, top, BIGKEY_TOPN * 2);
+    ASSERT(n == 4);
+    ASSERT(top[0].kind == BIGKEY_REPLY);
+    ASSERT(strcmp(top[0].key, "list") == 0);
+    ASSERT(top[0].len == 4);
+    ASSERT(top[0].bytes == 300);
+    ASSERT(top[0].elements == 20);
+    ASSERT(top[0].cmd_type == CMD_GET);
+    ASSERT(top[1].kind == BIGKEY_REQUEST);
+    ASSERT(top[1].bytes == strlen("*2\r\n$3\r\nGET\r\n$5\r\nsmall\r\n"));
+    ASSERT(top[1].elements == 2);
+    ASSERT(top[3].kind == BIGKEY_REPLY);
+    ASSERT(strcmp(top[3].key, "small") == 0);
+    ASSERT(top[3].elements == 1);
+
+    // only the largest keys are kept
+    for (int i = 0; i < BIGKEY_TOPN * 2; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        record(ctx, key, 100 + i, 0);
+    }
+    ASSERT(ctx->bigkeys.lists[BIGKEY_REPLY].len == BIGKEY_TOPN);
+    ASSERT(ctx->bigkeys.lists[BIGKEY_REPLY].min == 100 + BIGKEY_TOPN + 1);
+    ASSERT(bigkey_get_top(ctx, top, 2) == 2);
+    ASSERT(strcmp(top[0].key, "list") == 0);
+    ASSERT(top[1].bytes == 100 + BIGKEY_TOPN * 2 - 1);
+
+    bigkey_reset(ctx);
+    ASSERT(bigkey_get_top(ctx, top, 2) == 0);
+    // the lists are cleared by the owner thread on its next record
+    record(ctx, "small", 10, 0);
+    ASSERT(ctx->bigkeys.lists[BIGKEY_REPLY].len == 1);
+    ASSERT(ctx->bigkeys.lists[BIGKEY_REPLY].min == 0);
+    ASSERT(bigkey_get_top(ctx, top, 2) == 2);
+    PASS(NULL);
+}
+
+TEST_CASE(test_bigkey) {
+    RUN_TEST(test_cmd_copy_key);
+    RUN_TEST(test_bigkey_record);
+}
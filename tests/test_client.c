@@ -1,3 +1,5 @@
+#include <sys/socket.h>
+#include <unistd.h>
 #include "test.h"
 #include "client.h"
 #include "socket.h"
@@ -5,6 +7,9 @@
 
 extern struct mbuf *client_get_buf(struct connection *client);
 extern void client_range_clear(struct connection *client, struct command *cmd);
+extern void client_trigger_event(struct connection *client);
+extern int client_write(struct connection *client);
+extern int cmd_parse_rep(struct command *cmd, struct mbuf *buf);
 
 TEST(test_client_create) {
     ASSERT(client_create(ctx, -1) == NULL);
@@ -28,7 +33,7 @@ TEST(test_client_range_clear1) {
     ASSERT(buf->refcount == 0);
     ASSERT(cmd->req_buf[0].buf == NULL);
     ASSERT(client->info->current_buf == buf);
-    ASSERT(TAILQ_EMPTY(&ctx->free_mbufq));
+    ASSERT(TAILQ_EMPTY(&ctx->free_mbufq[buf->size_class]));
 
     conn_free(client);
     conn_buf_free(client);
@@ -55,7 +60,7 @@ TEST(test_client_range_clear2) {
     ASSERT(buf->refcount == 0);
     ASSERT(cmd->req_buf[0].buf == NULL);
     ASSERT(client->info->current_buf == NULL);
-    ASSERT(TAILQ_FIRST(&ctx->free_mbufq) == buf);
+    ASSERT(TAILQ_FIRST(&ctx->free_mbufq[buf->size_class]) == buf);
 
     conn_free(client);
     conn_buf_free(client);
@@ -82,7 +87,7 @@ TEST(test_client_range_clear3) {
     ASSERT(buf->refcount == 1);
     ASSERT(cmd->req_buf[0].buf == NULL);
     ASSERT(client->info->current_buf == buf);
-    ASSERT(TAILQ_EMPTY(&ctx->free_mbufq));
+    ASSERT(TAILQ_EMPTY(&ctx->free_mbufq[buf->size_class]));
 
     conn_free(client);
     conn_buf_free(client);
@@ -91,9 +96,88 @@ TEST(test_client_range_clear3) {
     PASS(NULL);
 }
 
+TEST(test_client_ready_queue) {
+    int fd = socket_create_stream();
+    struct connection *client = client_create(ctx, fd);
+    struct mbuf *buf = client_get_buf(client);
+
+    // nothing left to parse
+    client_trigger_event(client);
+    ASSERT(TAILQ_EMPTY(&ctx->ready_conns));
+
+    buf->last += 1;
+    client_trigger_event(client);
+    client_trigger_event(client);
+    ASSERT(TAILQ_FIRST(&ctx->ready_conns) == client);
+    ASSERT(TAILQ_NEXT(client, ready_next) == NULL);
+    ASSERT(ctx->ready_count == 1);
+
+    conn_free(client);
+    ASSERT(TAILQ_EMPTY(&ctx->ready_conns));
+    ASSERT(ctx->ready_count == 0);
+
+    conn_buf_free(client);
+    conn_recycle(ctx, client);
+
+    PASS(NULL);
+}
+
+TEST(test_client_write_in_order) {
+    int fds[2];
+    char data[] = "+OK\r\n:2\r\n$1\r\nc\r\n", rep[64];
+    struct command *cmds[3];
+
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    struct connection *client = conn_create(ctx);
+    client->fd = fds[0];
+    client->info = conn_info_create(ctx);
+    struct connection *server = conn_create(ctx);
+    server->info = conn_info_create(ctx);
+
+    struct mbuf *buf = conn_get_buf(server, true, false);
+    memcpy(buf->last, data, strlen(data));
+    buf->last += strlen(data);
+
+    for (int i = 0; i < 3; i++) {
+        cmds[i] = conn_get_cmd(client);
+        cmds[i]->client = client;
+        cmds[i]->server = server;
+        cmds[i]->parse_done = true;
+        cmds[i]->cmd_count = 1;
+        ASSERT(cmd_parse_rep(cmds[i], buf) == CORVUS_OK);
+    }
+
+    // the first and third commands are answered by a fast server
+    cmds[0]->cmd_done_count = 1;
+    cmds[2]->cmd_done_count = 1;
+    ASSERT(client_write(client) == CORVUS_OK);
+    ASSERT(recv(fds[1], rep, sizeof(rep), MSG_DONTWAIT) == 5);
+    ASSERT(strncmp(rep, "+OK\r\n", 5) == 0);
+    ASSERT(STAILQ_FIRST(&client->info->cmd_queue) == cmds[1]);
+
+    // the slow one
+    cmds[1]->cmd_done_count = 1;
+    ASSERT(client_write(client) == CORVUS_OK);
+    ASSERT(recv(fds[1], rep, sizeof(rep), MSG_DONTWAIT) == 11);
+    ASSERT(strncmp(rep, ":2\r\n$1\r\nc\r\n", 11) == 0);
+    ASSERT(STAILQ_EMPTY(&client->info->cmd_queue));
+    ASSERT(TAILQ_EMPTY(&server->info->data));
+
+    close(fds[1]);
+    conn_free(client);
+    conn_buf_free(client);
+    conn_recycle(ctx, client);
+    conn_free(server);
+    conn_recycle(ctx, server);
+
+    PASS(NULL);
+}
+
 TEST_CASE(test_client) {
     RUN_TEST(test_client_create);
     RUN_TEST(test_client_range_clear1);
     RUN_TEST(test_client_range_clear2);
     RUN_TEST(test_client_range_clear3);
+    RUN_TEST(test_client_ready_queue);
+    RUN_TEST(test_client_write_in_order);
 }
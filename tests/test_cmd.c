@@ -1,12 +1,32 @@
+#include <ctype.h>
 #include "test.h"
 #include "parser.h"
 #include "corvus.h"
 #include "command.h"
 #include "logging.h"
+#include "alloc.h"
 
 extern int cmd_apply_range(struct command *cmd, int type);
 extern int cmd_parse_rep(struct command *cmd, struct mbuf *buf);
 extern void cmd_gen_mget_iovec(struct command *cmd, struct iov_data *iov);
+extern struct cmd_item *cmd_map_get(struct pos_array *pos);
+extern struct cmd_item cmds[];
+extern const size_t CMD_NUM;
+
+static struct cmd_item *map_get(const char *name, int split)
+{
+    int len = strlen(name);
+    struct pos items[2] = {
+        {(uint8_t*)name, split},
+        {(uint8_t*)name + split, len - split},
+    };
+    struct pos_array pos = {
+        .items = split > 0 ? items : items + 1,
+        .str_len = len,
+        .pos_len = split > 0 ? 2 : 1,
+    };
+    return cmd_map_get(&pos);
+}
 
 TEST(test_parse_redirect) {
     char data1[] = "-MOV";
@@ -156,6 +176,7 @@ TEST(test_cmd_gen_mget_iovec) {
     STAILQ_INSERT_TAIL(&c->sub_cmds, c3, sub_cmd_next);
 
     c->keys = 3;
+    c->client = conn;
     c1->server = c2->server = c3->server = conn;
 
     ASSERT(cmd_parse_rep(c1, buf) == 0);
@@ -175,6 +196,7 @@ TEST(test_cmd_gen_mget_iovec) {
     cmd_iov_clear(ctx, &iov);
 
     ASSERT(TAILQ_EMPTY(&conn->info->data));
+    ASSERT(TAILQ_EMPTY(&conn->info->local_data));
 
     cmd_iov_free(&iov);
     cmd_free(c);
@@ -239,6 +261,95 @@ TEST(test_cmd_gen_mget_iovec_fail) {
     PASS(NULL);
 }
 
+TEST(test_cmd_gen_mget_iovec_grouped) {
+    char data1[] = "*2\r\n$1\r\na";
+    char data2[] = "\r\n$-1\r\n$1\r\nb\r\n";
+
+    struct command *c  = cmd_create(ctx),
+                   *c1 = cmd_create(ctx),
+                   *c2 = cmd_create(ctx);
+
+    struct connection *conn = conn_create(ctx);
+    conn->info = conn_info_create(ctx);
+
+    // keys 0 and 2 share a slot, key 1 is sent alone
+    c->keys = 3;
+    c->client = conn;
+    c->key_array = cv_calloc(3, sizeof(struct cmd_key));
+    c->key_array[0].next = &c->key_array[2];
+    c1->key_list = &c->key_array[0];
+    c1->key_count = 2;
+    c2->key_list = &c->key_array[1];
+    c2->key_count = 1;
+
+    STAILQ_INSERT_TAIL(&c->sub_cmds, c1, sub_cmd_next);
+    STAILQ_INSERT_TAIL(&c->sub_cmds, c2, sub_cmd_next);
+    c1->server = c2->server = conn;
+
+    struct mbuf *buf1 = conn_get_buf(conn, true, false);
+    memcpy(buf1->last, data1, strlen(data1));
+    buf1->last += strlen(data1);
+    buf1->end = buf1->last;
+    ASSERT(cmd_parse_rep(c1, buf1) == 0);
+
+    struct mbuf *buf2 = conn_get_buf(conn, true, false);
+    ASSERT(buf2 != buf1);
+    memcpy(buf2->last, data2, strlen(data2));
+    buf2->last += strlen(data2);
+    ASSERT(cmd_parse_rep(c1, buf2) == 0);
+    ASSERT(cmd_parse_rep(c2, buf2) == 0);
+
+    struct iov_data iov;
+    memset(&iov, 0, sizeof(iov));
+
+    cmd_gen_mget_iovec(c, &iov);
+
+    ASSERT(iov.len == 5);
+    ASSERT(strncmp(iov.data[0].iov_base, "*3\r\n", iov.data[0].iov_len) == 0);
+    ASSERT(strncmp(iov.data[1].iov_base, "$1\r\na", iov.data[1].iov_len) == 0);
+    ASSERT(strncmp(iov.data[2].iov_base, "\r\n", iov.data[2].iov_len) == 0);
+    ASSERT(strncmp(iov.data[3].iov_base, "$1\r\nb\r\n", iov.data[3].iov_len) == 0);
+    ASSERT(strncmp(iov.data[4].iov_base, "$-1\r\n", iov.data[4].iov_len) == 0);
+    cmd_iov_clear(ctx, &iov);
+
+    ASSERT(TAILQ_EMPTY(&conn->info->data));
+    ASSERT(TAILQ_EMPTY(&conn->info->local_data));
+
+    cmd_iov_free(&iov);
+    cmd_free(c);
+
+    conn_free(conn);
+    conn_recycle(ctx, conn);
+
+    PASS(NULL);
+}
+
+TEST(test_cmd_map_get) {
+    size_t i, j;
+    char name[32];
+
+    cmd_map_init();
+
+    for (i = 0; i < CMD_NUM; i++) {
+        for (j = 0; cmds[i].cmd[j] != '\0'; j++) {
+            name[j] = j % 2 ? tolower(cmds[i].cmd[j]) : cmds[i].cmd[j];
+        }
+        name[j] = '\0';
+        ASSERT(map_get(cmds[i].cmd, 0) == &cmds[i]);
+        ASSERT(map_get(name, 0) == &cmds[i]);
+        ASSERT(map_get(name, 1) == &cmds[i]);
+    }
+
+    ASSERT(map_get("GETT", 0) == NULL);
+    ASSERT(map_get("GE", 0) == NULL);
+    ASSERT(map_get("G", 0) == NULL);
+    ASSERT(map_get("", 0) == NULL);
+    ASSERT(map_get("G@T", 0) == NULL);
+    ASSERT(map_get("zremrangebylexx", 0) == NULL);
+    ASSERT(map_get("zremrangebylexzremrangebylexzremrangebylex", 0) == NULL);
+    PASS(NULL);
+}
+
 TEST_CASE(test_cmd) {
     RUN_TEST(test_parse_redirect);
     RUN_TEST(test_parse_redirect_wrong_error);
@@ -246,4 +357,6 @@ TEST_CASE(test_cmd) {
     RUN_TEST(test_cmd_iov_add);
     RUN_TEST(test_cmd_gen_mget_iovec);
     RUN_TEST(test_cmd_gen_mget_iovec_fail);
+    RUN_TEST(test_cmd_gen_mget_iovec_grouped);
+    RUN_TEST(test_cmd_map_get);
 }
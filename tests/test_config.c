@@ -16,6 +16,24 @@ TEST(test_config_bind) {
     PASS(NULL);
 }
 
+TEST(test_config_bind_unix) {
+    char n[] = "bind-unix-perm";
+
+    ASSERT(config_add(n, "") == -1);
+    ASSERT(config_add(n, "778") == -1);
+    ASSERT(config_add(n, "1777") == -1);
+    ASSERT(config_add(n, "-1") == -1);
+    ASSERT(config_add(n, "0660") == 0);
+    ASSERT(config.bind_unix_perm == 0660);
+
+    char path[UNIX_PATH_SIZE + 2];
+    memset(path, 'a', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    ASSERT(config_add("bind-unix", path) == -1);
+
+    PASS(NULL);
+}
+
 TEST(test_config_syslog) {
     char n[] = "syslog";
 
@@ -104,6 +122,10 @@ TEST(test_config_change) {
 
     ASSERT_CONFIG("cluster", "cluster_name");
     ASSERT_CONFIG("bind", "8080");
+    ASSERT_CONFIG("bind-unix", "/tmp/corvus.sock");
+    ASSERT_CONFIG("bind-unix-perm", "770");
+    ASSERT_CONFIG("metrics-bind", "9121");
+    ASSERT_CONFIG("metrics-bind", "0");
     ASSERT_CONFIG("node", "127.0.0.1:1111,127.0.0.1:2222");
     ASSERT_CONFIG("thread", "233");
     ASSERT_CONFIG("loglevel", "debug");
@@ -114,9 +136,17 @@ TEST(test_config_change) {
     ASSERT_CONFIG("client_timeout", "233");
     ASSERT_CONFIG("server_timeout", "666");
     ASSERT_CONFIG("bufsize", "23333");
+    ASSERT_CONFIG("buffer-arena", "true");
+    ASSERT_CONFIG("buffer-arena", "false");
+    ASSERT_CONFIG("splice-threshold", "1048576");
+    ASSERT_CONFIG("splice-threshold", "0");
     ASSERT_CONFIG("slowlog-log-slower-than", "12345");
     ASSERT_CONFIG("slowlog-max-len", "1024");
     ASSERT_CONFIG("slowlog-statsd-enabled", "true");
+    ASSERT_CONFIG("hotkey-sample-rate", "100");
+    ASSERT_CONFIG("hotkey-sample-rate", "0");
+    ASSERT(config_add("hotkey-sample-rate", "-1") == -1);
+    ASSERT(config_add("hotkey-sample-rate", "1000001") == -1);
 
     ASSERT_CONFIG("read-strategy", "master");
     ASSERT_CONFIG("read-strategy", "read-slave-only");
@@ -166,6 +196,7 @@ TEST(test_parse_int) {
 
 TEST_CASE(test_config) {
     RUN_TEST(test_config_bind);
+    RUN_TEST(test_config_bind_unix);
     RUN_TEST(test_config_syslog);
     RUN_TEST(test_config_requirepass);
     RUN_TEST(test_config_read_strategy);
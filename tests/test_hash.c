@@ -2,5 +2,70 @@
 #include "hash.h"
 #include "command.h"
 
+/* bitwise crc16 (XMODEM), the reference for the table driven version */
+static uint16_t crc16_bitwise(const uint8_t *s, size_t len)
+{
+    size_t i;
+    int j;
+    uint16_t crc = 0;
+
+    for (i = 0; i < len; i++) {
+        crc ^= s[i] << 8;
+        for (j = 0; j < 8; j++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+TEST(test_crc16) {
+    size_t i, len;
+    uint8_t data[100];
+    struct pos p[2];
+    struct pos_array arr = {.items = p};
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i * 37 + 11;
+
+    ASSERT(crc16_update(0, (uint8_t*)"123456789", 9) == 0x31C3);
+
+    for (len = 0; len < sizeof(data); len++) {
+        ASSERT(crc16_update(0, data, len) == crc16_bitwise(data, len));
+
+        // split anywhere
+        for (i = 0; i <= len; i++) {
+            p[0].str = data;
+            p[0].len = i;
+            p[1].str = data + i;
+            p[1].len = len - i;
+            arr.pos_len = 2;
+            arr.str_len = len;
+            ASSERT(crc16(&arr) == crc16_bitwise(data, len));
+        }
+    }
+    PASS(NULL);
+}
+
+TEST(test_crc16_batch) {
+    size_t i, n = 23;
+    uint8_t data[64];
+    const uint8_t *bufs[n];
+    size_t lens[n];
+    uint16_t crcs[n];
+
+    for (i = 0; i < sizeof(data); i++) data[i] = i * 13 + 5;
+    for (i = 0; i < n; i++) {
+        bufs[i] = data + i;
+        lens[i] = (i * 7) % 41;
+    }
+
+    crc16_batch(bufs, lens, crcs, n);
+    for (i = 0; i < n; i++) {
+        ASSERT(crcs[i] == crc16_bitwise(bufs[i], lens[i]));
+    }
+    PASS(NULL);
+}
+
 TEST_CASE(test_hash) {
+    RUN_TEST(test_crc16);
+    RUN_TEST(test_crc16_batch);
 }
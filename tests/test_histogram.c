@@ -0,0 +1,83 @@
+#include "test.h"
+#include "histogram.h"
+
+TEST(test_hist_record) {
+    struct histogram h;
+    memset(&h, 0, sizeof(h));
+
+    ASSERT(hist_count(&h) == 0);
+    ASSERT(hist_percentile(&h, 50) == -1);
+    ASSERT(hist_max(&h) == -1);
+
+    // values below HIST_SUB_COUNT are exact
+    for (int i = 0; i < HIST_SUB_COUNT; i++) {
+        memset(&h, 0, sizeof(h));
+        hist_record(&h, i);
+        ASSERT(hist_max(&h) == i);
+    }
+
+    int64_t values[] = {32, 33, 100, 1000, 12345, 999999, 123456789};
+    for (size_t i = 0; i < sizeof(values) / sizeof(int64_t); i++) {
+        memset(&h, 0, sizeof(h));
+        hist_record(&h, values[i]);
+        int64_t v = hist_max(&h);
+        ASSERT(v >= values[i]);
+        ASSERT(v - values[i] <= values[i] / HIST_SUB_COUNT);
+    }
+
+    // out of range values are clamped
+    memset(&h, 0, sizeof(h));
+    hist_record(&h, -5);
+    hist_record(&h, INT64_MAX);
+    ASSERT(hist_count(&h) == 2);
+    ASSERT(hist_percentile(&h, 50) == 0);
+    ASSERT(hist_max(&h) >= (1LL << HIST_MAX_BITS) - 1);
+    PASS(NULL);
+}
+
+TEST(test_hist_percentile) {
+    struct histogram h;
+    memset(&h, 0, sizeof(h));
+
+    for (int i = 1; i <= 1000; i++) {
+        hist_record(&h, i);
+    }
+    ASSERT(hist_count(&h) == 1000);
+
+    int64_t p50 = hist_percentile(&h, 50);
+    int64_t p99 = hist_percentile(&h, 99);
+    int64_t p999 = hist_percentile(&h, 99.9);
+    ASSERT(p50 >= 500 && p50 <= 500 + 500 / HIST_SUB_COUNT);
+    ASSERT(p99 >= 990 && p99 <= 990 + 990 / HIST_SUB_COUNT);
+    ASSERT(p999 >= 999 && p999 <= 999 + 999 / HIST_SUB_COUNT);
+    ASSERT(hist_percentile(&h, 100) == hist_max(&h));
+    ASSERT(hist_percentile(&h, 0) == 1);
+    PASS(NULL);
+}
+
+TEST(test_hist_merge) {
+    struct histogram a, b, sum;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    memset(&sum, 0, sizeof(sum));
+
+    for (int i = 0; i < 90; i++) hist_record(&a, 10);
+    for (int i = 0; i < 10; i++) hist_record(&b, 5000);
+
+    hist_merge(&sum, &a);
+    hist_merge(&sum, &b);
+    ASSERT(hist_count(&sum) == 100);
+    ASSERT(hist_percentile(&sum, 90) == 10);
+    ASSERT(hist_percentile(&sum, 91) >= 5000);
+
+    hist_sub(&sum, &a);
+    ASSERT(hist_count(&sum) == 10);
+    ASSERT(hist_percentile(&sum, 1) >= 5000);
+    PASS(NULL);
+}
+
+TEST_CASE(test_histogram) {
+    RUN_TEST(test_hist_record);
+    RUN_TEST(test_hist_percentile);
+    RUN_TEST(test_hist_merge);
+}
@@ -0,0 +1,167 @@
+#include <string.h>
+#include <pthread.h>
+#include "test.h"
+#include "corvus.h"
+#include "hotkey.h"
+
+static void sample_key(struct context *ctx, const char *key, int times)
+{
+    int len = strlen(key), half = len / 2;
+    struct pos p[] = {
+        {.len = half, .str = (uint8_t*)key},
+        {.len = len - half, .str = (uint8_t*)key + half}
+    };
+    struct pos_array arr = {.str_len = len, .items = p, .pos_len = 2};
+
+    for (int i = 0; i < times; i++) {
+        hotkey_sample(ctx, &arr);
+    }
+}
+
+TEST(test_hotkey_sample) {
+    struct hotkey_entry top[HOTKEY_TOPK];
+    char key[32];
+
+    hotkey_init(&ctx->hotkeys);
+    config.hotkey_sample_rate = 1;
+
+    sample_key(ctx, "hello", 100);
+    sample_key(ctx, "world", 30);
+    for (int i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "cold%d", i);
+        sample_key(ctx, key, 1);
+    }
+    ASSERT(ctx->hotkeys.countdown == 1);
+    ASSERT(ctx->hotkeys.top_len == HOTKEY_TOPK);
+
+    int n = hotkey_get_top(ctx, top, 2);
+    ASSERT(n == 2);
+    ASSERT(strcmp(top[0].key, "hello") == 0);
+    ASSERT(top[0].len == 5);
+    ASSERT(top[0].count >= 100 && top[0].count <= 102);
+    ASSERT(strcmp(top[1].key, "world") == 0);
+    ASSERT(top[1].count >= 30 && top[1].count <= 32);
+
+    // halved once per interval
+    hotkey_decay(&ctx->hotkeys, 1000);
+    hotkey_decay(&ctx->hotkeys, 1000 + HOTKEY_DECAY_INTERVAL - 1);
+    ASSERT(hotkey_get_top(ctx, top, 1) == 1);
+    ASSERT(top[0].count >= 100);
+    hotkey_decay(&ctx->hotkeys, 1000 + HOTKEY_DECAY_INTERVAL);
+    ASSERT(hotkey_get_top(ctx, top, 1) == 1);
+    ASSERT(top[0].count >= 50 && top[0].count <= 51);
+
+    // counters are scaled by the sample rate
+    config.hotkey_sample_rate = 10;
+    sample_key(ctx, "world", 10);
+    ASSERT(ctx->hotkeys.countdown >= 1 && ctx->hotkeys.countdown <= 19);
+    ASSERT(hotkey_get_top(ctx, top, 1) == 1);
+    ASSERT(strcmp(top[0].key, "world") == 0);
+    ASSERT(top[0].count >= 115 && top[0].count <= 116);
+
+    config.hotkey_sample_rate = 0;
+    sample_key(ctx, "hello", 1000);
+    ASSERT(hotkey_get_top(ctx, top, 1) == 1);
+    ASSERT(strcmp(top[0].key, "world") == 0);
+
+    hotkey_init(&ctx->hotkeys);
+    PASS(NULL);
+}
+
+TEST(test_hotkey_long_key) {
+    struct hotkey_entry top[1];
+    char key[HOTKEY_KEY_LEN * 2 + 1];
+
+    hotkey_init(&ctx->hotkeys);
+    config.hotkey_sample_rate = 1;
+
+    memset(key, 'a', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    sample_key(ctx, key, 3);
+    // same prefix, different key
+    key[sizeof(key) - 2] = 'b';
+    sample_key(ctx, key, 2);
+
+    ASSERT(hotkey_get_top(ctx, top, 1) == 1);
+    ASSERT(top[0].len == HOTKEY_KEY_LEN * 2);
+    ASSERT(strlen(top[0].key) == HOTKEY_KEY_LEN);
+    ASSERT(top[0].count == 3);
+    ASSERT(ctx->hotkeys.top_len == 2);
+
+    config.hotkey_sample_rate = 0;
+    hotkey_init(&ctx->hotkeys);
+    PASS(NULL);
+}
+
+TEST(test_hotkey_merge) {
+    struct test_contexts t;
+    struct hotkey_entry top[HOTKEY_TOPK * 2];
+
+    test_contexts_init(&t, 2);
+    struct context *ctxs = t.ctxs;
+    config.hotkey_sample_rate = 1;
+
+    sample_key(&ctxs[0], "a", 5);
+    sample_key(&ctxs[0], "b", 8);
+    sample_key(&ctxs[1], "a", 6);
+    sample_key(&ctxs[1], "c", 1);
+
+    int n = hotkey_get_top(ctxs, top, HOTKEY_TOPK * 2);
+    ASSERT(n == 3);
+    ASSERT(strcmp(top[0].key, "a") == 0 && top[0].count == 11);
+    ASSERT(strcmp(top[1].key, "b") == 0 && top[1].count == 8);
+    ASSERT(strcmp(top[2].key, "c") == 0 && top[2].count == 1);
+    ASSERT(hotkey_get_top(ctxs, top, 0) == 0);
+
+    test_contexts_free(&t);
+    config.hotkey_sample_rate = 0;
+    PASS(NULL);
+}
+
+static void *hotkey_writer(void *data)
+{
+    struct context *ctx = data;
+    char key[16];
+
+    for (int i = 0; i < 200000; i++) {
+        snprintf(key, sizeof(key), "key%d", i % 100);
+        sample_key(ctx, key, 1);
+        if (i % 1000 == 0) ctx->hotkeys.decay_time = 1;
+        hotkey_decay(&ctx->hotkeys, HOTKEY_DECAY_INTERVAL + 1);
+    }
+    return NULL;
+}
+
+TEST(test_hotkey_read_while_sampling) {
+    struct hotkey_entry top[HOTKEY_TOPK];
+    pthread_t writer;
+    bool torn = false;
+
+    hotkey_init(&ctx->hotkeys);
+    config.hotkey_sample_rate = 1;
+    ASSERT(pthread_create(&writer, NULL, hotkey_writer, ctx) == 0);
+
+    // copies are never torn, every entry is one of the sampled keys
+    while (pthread_tryjoin_np(writer, NULL) != 0) {
+        int n = hotkey_get_top(ctx, top, HOTKEY_TOPK);
+        for (int i = 0; i < n; i++) {
+            if (strncmp(top[i].key, "key", 3) != 0
+                    || top[i].len != (int)strlen(top[i].key) || top[i].count == 0)
+            {
+                torn = true;
+            }
+        }
+    }
+    ASSERT(!torn);
+
+    config.hotkey_sample_rate = 0;
+    hotkey_init(&ctx->hotkeys);
+    PASS(NULL);
+}
+
+TEST_CASE(test_hotkey) {
+    RUN_TEST(test_hotkey_sample);
+    RUN_TEST(test_hotkey_long_key);
+    RUN_TEST(test_hotkey_merge);
+    RUN_TEST(test_hotkey_read_while_sampling);
+}
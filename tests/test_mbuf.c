@@ -1,5 +1,10 @@
+#include <sys/socket.h>
+#include <unistd.h>
 #include "test.h"
 #include "alloc.h"
+#include "connection.h"
+#include "server.h"
+#include "socket.h"
 
 void init_mbuf_for_test(struct mbuf *b, size_t len) {
     uint8_t *p = cv_calloc(len, 1);
@@ -73,6 +78,99 @@ TEST(test_mbuf_range_func) {
     PASS(NULL);
 }
 
+TEST(test_mbuf_get_size) {
+    struct mbuf *b1 = mbuf_get_size(ctx, 30);
+    struct mbuf *b2 = mbuf_get_size(ctx, 1000);
+    struct mbuf *b3 = mbuf_get_size(ctx, 10000);
+    struct mbuf *b4 = mbuf_get_size(ctx, 1 << 20);
+    struct mbuf *b5 = mbuf_get(ctx);
+
+    ASSERT(b1->size_class == MBUF_SMALL);
+    ASSERT(mbuf_write_size(b1) == 512 - sizeof(struct mbuf));
+    ASSERT(b2->size_class == MBUF_MEDIUM);
+    ASSERT(b3->size_class == MBUF_DEFAULT);
+    ASSERT(b4->size_class == MBUF_LARGE);
+    ASSERT(mbuf_write_size(b4) == (uint32_t)config.bufsize * 16 - sizeof(struct mbuf));
+    ASSERT(b5->size_class == MBUF_DEFAULT);
+    ASSERT(mbuf_write_size(b5) == config.bufsize - sizeof(struct mbuf));
+
+    ASSERT(ctx->mstats.buffers == 5);
+    ASSERT(ctx->mstats.class_buffers[MBUF_DEFAULT] == 2);
+
+    mbuf_recycle(ctx, b1);
+    mbuf_recycle(ctx, b3);
+    ASSERT(ctx->mstats.class_buffers[MBUF_SMALL] == 0);
+    ASSERT(ctx->mstats.free_class_buffers[MBUF_SMALL] == 1);
+    ASSERT(ctx->mstats.free_buffers == 2);
+
+    // reused from the free queue of its class only
+    struct mbuf *b6 = mbuf_get_size(ctx, 0);
+    ASSERT(b6 == b1);
+    ASSERT(ctx->mstats.free_class_buffers[MBUF_DEFAULT] == 1);
+
+    struct mbuf *bufs[] = {b2, b4, b5, b6};
+    for (int i = 0; i < 4; i++) {
+        mbuf_recycle(ctx, bufs[i]);
+    }
+    ASSERT(ctx->mstats.buffers == 0);
+
+    PASS(NULL);
+}
+
+TEST(test_conn_read_hint) {
+    int fds[2];
+    char data[65536];
+    struct mbuf *buf;
+
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    ASSERT(socket_set_nonblocking(fds[0]) == CORVUS_OK);
+    struct connection *conn = server_create(ctx, fds[0]);
+
+    // a small read fits the smallest buffer
+    ASSERT(write(fds[1], "+OK\r\n", 5) == 5);
+    buf = conn_get_buf(conn, true, false);
+    ASSERT(buf->size_class == MBUF_SMALL);
+    ASSERT(conn_read(conn, buf) == CORVUS_OK);
+    buf->pos = buf->last;
+
+    // buffers grow while reads fill them
+    memset(data, 'a', sizeof(data));
+    ASSERT(write(fds[1], data, sizeof(data)) == sizeof(data));
+    while (true) {
+        buf = conn_get_buf(conn, true, false);
+        if (conn_read(conn, buf) != CORVUS_OK) break;
+        buf->pos = buf->last;
+    }
+    ASSERT(buf->size_class == MBUF_LARGE);
+
+    // and shrink back after small reads
+    for (int i = 0; i < 32; i++) {
+        ASSERT(write(fds[1], "+OK\r\n", 5) == 5);
+        ASSERT(conn_read(conn, buf) == CORVUS_OK);
+        buf->pos = buf->last;
+    }
+    ASSERT(conn->info->read_hint == 5);
+
+    // known length of a bulk string being parsed
+    buf = conn_get_buf(conn, true, false);
+    char *bulk = "$100000\r\nabc";
+    memcpy(buf->last, bulk, strlen(bulk));
+    buf->last += strlen(bulk);
+    reader_feed(&conn->info->reader, buf);
+    ASSERT(parse(&conn->info->reader, MODE_REP) == CORVUS_OK);
+    ASSERT(reader_pending(&conn->info->reader) == 100000 - 3 + 2);
+    buf->pos = buf->last = buf->end;
+    ASSERT(conn_get_buf(conn, true, false)->size_class == MBUF_LARGE);
+
+    close(fds[1]);
+    conn_free(conn);
+    conn_buf_free(conn);
+    conn_recycle(ctx, conn);
+    PASS(NULL);
+}
+
 TEST_CASE(test_mbuf) {
     RUN_TEST(test_mbuf_range_func);
+    RUN_TEST(test_mbuf_get_size);
+    RUN_TEST(test_conn_read_hint);
 }
@@ -4,6 +4,7 @@
 #include "parser.h"
 #include "mbuf.h"
 #include "logging.h"
+#include "alloc.h"
 
 extern int process_type(struct reader *r);
 extern int process_array(struct reader *r);
@@ -118,6 +119,53 @@ TEST(test_partial_parse) {
     PASS(NULL);
 }
 
+TEST(test_parse_split_anywhere) {
+    char data[] = "*5\r\n$3\r\nSET\r\n$-1\r\n:-123\r\n+OK\r\n$10\r\n0123456789\r\n";
+    int i, len = strlen(data);
+    char str[16];
+
+    // the length line and payload fast paths must agree with the
+    // byte by byte state machine wherever the buffer is cut
+    for (i = 1; i < len; i++) {
+        struct mbuf *buf = mbuf_get(ctx), *buf2 = mbuf_get(ctx);
+        memcpy(buf->last, data, i);
+        buf->last += i;
+        memcpy(buf2->last, data + i, len - i);
+        buf2->last += len - i;
+
+        struct reader r;
+        reader_init(&r);
+        reader_feed(&r, buf);
+        ASSERT(parse(&r, MODE_REQ) == 0);
+        ASSERT(!r.ready);
+        reader_feed(&r, buf2);
+        ASSERT(parse(&r, MODE_REQ) == 0);
+        ASSERT(r.ready);
+
+        struct redis_data *d = &r.data;
+        ASSERT(d->elements == 5);
+        ASSERT(d->element[0].pos.str_len == 3);
+        pos_to_str(&d->element[0].pos, str);
+        ASSERT(strcmp(str, "SET") == 0);
+        ASSERT(d->element[1].type == REP_STRING);
+        ASSERT(d->element[1].pos.str_len == 0);
+        ASSERT(d->element[2].type == REP_INTEGER);
+        ASSERT(d->element[2].integer == -123);
+        ASSERT(d->element[3].type == REP_SIMPLE_STRING);
+        pos_to_str(&d->element[3].pos, str);
+        ASSERT(strcmp(str, "OK") == 0);
+        ASSERT(d->element[4].pos.str_len == 10);
+        pos_to_str(&d->element[4].pos, str);
+        ASSERT(strcmp(str, "0123456789") == 0);
+        ASSERT(r.end.buf == buf2 && r.end.pos == buf2->last);
+
+        mbuf_recycle(ctx, buf);
+        mbuf_recycle(ctx, buf2);
+        reader_free(&r);
+    }
+    PASS(NULL);
+}
+
 TEST(test_process_integer) {
     struct mbuf buf;
 
@@ -464,9 +512,212 @@ TEST(test_pos_is_zero_letters) {
     PASS(NULL);
 }
 
+TEST(test_parse_store_inline) {
+    char data[] = "*3\r\n$3\r\nSET\r\n$5\r\nhello\r\n$5\r\nworld\r\n";
+    struct mbuf *buf = get_buf(ctx, data);
+    struct parse_pool pool;
+    struct parse_store store;
+    struct reader r;
+
+    memset(&pool, 0, sizeof(pool));
+    parse_store_init(&store, &pool);
+    reader_init(&r);
+    reader_feed(&r, buf);
+    r.store = &store;
+
+    long long count = cv_alloc_count;
+    ASSERT(parse(&r, MODE_REQ) == CORVUS_OK);
+    ASSERT(cv_alloc_count == count);
+    ASSERT(reader_ready(&r));
+    ASSERT(r.store == &store);
+
+    struct redis_data *d = &r.data;
+    ASSERT(d->stored);
+    ASSERT(d->elements == 3);
+    ASSERT(d->element == store.elements);
+    ASSERT(d->element[2].pos.pos_len == 1);
+    ASSERT(strncmp("world", (const char *)d->element[2].pos.items[0].str, 5) == 0);
+    ASSERT(store.blocks == NULL);
+
+    redis_data_free(&r.data);
+    parse_store_reset(&store);
+    ASSERT(store.elements_used == 0 && store.pos_used == 0);
+
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+    PASS(NULL);
+}
+
+TEST(test_parse_store_overflow) {
+    int i, j, n;
+    char data[2048], *p;
+    struct parse_pool pool;
+    struct parse_store store;
+    struct reader r;
+
+    n = sprintf(data, "*41\r\n$4\r\nMSET\r\n");
+    for (i = 0; i < 40; i++) {
+        n += sprintf(data + n, "$3\r\nk%02d\r\n", i);
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    parse_store_init(&store, &pool);
+
+    for (j = 0; j < 2; j++) {
+        struct mbuf *buf = get_buf(ctx, data);
+        reader_init(&r);
+        reader_feed(&r, buf);
+        r.store = &store;
+
+        long long count = cv_alloc_count;
+        ASSERT(parse(&r, MODE_REQ) == CORVUS_OK);
+        // the first request takes a new block, the second reuses it
+        ASSERT(cv_alloc_count == count + (j == 0 ? 1 : 0));
+        ASSERT(reader_ready(&r));
+        ASSERT(r.data.elements == 41);
+        ASSERT(store.blocks != NULL && store.blocks->next == NULL);
+
+        p = (char *)r.data.element[40].pos.items[0].str;
+        ASSERT(strncmp("k39", p, 3) == 0);
+
+        redis_data_free(&r.data);
+        parse_store_reset(&store);
+        ASSERT(store.blocks == NULL);
+        ASSERT(pool.len == 1);
+
+        mbuf_recycle(ctx, buf);
+        reader_free(&r);
+    }
+
+    parse_pool_free(&pool);
+    ASSERT(pool.free == NULL);
+    PASS(NULL);
+}
+
+TEST(test_parse_without_store) {
+    char data[] = "*2\r\n$3\r\nGET\r\n$5\r\nhello\r\n";
+    struct mbuf *buf = get_buf(ctx, data);
+    struct reader r;
+
+    reader_init(&r);
+    reader_feed(&r, buf);
+
+    long long count = cv_alloc_count;
+    ASSERT(parse(&r, MODE_REQ) == CORVUS_OK);
+    ASSERT(cv_alloc_count > count);
+    ASSERT(!r.data.stored);
+    ASSERT(r.data.elements == 2);
+
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+    PASS(NULL);
+}
+
+TEST(test_frame_split_anywhere) {
+    char data[] = "*5\r\n*2\r\n$3\r\nfoo\r\n:-12\r\n$-1\r\n-ERR x\r\n+OK\r\n*0\r\n"
+        ":7\r\n";
+    int i, j, replies, len = strlen(data), first = len - 4;
+
+    for (i = 1; i < len; i++) {
+        struct mbuf *bufs[2] = {mbuf_get(ctx), mbuf_get(ctx)};
+        memcpy(bufs[0]->last, data, i);
+        bufs[0]->last += i;
+        memcpy(bufs[1]->last, data + i, len - i);
+        bufs[1]->last += len - i;
+
+        struct reader r;
+        reader_init(&r);
+
+        long long count = cv_alloc_count;
+        replies = 0;
+        for (j = 0; j < 2; j++) {
+            reader_feed(&r, bufs[j]);
+            while (bufs[j]->pos < bufs[j]->last) {
+                ASSERT(parse(&r, MODE_REP) == CORVUS_OK);
+                if (!reader_ready(&r)) continue;
+
+                if (replies++ == 0) {
+                    ASSERT(r.redis_data_type == REP_ARRAY);
+                    ASSERT(r.data.elements == 5);
+                    if (i >= first) {
+                        ASSERT(r.end.buf == bufs[0] && r.end.pos == bufs[0]->start + first);
+                    } else {
+                        ASSERT(r.end.buf == bufs[1] && r.end.pos == bufs[1]->start + first - i);
+                    }
+                } else {
+                    ASSERT(r.redis_data_type == REP_INTEGER);
+                    ASSERT(r.item_size == 7);
+                    ASSERT(r.end.buf == bufs[1] && r.end.pos == bufs[1]->last);
+                }
+                r.ready = false;
+                redis_data_free(&r.data);
+            }
+        }
+        ASSERT(replies == 2);
+        ASSERT(cv_alloc_count == count);
+
+        mbuf_recycle(ctx, bufs[0]);
+        mbuf_recycle(ctx, bufs[1]);
+        reader_free(&r);
+    }
+    PASS(NULL);
+}
+
+TEST(test_frame_nested) {
+    char data[256];
+    int i, n = 0;
+
+    // deeper than the stack of MODE_REQ
+    for (i = 0; i < 20; i++) n += sprintf(data + n, "*1\r\n");
+    n += sprintf(data + n, "$3\r\nabc\r\n");
+
+    struct mbuf *buf = get_buf(ctx, data);
+    struct reader r;
+    reader_init(&r);
+    reader_feed(&r, buf);
+
+    ASSERT(parse(&r, MODE_REP) == CORVUS_OK);
+    ASSERT(r.ready);
+    ASSERT(r.data.elements == 1);
+    ASSERT(r.end.pos == buf->last);
+
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+    PASS(NULL);
+}
+
+TEST(test_frame_error) {
+    struct reader r;
+    struct mbuf *buf = get_buf(ctx, "-MOVED 866 127.0.0.1:8001\r\n");
+
+    reader_init(&r);
+    reader_feed(&r, buf);
+    ASSERT(parse(&r, MODE_REP) == CORVUS_OK);
+    ASSERT(r.ready);
+    ASSERT(r.redis_data_type == REP_ERROR);
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+
+    buf = get_buf(ctx, "*1\r\n$-2\r\n");
+    reader_init(&r);
+    reader_feed(&r, buf);
+    ASSERT(parse(&r, MODE_REP) == CORVUS_ERR);
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+
+    buf = get_buf(ctx, "$3\r\nabcd\r\n");
+    reader_init(&r);
+    reader_feed(&r, buf);
+    ASSERT(parse(&r, MODE_REP) == CORVUS_ERR);
+    mbuf_recycle(ctx, buf);
+    reader_free(&r);
+    PASS(NULL);
+}
+
 TEST_CASE(test_parser) {
     RUN_TEST(test_nested_array);
     RUN_TEST(test_partial_parse);
+    RUN_TEST(test_parse_split_anywhere);
     RUN_TEST(test_process_integer);
     RUN_TEST(test_empty_array);
     RUN_TEST(test_parse_simple_string);
@@ -483,4 +734,10 @@ TEST_CASE(test_parser) {
     RUN_TEST(test_pos_is_zero_multiple_zero);
     RUN_TEST(test_pos_is_zero_digits);
     RUN_TEST(test_pos_is_zero_letters);
+    RUN_TEST(test_parse_store_inline);
+    RUN_TEST(test_parse_store_overflow);
+    RUN_TEST(test_parse_without_store);
+    RUN_TEST(test_frame_split_anywhere);
+    RUN_TEST(test_frame_nested);
+    RUN_TEST(test_frame_error);
 }
@@ -1,9 +1,15 @@
+#include <sys/socket.h>
+#include <unistd.h>
 #include "test.h"
 #include "connection.h"
 #include "server.h"
 #include "corvus.h"
+#include "socket.h"
+#include "alloc.h"
 
 extern void server_data_clear(struct command *cmd);
+extern int server_read(struct connection *server);
+extern int client_write(struct connection *client);
 
 /* after server_eof:
  *      - stale cmds should be freed
@@ -84,7 +90,7 @@ TEST(test_server_data_clear) {
 
     ASSERT(cmd->rep_buf[0].buf == NULL);
     ASSERT(cmd->rep_buf[1].buf == NULL);
-    ASSERT(TAILQ_FIRST(&ctx->free_mbufq) == buf);
+    ASSERT(TAILQ_FIRST(&ctx->free_mbufq[buf->size_class]) == buf);
 
     cmd_free(cmd);
 
@@ -94,7 +100,163 @@ TEST(test_server_data_clear) {
     PASS(NULL);
 }
 
+TEST(test_server_dirty) {
+    int fd = conn_create_fd();
+    struct connection *server = server_create(ctx, fd);
+    server->info->status = CONNECTING;
+
+    conn_mark_dirty(server);
+    conn_mark_dirty(server);
+    ASSERT(TAILQ_FIRST(&ctx->dirty_conns) == server);
+    ASSERT(TAILQ_NEXT(server, dirty_next) == NULL);
+
+    /* connecting server only gets registered */
+    conn_flush_dirty(ctx);
+    ASSERT(TAILQ_EMPTY(&ctx->dirty_conns));
+    ASSERT(server->registered);
+    ASSERT(!server->dirty);
+
+    /* freed connection is removed from dirty list */
+    conn_mark_dirty(server);
+    conn_free(server);
+    ASSERT(TAILQ_EMPTY(&ctx->dirty_conns));
+    ASSERT(!server->dirty);
+
+    conn_buf_free(server);
+    conn_recycle(ctx, server);
+
+    PASS(NULL);
+}
+
+static struct command *relay_cmd(struct connection *client, struct connection *server)
+{
+    struct command *cmd = conn_get_cmd(client);
+    cmd->client = client;
+    cmd->server = server;
+    cmd->parse_done = true;
+    cmd->cmd_count = 1;
+    STAILQ_INSERT_TAIL(&server->info->waiting_queue, cmd, waiting_next);
+    return cmd;
+}
+
+TEST(test_server_relay) {
+    int s[2], c[2], threshold = config.splice_threshold;
+    size_t len, sent = 0, received = 0, size = 100000;
+    char *data = cv_malloc(size + 32), *rep = cv_malloc(size + 32);
+    ssize_t n;
+
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, c) == 0);
+    for (int i = 0; i < 2; i++) {
+        socket_set_nonblocking(s[i]);
+        socket_set_nonblocking(c[i]);
+    }
+    struct connection *server = server_create(ctx, s[0]);
+    struct connection *client = conn_create(ctx);
+    client->fd = c[0];
+    client->info = conn_info_create(ctx);
+
+    len = sprintf(data, "$%zu\r\n", size);
+    memset(data + len, 'x', size);
+    len += size;
+    len += sprintf(data + len, "\r\n+OK\r\n");
+
+    config.splice_threshold = 1024;
+    relay_cmd(client, server);
+    relay_cmd(client, server);
+
+    // the head is buffered, the rest is spliced
+    ASSERT(write(s[1], data, 209) == 209);
+    sent = 209;
+    server_read(server);
+    ASSERT(server->info->relay != NULL);
+    ASSERT(client->info->relay == server->info->relay);
+
+    for (int i = 0; i < 10000 && received < len; i++) {
+        if (sent < len && (n = write(s[1], data + sent, len - sent)) > 0) {
+            sent += n;
+        }
+        ASSERT(server_read(server) != CORVUS_ERR);
+        ASSERT(client_write(client) == CORVUS_OK);
+        if ((n = read(c[1], rep + received, len - received)) > 0) {
+            received += n;
+        }
+    }
+    ASSERT(received == len);
+    ASSERT(memcmp(rep, data, len) == 0);
+    ASSERT(server->info->relay == NULL && client->info->relay == NULL);
+    ASSERT(STAILQ_EMPTY(&server->info->waiting_queue));
+    ASSERT(STAILQ_EMPTY(&client->info->cmd_queue));
+    ASSERT(ctx->stats.basic.spliced_replies == 1);
+    ASSERT(ctx->stats.basic.spliced_bytes == (long long)(size - 200 + 2));
+
+    config.splice_threshold = threshold;
+    close(s[1]);
+    close(c[1]);
+    conn_free(client);
+    conn_buf_free(client);
+    conn_recycle(ctx, client);
+    conn_free(server);
+    conn_buf_free(server);
+    conn_recycle(ctx, server);
+    cv_free(data);
+    cv_free(rep);
+    PASS(NULL);
+}
+
+TEST(test_server_relay_fallback) {
+    int s[2], c[2], threshold = config.splice_threshold;
+    char data[4096];
+
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, c) == 0);
+    socket_set_nonblocking(s[0]);
+    struct connection *server = server_create(ctx, s[0]);
+    struct connection *client = conn_create(ctx);
+    client->fd = c[0];
+    client->info = conn_info_create(ctx);
+
+    int len = sprintf(data, "$2000\r\n");
+    memset(data + len, 'x', 2000);
+    len += 2000;
+    len += sprintf(data + len, "\r\n");
+
+    // the client is still waiting for the reply of an earlier command
+    config.splice_threshold = 1024;
+    struct command *first = conn_get_cmd(client);
+    first->parse_done = true;
+    struct command *cmd = relay_cmd(client, server);
+
+    ASSERT(write(s[1], data, 100) == 100);
+    server_read(server);
+    ASSERT(server->info->relay == NULL);
+    ASSERT(write(s[1], data + 100, len - 100) == len - 100);
+    server_read(server);
+    ASSERT(cmd->cmd_done_count == 1);
+    ASSERT(cmd->reply_type == REP_STRING);
+    ASSERT(mbuf_range_len(cmd->rep_buf) == (uint32_t)len);
+
+    config.splice_threshold = threshold;
+    mbuf_range_clear(ctx, cmd->rep_buf);
+    STAILQ_REMOVE_HEAD(&client->info->cmd_queue, cmd_next);
+    STAILQ_REMOVE_HEAD(&client->info->cmd_queue, cmd_next);
+    cmd_free(first);
+    cmd_free(cmd);
+    close(s[1]);
+    close(c[1]);
+    conn_free(client);
+    conn_buf_free(client);
+    conn_recycle(ctx, client);
+    conn_free(server);
+    conn_buf_free(server);
+    conn_recycle(ctx, server);
+    PASS(NULL);
+}
+
 TEST_CASE(test_server) {
     RUN_TEST(test_server_eof);
+    RUN_TEST(test_server_dirty);
     RUN_TEST(test_server_data_clear);
+    RUN_TEST(test_server_relay);
+    RUN_TEST(test_server_relay_fallback);
 }
@@ -1,5 +1,9 @@
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "test.h"
 #include "slot.h"
 #include "parser.h"
@@ -10,8 +14,11 @@
 #include "slot.h"
 #include "alloc.h"
 
-extern int split_node_description(struct node_desc *desc, struct pos_array *pos_array);
+extern int split_node_description(struct node_desc **desc, char *text);
+extern void node_desc_free(struct node_desc *desc, int n);
 extern int parse_cluster_nodes(struct redis_data *data);
+extern int slot_check_nodes(struct redis_data *data, uint64_t *epoch, uint64_t *digest);
+extern int slot_update_from(struct context *ctx, struct address *nodes, int len);
 
 TEST(test_slot_get1) {
     struct pos p[] = {
@@ -60,6 +67,51 @@ TEST(test_slot_get3) {
     PASS(NULL);
 }
 
+TEST(test_slot_get_split) {
+    const char *keys[] = {
+        "hello", "{user1000}.following", "foo{}{bar}", "foo{{bar}}zap",
+        "foo{bar}{zap}", "{}", "{", "}{", "a{b", "a}b{c}", "",
+    };
+    size_t i, j, n = sizeof(keys) / sizeof(keys[0]);
+    uint16_t slot, slots[n];
+    struct pos p[2], whole[n];
+    struct pos_array arr = {.items = p, .pos_len = 2};
+    struct pos_array batch[n], *batch_ptr[n];
+
+    for (i = 0; i < n; i++) {
+        int len = strlen(keys[i]);
+
+        whole[i].str = (uint8_t*)keys[i];
+        whole[i].len = len;
+        batch[i].items = &whole[i];
+        batch[i].pos_len = 1;
+        batch[i].str_len = len;
+        batch_ptr[i] = &batch[i];
+
+        slot = slot_get(&batch[i]);
+        for (j = 0; j <= (size_t)len; j++) {
+            p[0].str = (uint8_t*)keys[i];
+            p[0].len = j;
+            p[1].str = (uint8_t*)keys[i] + j;
+            p[1].len = len - j;
+            arr.str_len = len;
+            ASSERT(slot_get(&arr) == slot);
+        }
+    }
+
+    // {user1000} and {bar} are the hash tags
+    ASSERT(slot_get(&batch[1]) == 3443);
+    ASSERT(slot_get(&batch[2]) == 8363);
+    ASSERT(slot_get(&batch[3]) == 4015);
+    ASSERT(slot_get(&batch[4]) == 5061);
+
+    slot_get_batch(batch_ptr, slots, n);
+    for (i = 0; i < n; i++) {
+        ASSERT(slots[i] == slot_get(&batch[i]));
+    }
+    PASS(NULL);
+}
+
 TEST(test_split_node_description) {
     char data1[] = "298381934bd7f45ae7a59f9f6e3c9f3c0268536c 127.0.0.1:8003 sl";
     char data2[] = "ave 2033f1738f69a650f315f54b67cfea676734e42a 0 1464233594838 4 connected";
@@ -77,34 +129,25 @@ TEST(test_split_node_description) {
     char data14[] = "master - 0 0 1 connected 0-5461\n0552289a193de9d2a93de8a";
     char data15[] = "62e523dcb45753cf7 127.0.0.1:8002 master - 0 1464233592817 3 connected 10923-16383\n";
 
-    struct pos p[15] = {
-        {(uint8_t*)data1, strlen(data1)},
-        {(uint8_t*)data2, strlen(data2)},
-        {(uint8_t*)data3, strlen(data3)},
-        {(uint8_t*)data4, strlen(data4)},
-        {(uint8_t*)data5, strlen(data5)},
-        {(uint8_t*)data6, strlen(data6)},
-        {(uint8_t*)data7, strlen(data7)},
-        {(uint8_t*)data8, strlen(data8)},
-        {(uint8_t*)data9, strlen(data9)},
-        {(uint8_t*)data10, strlen(data10)},
-        {(uint8_t*)data11, strlen(data11)},
-        {(uint8_t*)data12, strlen(data12)},
-        {(uint8_t*)data13, strlen(data13)},
-        {(uint8_t*)data14, strlen(data14)},
-        {(uint8_t*)data15, strlen(data15)},
+    char *parts[] = {
+        data1, data2, data3, data4, data5, data6, data7, data8,
+        data9, data10, data11, data12, data13, data14, data15,
     };
-    struct pos_array pos = {p, 828, 15, 0};
-    struct node_desc desc[REDIS_CLUSTER_SLOTS];
-    memset(desc, 0, sizeof(desc));
-    int n = split_node_description(desc, &pos);
-    ASSERT(n == 7);
-    ASSERT(desc[0].index == 8);
-    ASSERT(strncmp(desc[0].parts[0].data, "298381934bd7f45ae7a59f9f6e3c9f3c0268536c",
-                desc[0].parts[0].len) == 0);
-    for (int i = 0; i < n; i++) {
-        cv_free(desc[i].parts);
+    char text[1024] = "";
+    for (int i = 0; i < 15; i++) {
+        strcat(text, parts[i]);
     }
+    ASSERT(strlen(text) == 828);
+
+    struct node_desc *desc;
+    int n = split_node_description(&desc, text);
+    ASSERT(n == 7);
+    ASSERT(desc[0].len == 8);
+    ASSERT(strcmp(desc[0].parts[0], "298381934bd7f45ae7a59f9f6e3c9f3c0268536c") == 0);
+    ASSERT(strcmp(desc[0].parts[2], "slave") == 0);
+    ASSERT(desc[6].len == 9);
+    ASSERT(strcmp(desc[6].parts[8], "10923-16383") == 0);
+    node_desc_free(desc, n);
     PASS(NULL);
 }
 
@@ -120,10 +163,18 @@ TEST(test_parse_cluster_nodes) {
     int count = parse_cluster_nodes(&redis_data);
     ASSERT(count == 51);
 
-    struct node_info info;
-    ASSERT(slot_get_node_addr(5499, &info));
-    ASSERT(strcmp(info.nodes[0].ip, "127.0.0.1") == 0 && info.nodes[0].port == 8001);
-    ASSERT(!slot_get_node_addr(9, &info));
+    struct address nodes[2];
+    ASSERT(slot_get_node_addr(5499, nodes, 2) == 1);
+    ASSERT(strcmp(nodes[0].ip, "127.0.0.1") == 0 && nodes[0].port == 8001);
+    ASSERT(slot_get_node_addr(9, nodes, 2) == 0);
+
+    struct slot_route *route = slot_get_route(&ctx->slot_table, 5499);
+    ASSERT(route != NULL && route->len == 1);
+    ASSERT(strcmp(route->nodes[0].ip, "127.0.0.1") == 0 && route->nodes[0].port == 8001);
+    ASSERT(route->servers[0] == NULL);
+    ASSERT(slot_get_route(&ctx->slot_table, 0) == route);
+    ASSERT(slot_get_route(&ctx->slot_table, 9) == NULL);
+    ASSERT(ctx->slot_table.len == 1);
 
     PASS(NULL);
 }
@@ -142,11 +193,14 @@ TEST(test_parse_cluster_nodes_slave) {
     int count = parse_cluster_nodes(&redis_data);
     ASSERT(count == 1);
 
-    struct node_info info;
-    ASSERT(slot_get_node_addr(0, &info));
-    ASSERT(strcmp(info.nodes[0].ip, "127.0.0.1") == 0 && info.nodes[0].port == 8001);
-    ASSERT(info.index == 2);
-    ASSERT(strcmp(info.nodes[1].ip, "127.0.0.1") == 0 && info.nodes[1].port == 8003);
+    struct address nodes[2];
+    ASSERT(slot_get_node_addr(0, nodes, 2) == 2);
+    ASSERT(strcmp(nodes[0].ip, "127.0.0.1") == 0 && nodes[0].port == 8001);
+    ASSERT(strcmp(nodes[1].ip, "127.0.0.1") == 0 && nodes[1].port == 8003);
+
+    struct slot_route *route = slot_get_route(&ctx->slot_table, 0);
+    ASSERT(route != NULL && route->len == 2);
+    ASSERT(route->nodes[1].port == 8003);
 
     PASS(NULL);
 }
@@ -165,11 +219,240 @@ TEST(test_parse_cluster_nodes_fail_slave) {
     int count = parse_cluster_nodes(&redis_data);
     ASSERT(count == 1);
 
-    struct node_info info;
-    ASSERT(slot_get_node_addr(0, &info));
-    ASSERT(strcmp(info.nodes[0].ip, "127.0.0.1") == 0 && info.nodes[0].port == 8001);
-    ASSERT(info.index == 1);
+    struct address nodes[2];
+    ASSERT(slot_get_node_addr(0, nodes, 2) == 1);
+    ASSERT(strcmp(nodes[0].ip, "127.0.0.1") == 0 && nodes[0].port == 8001);
+
+    PASS(NULL);
+}
+
+TEST(test_slot_map_move) {
+    char data[] = "4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 127.0.0.1:8001 "
+                  "master - 0 1464764873814 9 connected 0-1\n"
+                  "41d62ab2b6fdf0f248571ff097c8d770c611cfbc 127.0.0.1:8003 "
+                  "slave 4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 0 1464775965124 3 connected\n"
+                  "a2d62ab2b6fdf0f248571ff097c8d770c611cfbc 127.0.0.1:8002 "
+                  "master - 0 1464764873814 9 connected 2\n";
+
+    struct pos p[] = {{(uint8_t*)data, strlen(data)}};
+    struct pos_array pos = {p, strlen(data), 1, 0};
+    struct redis_data redis_data;
+    redis_data.type = REP_STRING;
+    memcpy(&redis_data.pos, &pos, sizeof(pos));
+    ASSERT(parse_cluster_nodes(&redis_data) == 3);
+
+    struct slot_route *route = slot_get_route(&ctx->slot_table, 2);
+    ASSERT(route != NULL && route->nodes[0].port == 8002);
+    uint64_t version = ctx->slot_table.version;
+
+    // a resolved server stands in for a connection
+    struct connection *server = (struct connection*)&redis_data;
+    slot_get_route(&ctx->slot_table, 0)->servers[0] = server;
+
+    // moved to a known master, slaves are kept
+    ASSERT(slot_map_move(2, "127.0.0.1:8001") == CORVUS_OK);
+    route = slot_get_route(&ctx->slot_table, 2);
+    ASSERT(ctx->slot_table.version != version);
+    ASSERT(route == slot_get_route(&ctx->slot_table, 0));
+    ASSERT(route->len == 2 && route->nodes[1].port == 8003);
+    ASSERT(route->servers[0] == server);
+
+    // already moved
+    version = ctx->slot_table.version;
+    ASSERT(slot_map_move(2, "127.0.0.1:8001") == CORVUS_OK);
+    slot_get_route(&ctx->slot_table, 2);
+    ASSERT(ctx->slot_table.version == version);
+
+    // moved to a new master, or to an uncovered slot
+    ASSERT(slot_map_move(1, "127.0.0.1:8004") == CORVUS_OK);
+    ASSERT(slot_map_move(9, "127.0.0.1:8004") == CORVUS_OK);
+    route = slot_get_route(&ctx->slot_table, 1);
+    ASSERT(route != NULL && route->len == 1 && route->nodes[0].port == 8004);
+    ASSERT(slot_get_route(&ctx->slot_table, 9) == route);
+    ASSERT(slot_get_route(&ctx->slot_table, 0)->nodes[0].port == 8001);
+    ASSERT(slot_get_route(&ctx->slot_table, 0)->servers[0] == server);
+
+    // more moves than the log keeps, the table is copied again
+    for (int i = 0; i <= SLOT_MOVE_LOG; i++) {
+        ASSERT(slot_map_move(5, i % 2 ? "127.0.0.1:8002" : "127.0.0.1:8001") == CORVUS_OK);
+    }
+    ASSERT(slot_get_route(&ctx->slot_table, 5)->nodes[0].port == 8001);
+    ASSERT(slot_get_route(&ctx->slot_table, 0)->servers[0] == NULL);
+    ASSERT(slot_get_route(&ctx->slot_table, 9)->nodes[0].port == 8004);
+
+    struct address nodes[2];
+    ASSERT(slot_get_node_addr(9, nodes, 2) == 1 && nodes[0].port == 8004);
+
+    ASSERT(slot_map_move(REDIS_CLUSTER_SLOTS, "127.0.0.1:8004") == CORVUS_ERR);
+    ASSERT(slot_map_move(3, "127.0.0.1") == CORVUS_ERR);
+
+    // a full update replaces the moved slots
+    ASSERT(parse_cluster_nodes(&redis_data) == 3);
+    ASSERT(slot_get_route(&ctx->slot_table, 2)->nodes[0].port == 8002);
+    ASSERT(slot_get_route(&ctx->slot_table, 1)->nodes[0].port == 8001);
+    ASSERT(slot_get_route(&ctx->slot_table, 9) == NULL);
+    PASS(NULL);
+}
+
+TEST(test_parse_cluster_nodes_large) {
+    int i, masters = 500, size = 256 * 1024, len = 0;
+    char *data = cv_malloc(size);
+
+    // slaves before their masters, 1000 nodes in total
+    for (i = 0; i < masters; i++) {
+        len += snprintf(data + len, size - len, "%040d 10.0.%d.%d:7001 slave %040d "
+                "0 1464775965124 %d connected\n", masters + i, i / 256, i % 256, i, i + 1);
+    }
+    for (i = 0; i < masters; i++) {
+        int start = i * REDIS_CLUSTER_SLOTS / masters;
+        int stop = (i + 1) * REDIS_CLUSTER_SLOTS / masters - 1;
+        len += snprintf(data + len, size - len, "%040d 10.0.%d.%d:7000 master - "
+                "0 1464764873814 %d connected %d %d-%d\n",
+                i, i / 256, i % 256, i + 1, start, start + 1, stop);
+    }
+    ASSERT(len < size);
+
+    struct pos p[] = {{(uint8_t*)data, len}};
+    struct redis_data redis_data;
+    redis_data.type = REP_STRING;
+    redis_data.pos.items = p;
+    redis_data.pos.str_len = len;
+    redis_data.pos.pos_len = 1;
+
+    uint64_t epoch, digest;
+    ASSERT(slot_check_nodes(&redis_data, &epoch, &digest) == REDIS_CLUSTER_SLOTS);
+    ASSERT(epoch == (uint64_t)masters);
+    ASSERT(parse_cluster_nodes(&redis_data) == REDIS_CLUSTER_SLOTS);
+
+    struct address nodes[2];
+    ASSERT(slot_get_node_addr(REDIS_CLUSTER_SLOTS - 1, nodes, 2) == 2);
+    ASSERT(strcmp(nodes[0].ip, "10.0.1.243") == 0 && nodes[0].port == 7000);
+    ASSERT(strcmp(nodes[1].ip, "10.0.1.243") == 0 && nodes[1].port == 7001);
+
+    for (i = 0; i < REDIS_CLUSTER_SLOTS; i += 97) {
+        struct slot_route *route = slot_get_route(&ctx->slot_table, i);
+        ASSERT(route != NULL && route->len == 2);
+        ASSERT(route->nodes[0].port == 7000 && route->nodes[1].port == 7001);
+        ASSERT(strcmp(route->nodes[0].ip, route->nodes[1].ip) == 0);
+    }
+    ASSERT(ctx->slot_table.len == (size_t)masters);
+    ASSERT(slot_get_route(&ctx->slot_table, 0) != slot_get_route(&ctx->slot_table, 33));
+
+    char *list = node_list_get();
+    int count = 1;
+    for (char *c = list; *c != '\0'; c++) {
+        if (*c == ',') count++;
+    }
+    ASSERT(count == 2 * masters);
+    cv_free(list);
+
+    cv_free(data);
+    PASS(NULL);
+}
+
+static int check_nodes(char *data, uint64_t *epoch, uint64_t *digest)
+{
+    struct pos p[] = {{(uint8_t*)data, strlen(data)}};
+    struct redis_data redis_data;
+    redis_data.type = REP_STRING;
+    redis_data.pos.items = p;
+    redis_data.pos.str_len = strlen(data);
+    redis_data.pos.pos_len = 1;
+    return slot_check_nodes(&redis_data, epoch, digest);
+}
+
+TEST(test_slot_check_nodes) {
+    uint64_t epoch, digest, e, d;
+    char m1[] = "4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 127.0.0.1:8001 "
+                "myself,master - 0 1464764873814 9 connected 0-8191 [8192->-a2d6]\n";
+    char m2[] = "a2d62ab2b6fdf0f248571ff097c8d770c611cfbc 127.0.0.1:8002 "
+                "master - 0 1464764873815 12 connected 8192-16383\n";
+    char s1[] = "41d62ab2b6fdf0f248571ff097c8d770c611cfbc 127.0.0.1:8003 "
+                "slave 4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 0 1464775965124 30 connected\n";
+    char data[512];
+
+    snprintf(data, sizeof(data), "%s%s%s", m1, m2, s1);
+    ASSERT(check_nodes(data, &epoch, &digest) == REDIS_CLUSTER_SLOTS);
+    ASSERT(epoch == 12);
+
+    // same view from another node, in another order
+    char m1b[] = "4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 127.0.0.1:8001 "
+                 "master - 0 1464764873999 9 connected 0-8191 [8192->-a2d6]\n";
+    snprintf(data, sizeof(data), "%s%s%s", s1, m2, m1b);
+    ASSERT(check_nodes(data, &e, &d) == REDIS_CLUSTER_SLOTS);
+    ASSERT(e == epoch && d == digest);
+
+    // a stale view
+    snprintf(data, sizeof(data), "%s%s", m1, m2);
+    *strstr(data, "8192-16383") = '9';
+    ASSERT(check_nodes(data, &e, &d) == REDIS_CLUSTER_SLOTS - 1000);
+    ASSERT(d != digest);
+
+    ASSERT(check_nodes("4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 127.0.0.1:8001\n", &e, &d) == CORVUS_ERR);
+    PASS(NULL);
+}
+
+static int listen_local(struct address *addr)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int fd = socket_create_server("127.0.0.1", 0);
+
+    if (fd == -1 || getsockname(fd, (struct sockaddr*)&sa, &len) == -1) return -1;
+    strcpy(addr->ip, "127.0.0.1");
+    addr->port = ntohs(sa.sin_port);
+    return fd;
+}
+
+struct nodes_server {
+    int fd;
+    uint16_t port;
+};
+
+// answer one CLUSTER NODES query, then wait for the client to close
+static void *nodes_server_run(void *data)
+{
+    struct nodes_server *s = data;
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+    char text[256], rep[512], buf[128];
+
+    if (poll(&pfd, 1, SLOT_UPDATE_TIMEOUT) != 1) return NULL;
+    int fd = accept(s->fd, NULL, NULL);
+    if (fd == -1) return NULL;
+
+    int n = snprintf(text, sizeof(text), "4f6d838441c4f652f970cd7570c0cf16bbd0f3a9 "
+            "127.0.0.1:%d myself,master - 0 1464764873814 9 connected 0-16383\n", s->port);
+    n = snprintf(rep, sizeof(rep), "$%d\r\n%s\r\n", n, text);
+    if (read(fd, buf, sizeof(buf)) > 0 && write(fd, rep, n) == n) {
+        while (read(fd, buf, sizeof(buf)) > 0);
+    }
+    close(fd);
+    return NULL;
+}
+
+TEST(test_slot_update_from) {
+    struct address nodes[2];
+    struct nodes_server server;
+    pthread_t thread;
+
+    // the first node accepts but never answers
+    int silent = listen_local(&nodes[0]);
+    server.fd = listen_local(&nodes[1]);
+    server.port = nodes[1].port;
+    ASSERT(silent != -1 && server.fd != -1);
+    ASSERT(pthread_create(&thread, NULL, nodes_server_run, &server) == 0);
+
+    int64_t start = get_time();
+    int count = slot_update_from(ctx, nodes, 2);
+    int64_t elapsed = get_time() - start;
+    pthread_join(thread, NULL);
+    close(silent);
+    close(server.fd);
 
+    ASSERT(count == REDIS_CLUSTER_SLOTS);
+    ASSERT(elapsed < SLOT_UPDATE_TIMEOUT * 1000000LL);
+    struct slot_route *route = slot_get_route(&ctx->slot_table, 100);
+    ASSERT(route != NULL && route->nodes[0].port == nodes[1].port);
     PASS(NULL);
 }
 
@@ -177,8 +460,13 @@ TEST_CASE(test_slot) {
     RUN_TEST(test_slot_get1);
     RUN_TEST(test_slot_get2);
     RUN_TEST(test_slot_get3);
+    RUN_TEST(test_slot_get_split);
     RUN_TEST(test_split_node_description);
     RUN_TEST(test_parse_cluster_nodes);
     RUN_TEST(test_parse_cluster_nodes_slave);
     RUN_TEST(test_parse_cluster_nodes_fail_slave);
+    RUN_TEST(test_parse_cluster_nodes_large);
+    RUN_TEST(test_slot_map_move);
+    RUN_TEST(test_slot_check_nodes);
+    RUN_TEST(test_slot_update_from);
 }
@@ -0,0 +1,75 @@
+#include <string.h>
+#include "test.h"
+#include "corvus.h"
+#include "slotstats.h"
+#include "array.h"
+
+TEST(test_slotstats_record) {
+    struct slot_counter slots[3];
+
+    slotstats_record(&ctx->slotstats, 1, 30, 100);
+    slotstats_record(&ctx->slotstats, 1, 30, 200);
+    slotstats_record(&ctx->slotstats, 3, 40, 4);
+    slotstats_record(&ctx->slotstats, REDIS_CLUSTER_SLOTS - 1, 1, 1);
+
+    slotstats_get(ctx, slots, 1, 3);
+    ASSERT(slots[0].ops == 2);
+    ASSERT(slots[0].req_bytes == 60);
+    ASSERT(slots[0].rep_bytes == 300);
+    ASSERT(slots[1].ops == 0);
+    ASSERT(slots[2].ops == 1 && slots[2].rep_bytes == 4);
+
+    // halved once per interval
+    slotstats_decay(&ctx->slotstats, 1000);
+    slotstats_decay(&ctx->slotstats, 1000 + SLOTSTATS_DECAY_INTERVAL - 1);
+    slotstats_get(ctx, slots, 1, 1);
+    ASSERT(slots[0].ops == 2);
+    slotstats_decay(&ctx->slotstats, 1000 + SLOTSTATS_DECAY_INTERVAL);
+    slotstats_get(ctx, slots, 1, 3);
+    ASSERT(slots[0].ops == 1);
+    ASSERT(slots[0].req_bytes == 30);
+    ASSERT(slots[0].rep_bytes == 150);
+    ASSERT(slots[2].ops == 0 && slots[2].req_bytes == 20);
+    PASS(NULL);
+}
+
+TEST(test_slotstats_merge) {
+    struct test_contexts t;
+    struct slot_counter slots[1];
+
+    test_contexts_init(&t, 2);
+    struct context *ctxs = t.ctxs;
+
+    slotstats_record(&ctxs[0].slotstats, 100, 10, 20);
+    slotstats_record(&ctxs[1].slotstats, 100, 1, 2);
+    slotstats_get(ctxs, slots, 100, 100);
+    ASSERT(slots[0].ops == 2);
+    ASSERT(slots[0].req_bytes == 11);
+    ASSERT(slots[0].rep_bytes == 22);
+
+    test_contexts_free(&t);
+    PASS(NULL);
+}
+
+TEST(test_slotstats_dump) {
+    struct context *ctxs = get_contexts();
+    slotstats_record(&ctxs[0].slotstats, 5, 10, 20);
+    slotstats_record(&ctxs[0].slotstats, 16000, 7, 8);
+
+    struct cvstr buf = cvstr_new(16);
+    size_t n = stats_get_slotstats(&buf);
+    ASSERT(n == strlen(buf.data));
+    ASSERT(strcmp(buf.data, "slot,ops,request_bytes,reply_bytes\n"
+                "5,1,10,20\n16000,1,7,8\n") == 0);
+    cvstr_free(&buf);
+
+    slotstats_free(&ctxs[0].slotstats);
+    slotstats_init(&ctxs[0].slotstats);
+    PASS(NULL);
+}
+
+TEST_CASE(test_slotstats) {
+    RUN_TEST(test_slotstats_record);
+    RUN_TEST(test_slotstats_merge);
+    RUN_TEST(test_slotstats_dump);
+}
@@ -211,9 +211,16 @@ TEST(test_slowlog_statsd) {
     uint32_t *count = dict_get(&slow_counts, "localhost");
     ASSERT(count[CMD_GET] == 1);
     ASSERT(counts_sum[CMD_GET] == 1);
-    ASSERT(slow_cmd_counts[CMD_GET] == 0);
+    ASSERT(slow_cmd_counts[CMD_GET] == 1);
     ASSERT(counts_sum[CMD_MSET] == 2);
 
+    // only new slow commands are counted in the next round
+    slowlog_add_count(cmd);
+    slowlog_prepare_stats(ctx);
+    ASSERT(count[CMD_GET] == 1);
+    ASSERT(counts_sum[CMD_GET] == 1);
+    ASSERT(counts_sum[CMD_MSET] == 0);
+
     cmd_free(cmd);
     cmd_free(multi_key_cmd);
     TAILQ_REMOVE(&ctx->servers, server, next);
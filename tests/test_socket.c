@@ -1,3 +1,7 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "test.h"
 #include "socket.h"
 
@@ -65,9 +69,56 @@ TEST(test_socket_parse_addr_wrong) {
     PASS(NULL);
 }
 
+TEST(test_socket_unix_server) {
+    char path[] = "/tmp/corvus-test.sock";
+    char ip[16];
+    int port = -1;
+    struct stat st;
+    struct sockaddr_un addr;
+
+    // a stale socket file is replaced
+    int fd = socket_create_unix_server(path, 0);
+    ASSERT(fd != -1);
+    close(fd);
+    fd = socket_create_unix_server(path, 0770);
+    ASSERT(fd != -1);
+    ASSERT(stat(path, &st) == 0);
+    ASSERT(S_ISSOCK(st.st_mode));
+    ASSERT((st.st_mode & 0777) == 0770);
+
+    ASSERT(socket_accept(fd, ip, sizeof(ip), &port) == CORVUS_AGAIN);
+
+    int c = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    ASSERT(connect(c, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    int s = socket_accept(fd, ip, sizeof(ip), &port);
+    ASSERT(s >= 0);
+    ASSERT(strcmp(ip, "unix") == 0);
+    ASSERT(port == 0);
+    ASSERT(socket_set_tcpnodelay(s) == CORVUS_OK);
+
+    close(s);
+    close(c);
+    close(fd);
+    unlink(path);
+
+    // never remove a regular file
+    FILE *f = fopen(path, "w");
+    fclose(f);
+    ASSERT(socket_create_unix_server(path, 0) == -1);
+    ASSERT(stat(path, &st) == 0);
+    unlink(path);
+
+    PASS(NULL);
+}
+
 TEST_CASE(test_socket) {
     RUN_TEST(test_socket_address_init);
     RUN_TEST(test_parse_port);
     RUN_TEST(test_socket_parse_addr);
     RUN_TEST(test_socket_parse_addr_wrong);
+    RUN_TEST(test_socket_unix_server);
 }
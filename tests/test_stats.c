@@ -1,18 +1,21 @@
 #include "test.h"
 #include "stats.h"
+#include "array.h"
+#include "hotkey.h"
+#include "bigkey.h"
 
 extern void stats_get_simple(struct stats *stats, bool reset);
 
 void set_stats(struct context *ctx)
 {
-    ctx->stats.completed_commands = 10;
-    ctx->stats.remote_latency = 1000;
-    ctx->stats.total_latency = 10000;
-    ctx->stats.recv_bytes = 16;
-    ctx->stats.send_bytes = 32;
-    ctx->stats.connected_clients = 5;
-    ctx->stats.ask_recv = 233;
-    ctx->stats.moved_recv = 600;
+    ctx->stats.basic.completed_commands += 10;
+    ctx->stats.basic.remote_latency += 1000;
+    ctx->stats.basic.total_latency += 10000;
+    ctx->stats.basic.recv_bytes += 16;
+    ctx->stats.basic.send_bytes += 32;
+    ctx->stats.basic.connected_clients = 5;
+    ctx->stats.basic.ask_recv += 233;
+    ctx->stats.basic.moved_recv += 600;
 }
 
 TEST(test_stats_get_simple_reset) {
@@ -34,13 +37,14 @@ TEST(test_stats_get_simple_reset) {
     ASSERT(stats.basic.ask_recv == 233);
     ASSERT(stats.basic.moved_recv == 600);
 
-    ASSERT(ctxs[0].stats.completed_commands == 0);
-    ASSERT(ctxs[0].stats.remote_latency == 0);
-    ASSERT(ctxs[0].stats.total_latency == 0);
-    ASSERT(ctxs[0].stats.recv_bytes == 0);
-    ASSERT(ctxs[0].stats.send_bytes == 0);
-    ASSERT(ctxs[0].stats.ask_recv == 0);
-    ASSERT(ctxs[0].stats.moved_recv == 0);
+    // counters of workers are never reset
+    ASSERT(ctxs[0].stats.basic.completed_commands == 10);
+    ASSERT(ctxs[0].stats.basic.remote_latency == 1000);
+    ASSERT(ctxs[0].stats.basic.total_latency == 10000);
+    ASSERT(ctxs[0].stats.basic.recv_bytes == 16);
+    ASSERT(ctxs[0].stats.basic.send_bytes == 32);
+    ASSERT(ctxs[0].stats.basic.ask_recv == 233);
+    ASSERT(ctxs[0].stats.basic.moved_recv == 600);
     PASS(NULL);
 }
 
@@ -63,18 +67,202 @@ TEST(test_stats_get_simple_cumulative) {
     ASSERT(stats.basic.ask_recv == 466);
     ASSERT(stats.basic.moved_recv == 1200);
 
-    ASSERT(ctxs[0].stats.completed_commands == 10);
-    ASSERT(ctxs[0].stats.remote_latency == 1000);
-    ASSERT(ctxs[0].stats.total_latency == 10000);
-    ASSERT(ctxs[0].stats.recv_bytes == 16);
-    ASSERT(ctxs[0].stats.send_bytes == 32);
-    ASSERT(ctxs[0].stats.connected_clients == 5);
-    ASSERT(ctxs[0].stats.ask_recv == 233);
-    ASSERT(ctxs[0].stats.moved_recv == 600);
+    // only the counts since last reset
+    memset(&stats, 0, sizeof(stats));
+    stats_get_simple(&stats, true);
+    ASSERT(stats.basic.completed_commands == 10);
+    ASSERT(stats.basic.slot_update_jobs == 2);
+    ASSERT(stats.basic.remote_latency == 1000);
+    ASSERT(stats.basic.total_latency == 10000);
+    ASSERT(stats.basic.recv_bytes == 16);
+    ASSERT(stats.basic.send_bytes == 32);
+    ASSERT(stats.basic.connected_clients == 5);
+    ASSERT(stats.basic.ask_recv == 233);
+    ASSERT(stats.basic.moved_recv == 600);
+    PASS(NULL);
+}
+
+static void *stats_writer(void *data)
+{
+    struct thread_stats *s = data;
+    for (int i = 0; i < 1000000; i++) {
+        stats_write_begin(s);
+        STATS_INCR(s->basic.completed_commands, 1);
+        STATS_INCR(s->basic.total_latency, 10);
+        STATS_SET(s->last_command_latency, s->basic.completed_commands);
+        stats_write_end(s);
+    }
+    return NULL;
+}
+
+TEST(test_stats_snapshot) {
+    struct thread_stats s;
+    struct basic_stats basic;
+    long long last = 0;
+    pthread_t writer;
+
+    memset(&s, 0, sizeof(s));
+    ASSERT(pthread_create(&writer, NULL, stats_writer, &s) == 0);
+    do {
+        stats_snapshot(&s, &basic, &last);
+        ASSERT(basic.total_latency == basic.completed_commands * 10);
+        ASSERT(last == basic.completed_commands);
+    } while (basic.completed_commands < 1000000);
+    pthread_join(writer, NULL);
+
+    ASSERT(s.seq == 2000000);
+    PASS(NULL);
+}
+
+TEST(test_stats_get_metrics) {
+    struct cvstr buf = cvstr_new(16);
+    size_t n = stats_get_metrics(&buf);
+
+    ASSERT(n == strlen(buf.data));
+    ASSERT(strstr(buf.data, "# TYPE corvus_completed_commands_total counter\n"
+                "corvus_completed_commands_total 20\n") != NULL);
+    ASSERT(strstr(buf.data, "corvus_connected_clients 5\n") != NULL);
+    ASSERT(strstr(buf.data, "corvus_moved_recv_total 1200\n") != NULL);
+    ASSERT(strstr(buf.data, "corvus_total_latency_seconds_total 0.000020000\n") != NULL);
+    ASSERT(strstr(buf.data, "# TYPE corvus_in_use_buffers gauge\n") != NULL);
+    ASSERT(strstr(buf.data, "# TYPE corvus_node_slow_queries_total counter\n") != NULL);
+    cvstr_free(&buf);
+    PASS(NULL);
+}
+
+TEST(test_stats_get_latency) {
+    struct context *ctxs = get_contexts();
+    struct command *cmd = cmd_create(&ctxs[0]);
+    cmd->cmd_type = CMD_GET;
+    cmd->rep_time[0] = 1000000;
+    cmd->rep_time[1] = 1300000;
+    stats_record_latency(cmd, 400000);
+
+    cmd->cmd_type = CMD_PING;
+    cmd->rep_time[0] = 0;
+    cmd->rep_time[1] = 0;
+    stats_record_latency(cmd, 20000);
+    cmd_free(cmd);
+
+    struct cvstr info = cvstr_new(16);
+    size_t n = stats_get_latency(&info);
+    ASSERT(n == strlen(info.data));
+    ASSERT(strstr(info.data, "latency_total_usec_get:calls=1,p50=") != NULL);
+    ASSERT(strstr(info.data, "latency_remote_usec_get:calls=1,p50=") != NULL);
+    ASSERT(strstr(info.data, "latency_total_usec_ping:calls=1,p50=20,p99=20,p99.9=20,max=20\r\n") != NULL);
+    ASSERT(strstr(info.data, "latency_remote_usec_ping") == NULL);
+    ASSERT(strstr(info.data, "latency_total_usec_set") == NULL);
+    cvstr_free(&info);
+    PASS(NULL);
+}
+
+TEST(test_stats_get_sizes) {
+    struct context *ctxs = get_contexts();
+    stats_record_size(&ctxs[0], CMD_HGETALL, 30, 1000);
+    stats_record_size(&ctxs[0], CMD_HGETALL, 30, 3000);
+
+    struct cvstr info = cvstr_new(16);
+    size_t n = stats_get_sizes(&info);
+    ASSERT(n == strlen(info.data));
+    ASSERT(strstr(info.data, "size_request_bytes_hgetall:calls=2,p50=30,p99=30,p99.9=30,max=30\r\n") != NULL);
+    ASSERT(strstr(info.data, "size_reply_bytes_hgetall:calls=2,p50=") != NULL);
+    ASSERT(strstr(info.data, "size_reply_bytes_get") == NULL);
+    cvstr_free(&info);
+
+    struct cvstr buf = cvstr_new(16);
+    stats_get_metrics(&buf);
+    ASSERT(strstr(buf.data, "# TYPE corvus_reply_size_bytes gauge\n") != NULL);
+    ASSERT(strstr(buf.data, "corvus_request_size_bytes{command=\"HGETALL\",quantile=\"1\"} 30\n") != NULL);
+    cvstr_free(&buf);
+    PASS(NULL);
+}
+
+// a metrics page must be ASCII to be valid UTF-8 whatever the keys are
+static bool metrics_ascii(const char *data)
+{
+    for (const char *c = data; *c != '\0'; c++) {
+        if ((unsigned char)*c > 0x7e) return false;
+    }
+    return true;
+}
+
+static void sample_key(struct context *ctx, char *key, int len)
+{
+    struct pos p = {.len = len, .str = (uint8_t*)key};
+    struct pos_array arr = {.str_len = len, .items = &p, .pos_len = 1};
+    hotkey_sample(ctx, &arr);
+}
+
+TEST(test_stats_hotkey_labels) {
+    struct context *ctxs = get_contexts();
+    char binary[] = "a\xff\xe4\xb8\"\\%\n\x01";
+    char long1[HOTKEY_KEY_LEN + 8], long2[HOTKEY_KEY_LEN + 8];
+
+    memset(long1, 'k', sizeof(long1));
+    memset(long2, 'k', sizeof(long2));
+    long2[sizeof(long2) - 1] = 'x';
+
+    config.hotkey_sample_rate = 1;
+    sample_key(&ctxs[0], binary, strlen(binary));
+    sample_key(&ctxs[0], long1, sizeof(long1));
+    sample_key(&ctxs[0], long2, sizeof(long2));
+
+    struct cvstr buf = cvstr_new(16);
+    stats_get_metrics(&buf);
+    ASSERT(metrics_ascii(buf.data));
+    ASSERT(strstr(buf.data, "corvus_hotkey_ops{key=\"a%FF%E4%B8\\\"\\\\%25%0A%01\"} 1\n") != NULL);
+
+    // keys sharing the first bytes stay distinct
+    char *a = strstr(buf.data, "kkk...(len=136,hash=");
+    char *b = a != NULL ? strstr(a + 1, "kkk...(len=136,hash=") : NULL;
+    ASSERT(a != NULL && b != NULL && strncmp(a, b, 36) != 0);
+    cvstr_free(&buf);
+
+    config.hotkey_sample_rate = 0;
+    hotkey_init(&ctxs[0].hotkeys);
+    PASS(NULL);
+}
+
+TEST(test_stats_bigkey_labels) {
+    struct context *ctxs = get_contexts();
+    char data[512], key[BIGKEY_KEY_LEN + 9];
+    struct test_bufs bufs;
+
+    memset(key, 'b', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+
+    char *keys[] = {"b\xfe\x7f\xe4", key};
+    for (int i = 0; i < 2; i++) {
+        struct command *cmd = cmd_create(&ctxs[0]);
+        test_get_req(&bufs, data, sizeof(data), cmd, keys[i]);
+        cmd->cmd_type = CMD_GET;
+        cmd->keys = 1;
+        cmd->reply_type = REP_STRING;
+        bigkey_record(cmd, 20, 1000);
+        memset(cmd->req_buf, 0, sizeof(cmd->req_buf));
+        memset(cmd->key_buf, 0, sizeof(cmd->key_buf));
+        cmd_free(cmd);
+    }
+
+    struct cvstr buf = cvstr_new(16);
+    stats_get_metrics(&buf);
+    ASSERT(metrics_ascii(buf.data));
+    ASSERT(strstr(buf.data, "corvus_bigkey_bytes{kind=\"reply\",command=\"GET\","
+                "key=\"b%FE%7F%E4\",node=\"\"} 1000\n") != NULL);
+    ASSERT(strstr(buf.data, "bbb...(len=136)\",node=\"\"} 1000\n") != NULL);
+    cvstr_free(&buf);
+
+    bigkey_reset(ctxs);
     PASS(NULL);
 }
 
 TEST_CASE(test_stats) {
     RUN_TEST(test_stats_get_simple_reset);
     RUN_TEST(test_stats_get_simple_cumulative);
+    RUN_TEST(test_stats_snapshot);
+    RUN_TEST(test_stats_get_metrics);
+    RUN_TEST(test_stats_get_latency);
+    RUN_TEST(test_stats_get_sizes);
+    RUN_TEST(test_stats_hotkey_labels);
+    RUN_TEST(test_stats_bigkey_labels);
 }